@@ -0,0 +1,1075 @@
+#include "ServerInterface.hpp"
+#include "DownloadScheduler.hpp"
+#include "LogDownloader.hpp"
+#include "LogIndexer.hpp"
+#include "LogList.hpp"
+#include "Log.hpp"
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <map>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sqlite3.h>
+#define CPPHTTPLIB_OPENSSL_SUPPORT
+#include <httplib.h>
+
+namespace fs = std::filesystem;
+
+static int bench_upload(const std::vector<uint64_t>& sizes_mb);
+static int bench_database(uint32_t num_rows);
+static int bench_suite(const std::vector<uint32_t>& row_counts);
+static int bench_download(const std::string& connection_url, uint32_t num_downloads, double link_reserve);
+static int bench_fleet(const std::string& connection_url, uint32_t num_vehicles, uint32_t num_downloads);
+static int bench_schedule(const std::string& trace_path);
+static int bench_index(const std::string& logs_directory, uint32_t passes);
+static long peak_rss_kb();
+static std::string bench_date(uint32_t index);
+static void usage();
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		usage();
+		return -1;
+	}
+
+	std::string bench = argv[1];
+
+	if (bench == "upload") {
+		std::vector<uint64_t> sizes_mb;
+
+		for (int i = 2; i < argc; i++) {
+			sizes_mb.push_back(std::stoull(argv[i]));
+		}
+
+		if (sizes_mb.empty()) {
+			sizes_mb = {50, 500, 2048};
+		}
+
+		return bench_upload(sizes_mb);
+
+	} else if (bench == "db") {
+		uint32_t num_rows = argc > 2 ? std::stoul(argv[2]) : 10000;
+		return bench_database(num_rows);
+
+	} else if (bench == "suite") {
+		std::vector<uint32_t> row_counts;
+
+		for (int i = 2; i < argc; i++) {
+			row_counts.push_back(std::stoul(argv[i]));
+		}
+
+		if (row_counts.empty()) {
+			row_counts = {1000, 10000, 100000};
+		}
+
+		return bench_suite(row_counts);
+
+	} else if (bench == "download") {
+		std::string connection_url = argc > 2 ? argv[2] : "udp://:14551";
+		uint32_t num_downloads = argc > 3 ? std::stoul(argv[3]) : 1;
+		double link_reserve = argc > 4 ? std::stod(argv[4]) : DownloadPacer::Settings {}.link_reserve;
+		return bench_download(connection_url, num_downloads, link_reserve);
+
+	} else if (bench == "fleet") {
+		std::string connection_url = argc > 2 ? argv[2] : "udp://:14551";
+		uint32_t num_vehicles = argc > 3 ? std::stoul(argv[3]) : 2;
+		uint32_t num_downloads = argc > 4 ? std::stoul(argv[4]) : 1;
+		return bench_fleet(connection_url, num_vehicles, num_downloads);
+
+	} else if (bench == "schedule") {
+		return bench_schedule(argc > 2 ? argv[2] : "");
+
+	} else if (bench == "index") {
+		uint32_t passes = argc > 3 ? std::stoul(argv[3]) : 3;
+		return bench_index(argc > 2 ? argv[2] : "", passes);
+	}
+
+	usage();
+	return -1;
+}
+
+static void usage()
+{
+	std::cerr << "Usage: logloader_bench <benchmark> [args]\n"
+		  << "  upload [size_mb...]    Peak RSS while uploading logs of the given sizes (default 50 500 2048)\n"
+		  << "  db [rows]              Per-call latency of the database queries (default 10000 rows)\n"
+		  << "  suite [rows...]        Hot path micro-benchmarks at each database size (default 1000 10000 100000)\n"
+		  << "  download [url] [n] [reserve]\n"
+		  << "                         List fetch time, TTFB and throughput of the n newest logs from a vehicle\n"
+		  << "                         or logloader_emulator, and the link estimates of the request pacing\n"
+		  << "                         (default udp://:14551 1 0.2)\n"
+		  << "  fleet [url] [vehicles] [n]\n"
+		  << "                         Aggregate throughput downloading the n newest logs from each of several\n"
+		  << "                         vehicles at once (default udp://:14551 2 1)\n"
+		  << "  schedule [trace]       Replays a download_trace file with every download policy, a generated\n"
+		  << "                         fleet day when no trace is given\n"
+		  << "  index [dir] [passes]   ULog metadata scan speed over the logs of a directory, generated logs when\n"
+		  << "                         no directory is given (default 3 passes)\n";
+}
+
+static long peak_rss_kb()
+{
+	struct rusage usage {};
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+static std::string bench_date(uint32_t index)
+{
+	// One log every ten minutes starting 2020-01-01
+	time_t t = 1577836800 + time_t(index) * 600;
+	char buf[32];
+	strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+	return buf;
+}
+
+template<typename Func>
+static double microseconds_per_call(uint32_t iterations, Func&& func)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for (uint32_t i = 0; i < iterations; i++) {
+		func(i);
+	}
+
+	std::chrono::duration<double, std::micro> duration = std::chrono::steady_clock::now() - start;
+	return duration.count() / iterations;
+}
+
+// Baseline: prepare, step and finalize on every call like the queries used to
+static void uncached_query(sqlite3* db, const char* query, const std::string* uuid)
+{
+	sqlite3_stmt* stmt;
+
+	if (sqlite3_prepare_v2(db, query, -1, &stmt, nullptr) != SQLITE_OK) {
+		return;
+	}
+
+	if (uuid) {
+		sqlite3_bind_text(stmt, 1, uuid->c_str(), -1, SQLITE_STATIC);
+	}
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {}
+
+	sqlite3_finalize(stmt);
+}
+
+// Compares the cached prepared statements in Database against preparing the same
+// query on every call, on a database with num_rows logs.
+static int bench_database(uint32_t num_rows)
+{
+	fs::path bench_dir = fs::temp_directory_path() / ("logloader_bench_" + std::to_string(getpid()));
+	fs::create_directories(bench_dir);
+
+	Database::Settings settings = {
+		.db_path = (bench_dir / "bench.db").string(),
+		.logs_directory = (bench_dir / "logs").string() + "/",
+	};
+
+	Database database(settings);
+	const std::string backend_id = "bench";
+	database.register_backend(backend_id);
+
+	// Populate the database in a single transaction through a second connection
+	sqlite3* db = nullptr;
+	sqlite3_open(settings.db_path.c_str(), &db);
+	sqlite3_exec(db, "BEGIN", nullptr, nullptr, nullptr);
+
+	sqlite3_stmt* insert_log;
+	sqlite3_prepare_v2(db, "INSERT INTO logs (uuid, id, date, size_bytes, downloaded) VALUES (?, ?, ?, ?, ?)", -1,
+			   &insert_log, nullptr);
+	sqlite3_stmt* insert_blacklist;
+	sqlite3_prepare_v2(db, "INSERT INTO uploads (backend_id, uuid, state, attempts, message, updated_at) "
+			   "VALUES ('bench', ?, 2, 1, 'bench', '')", -1, &insert_blacklist, nullptr);
+
+	std::vector<mavsdk::LogFiles::Entry> entries;
+	std::vector<std::string> uuids;
+
+	for (uint32_t i = 0; i < num_rows; i++) {
+		mavsdk::LogFiles::Entry entry;
+		entry.id = i;
+		entry.date = bench_date(i);
+		entry.size_bytes = 100000 + i;
+		entries.push_back(entry);
+		uuids.push_back(Database::generate_uuid(entry));
+
+		sqlite3_bind_text(insert_log, 1, uuids.back().c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_int(insert_log, 2, entry.id);
+		sqlite3_bind_text(insert_log, 3, entry.date.c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_int(insert_log, 4, entry.size_bytes);
+		sqlite3_bind_int(insert_log, 5, i % 2);
+		sqlite3_step(insert_log);
+		sqlite3_reset(insert_log);
+
+		if (i % 100 == 0) {
+			sqlite3_bind_text(insert_blacklist, 1, uuids.back().c_str(), -1, SQLITE_STATIC);
+			sqlite3_step(insert_blacklist);
+			sqlite3_reset(insert_blacklist);
+		}
+	}
+
+	sqlite3_finalize(insert_log);
+	sqlite3_finalize(insert_blacklist);
+	sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr);
+
+	auto report = [num_rows](const char* query, uint32_t iterations, double uncached_us, double cached_us) {
+		LOG("db rows=" << num_rows
+		    << " query=" << query
+		    << " iterations=" << iterations
+		    << " uncached_us=" << std::fixed << std::setprecision(2) << uncached_us
+		    << " cached_us=" << cached_us
+		    << " speedup=" << uncached_us / cached_us);
+	};
+
+	const uint32_t lookups = 10000;
+	const uint32_t scans = 100;
+
+	report("add_log_entry_existing", lookups,
+	microseconds_per_call(lookups, [&](uint32_t i) {
+		uncached_query(db, "INSERT INTO logs (uuid, id, date, size_bytes, downloaded) VALUES (?, 0, '', 0, 0) "
+			       "ON CONFLICT(uuid) DO NOTHING", &uuids[i % num_rows]);
+	}),
+	microseconds_per_call(lookups, [&](uint32_t i) {
+		database.add_log_entry(entries[i % num_rows]);
+	}));
+
+	report("is_blacklisted", lookups,
+	microseconds_per_call(lookups, [&](uint32_t i) {
+		uncached_query(db, "SELECT COUNT(*) FROM uploads WHERE backend_id = 'bench' AND uuid = ? AND state = 2",
+			       &uuids[i % num_rows]);
+	}),
+	microseconds_per_call(lookups, [&](uint32_t i) {
+		database.is_blacklisted(backend_id, uuids[i % num_rows]);
+	}));
+
+	report("filepath_from_uuid", lookups,
+	microseconds_per_call(lookups, [&](uint32_t i) {
+		uncached_query(db, "SELECT id, date FROM logs WHERE uuid = ?", &uuids[i % num_rows]);
+	}),
+	microseconds_per_call(lookups, [&](uint32_t i) {
+		database.filepath_from_uuid(uuids[i % num_rows]);
+	}));
+
+	report("num_logs_to_upload", scans,
+	microseconds_per_call(scans, [&](uint32_t) {
+		uncached_query(db, "SELECT COUNT(*) FROM logs l WHERE l.downloaded = 1 AND NOT EXISTS "
+			       "(SELECT 1 FROM uploads u WHERE u.backend_id = 'bench' AND u.uuid = l.uuid AND u.state != 0)", nullptr);
+	}),
+	microseconds_per_call(scans, [&](uint32_t) {
+		database.num_logs_to_upload(backend_id);
+	}));
+
+	report("get_next_log_to_upload", scans,
+	microseconds_per_call(scans, [&](uint32_t) {
+		uncached_query(db, "SELECT uuid, id, date, size_bytes, downloaded FROM logs l WHERE l.downloaded = 1 AND NOT EXISTS "
+			       "(SELECT 1 FROM uploads u WHERE u.backend_id = 'bench' AND u.uuid = l.uuid AND u.state != 0) "
+			       "ORDER BY date DESC, size_bytes DESC LIMIT 1", nullptr);
+	}),
+	microseconds_per_call(scans, [&](uint32_t) {
+		database.get_next_log_to_upload(backend_id);
+	}));
+
+	report("num_logs_to_download", scans,
+	microseconds_per_call(scans, [&](uint32_t) {
+		uncached_query(db, "SELECT COUNT(*) FROM logs WHERE downloaded = 0", nullptr);
+	}),
+	microseconds_per_call(scans, [&](uint32_t) {
+		database.num_logs_to_download();
+	}));
+
+	report("get_next_log_to_download", scans,
+	microseconds_per_call(scans, [&](uint32_t) {
+		uncached_query(db, "SELECT uuid, id, date, size_bytes, downloaded FROM logs WHERE downloaded = 0 "
+			       "ORDER BY date DESC, size_bytes DESC LIMIT 1", nullptr);
+	}),
+	microseconds_per_call(scans, [&](uint32_t) {
+		database.get_next_log_to_download();
+	}));
+
+	sqlite3_close(db);
+	fs::remove_all(bench_dir);
+
+	return 0;
+}
+
+// Times the database, UUID and filename hot paths on a temporary database filled with num_rows logs,
+// half of them downloaded. Prints one line per operation:
+//   suite op=<name> rows=<n> iterations=<k> ns_per_op=<mean> ops_per_sec=<rate>
+static void bench_suite_rows(uint32_t num_rows)
+{
+	fs::path bench_dir = fs::temp_directory_path() / ("logloader_bench_" + std::to_string(getpid()));
+	fs::create_directories(bench_dir);
+
+	Database::Settings settings = {
+		.db_path = (bench_dir / "bench.db").string(),
+		.logs_directory = (bench_dir / "logs").string() + "/",
+	};
+
+	auto database = std::make_shared<Database>(settings);
+	const std::string backend_id = "bench";
+	database->register_backend(backend_id);
+
+	auto make_entry = [](uint32_t index) {
+		mavsdk::LogFiles::Entry entry;
+		entry.id = index;
+		entry.date = bench_date(index);
+		entry.size_bytes = 100000 + index;
+		return entry;
+	};
+
+	std::vector<mavsdk::LogFiles::Entry> entries;
+	std::vector<std::string> uuids;
+	std::vector<std::string> filepaths;
+
+	for (uint32_t i = 0; i < num_rows; i++) {
+		entries.push_back(make_entry(i));
+		uuids.push_back(Database::generate_uuid(entries.back()));
+		filepaths.push_back(database->filepath_from_entry(entries.back()));
+	}
+
+	database->add_log_entries(entries);
+
+	// Mark every other log downloaded in one statement, the triggers fill the upload queue
+	sqlite3* db = nullptr;
+	sqlite3_open(settings.db_path.c_str(), &db);
+	sqlite3_exec(db, "UPDATE logs SET downloaded = 1 WHERE id % 2 = 0", nullptr, nullptr, nullptr);
+	sqlite3_close(db);
+
+	auto report = [num_rows](const char* op, uint32_t iterations, double us_per_op) {
+		LOG("suite op=" << op
+		    << " rows=" << num_rows
+		    << " iterations=" << iterations
+		    << " ns_per_op=" << std::fixed << std::setprecision(1) << us_per_op * 1000
+		    << " ops_per_sec=" << std::setprecision(0) << 1e6 / us_per_op);
+	};
+
+	const uint32_t fast = 100000;
+	const uint32_t lookups = 10000;
+	const uint32_t writes = 200;
+
+	report("generate_uuid", fast, microseconds_per_call(fast, [&](uint32_t i) {
+		Database::generate_uuid(entries[i % num_rows]);
+	}));
+
+	report("uuid_hash", fast, microseconds_per_call(fast, [&](uint32_t i) {
+		Database::uuid_hash(entries[i % num_rows]);
+	}));
+
+	report("parse_log_filename", fast, microseconds_per_call(fast, [&](uint32_t i) {
+		mavsdk::LogFiles::Entry entry;
+		ServerInterface::parse_log_filename(filepaths[i % num_rows], entry);
+	}));
+
+	report("filepath_from_uuid", lookups, microseconds_per_call(lookups, [&](uint32_t i) {
+		database->filepath_from_uuid(uuids[i % num_rows]);
+	}));
+
+	report("log_exists", lookups, microseconds_per_call(lookups, [&](uint32_t i) {
+		database->log_exists(uuids[i % num_rows]);
+	}));
+
+	report("add_log_entry_existing", lookups, microseconds_per_call(lookups, [&](uint32_t i) {
+		database->add_log_entry(entries[i % num_rows]);
+	}));
+
+	report("num_logs_to_download", lookups, microseconds_per_call(lookups, [&](uint32_t) {
+		database->num_logs_to_download();
+	}));
+
+	report("get_next_log_to_download", lookups, microseconds_per_call(lookups, [&](uint32_t) {
+		database->get_next_log_to_download();
+	}));
+
+	report("num_logs_to_upload", lookups, microseconds_per_call(lookups, [&](uint32_t) {
+		database->num_logs_to_upload(backend_id);
+	}));
+
+	report("get_next_log_to_upload", lookups, microseconds_per_call(lookups, [&](uint32_t) {
+		database->get_next_log_to_upload(backend_id);
+	}));
+
+	report("get_logs_to_upload_16", lookups, microseconds_per_call(lookups, [&](uint32_t) {
+		database->get_logs_to_upload(backend_id, 16);
+	}));
+
+	// Writes commit on every call, these are dominated by the journal sync
+	report("add_log_entry_new", writes, microseconds_per_call(writes, [&](uint32_t i) {
+		database->add_log_entry(make_entry(num_rows + i));
+	}));
+
+	std::vector<mavsdk::LogFiles::Entry> batch;
+
+	for (uint32_t i = 0; i < 1000; i++) {
+		batch.push_back(make_entry(num_rows + writes + i));
+	}
+
+	report("add_log_entries_1000", 1, microseconds_per_call(1, [&](uint32_t) {
+		database->add_log_entries(batch);
+	}));
+
+	report("download_complete", writes, microseconds_per_call(writes, [&](uint32_t i) {
+		database->update_download_status(uuids[(2 * i + 1) % num_rows], true);
+	}));
+
+	report("dequeue_upload", writes, microseconds_per_call(writes, [&](uint32_t) {
+		Database::LogEntry entry = database->get_next_log_to_upload(backend_id);
+		database->set_upload_state(backend_id, entry.uuid, Database::UploadState::Uploaded);
+	}));
+
+	database.reset();
+	fs::remove_all(bench_dir);
+}
+
+static int bench_suite(const std::vector<uint32_t>& row_counts)
+{
+	for (uint32_t num_rows : row_counts) {
+		if (num_rows == 0) {
+			continue;
+		}
+
+		bench_suite_rows(num_rows);
+	}
+
+	return 0;
+}
+
+// Uploads sparse files of increasing size to an in-process HTTP server that discards the
+// received bytes. Since ru_maxrss is a high water mark it should stay flat across all sizes.
+static int bench_upload(const std::vector<uint64_t>& sizes_mb)
+{
+	fs::path bench_dir = fs::temp_directory_path() / ("logloader_bench_" + std::to_string(getpid()));
+	fs::path logs_dir = bench_dir / "logs";
+	fs::create_directories(logs_dir);
+
+	httplib::Server server;
+	uint64_t bytes_received = 0;
+
+	server.Get("/", [](const httplib::Request&, httplib::Response& res) {
+		res.status = 200;
+	});
+
+	server.Post("/upload", [&bytes_received](const httplib::Request&, httplib::Response& res, const httplib::ContentReader& reader) {
+		reader([](const httplib::MultipartFormData&) { return true; },
+		[&bytes_received](const char*, size_t length) {
+			bytes_received += length;
+			return true;
+		});
+		res.status = 302;
+		res.set_header("Location", "/plot_app?log=bench");
+	});
+
+	int port = server.bind_to_any_port("127.0.0.1");
+	std::thread server_thread([&server] { server.listen_after_bind(); });
+	server.wait_until_ready();
+
+	Database::Settings database_settings = {
+		.db_path = (bench_dir / "bench.db").string(),
+		.logs_directory = logs_dir.string() + "/",
+	};
+
+	ServerInterface::Settings settings = {
+		.name = "bench",
+		.server_url = "http://127.0.0.1:" + std::to_string(port),
+		.user_email = "",
+		.upload_enabled = true,
+		.public_logs = false,
+	};
+
+	ServerInterface server_interface(settings, std::make_shared<Database>(database_settings));
+
+	LOG("baseline peak_rss_kb=" << peak_rss_kb());
+
+	int result = 0;
+	uint32_t id = 0;
+
+	for (uint64_t size_mb : sizes_mb) {
+		// Sparse file, reads back as zeros without needing the disk space
+		fs::path filepath = logs_dir / ("LOG" + std::to_string(1000 + id++) + "_2024-01-01T00:00:00Z.ulg");
+		std::ofstream(filepath).close();
+		fs::resize_file(filepath, size_mb * 1024 * 1024);
+
+		bytes_received = 0;
+		auto start = std::chrono::steady_clock::now();
+		ServerInterface::UploadResult upload_result = server_interface.upload_log(filepath.string());
+		std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+		LOG("upload size_mb=" << size_mb
+		    << " success=" << upload_result.success
+		    << " bytes_received=" << bytes_received
+		    << " seconds=" << std::fixed << std::setprecision(3) << duration.count()
+		    << " peak_rss_kb=" << peak_rss_kb());
+
+		if (!upload_result.success) {
+			result = -1;
+		}
+
+		fs::remove(filepath);
+	}
+
+	server.stop();
+	server_thread.join();
+	fs::remove_all(bench_dir);
+
+	return result;
+}
+
+// Lists and downloads logs from a real vehicle or logloader_emulator through the same code paths
+// logloader uses, reporting the time to fetch the log list, the time to first byte and the
+// end to end throughput of each download. Against an emulator with --bandwidth-kbps the throughput
+// shows the share of the link the pacing takes for the given link reserve.
+static int bench_download(const std::string& connection_url, uint32_t num_downloads, double link_reserve)
+{
+	auto mavsdk = std::make_shared<mavsdk::Mavsdk>(mavsdk::Mavsdk::Configuration(1, MAV_COMP_ID_ONBOARD_COMPUTER, true));
+
+	if (mavsdk->add_any_connection(connection_url) != mavsdk::ConnectionResult::Success) {
+		LOG("Connection failed: " << connection_url);
+		return -1;
+	}
+
+	auto system = mavsdk->first_autopilot(10.0);
+
+	if (!system) {
+		LOG("Timed out waiting for system");
+		return -1;
+	}
+
+	auto log_files = std::make_shared<mavsdk::LogFiles>(system.value());
+	auto passthrough = std::make_shared<mavsdk::MavlinkPassthrough>(system.value());
+	LogList log_list(log_files, passthrough, LogList::Settings {});
+
+	for (const char* op : {"list", "list_incremental"}) {
+		auto start = std::chrono::steady_clock::now();
+		LogList::Result result = log_list.refresh();
+		std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+		if (result == LogList::Result::Failed) {
+			LOG("Failed to fetch the log list");
+			return -1;
+		}
+
+		LOG("download op=" << op
+		    << " logs=" << log_list.entries().size()
+		    << " seconds=" << std::fixed << std::setprecision(3) << duration.count());
+	}
+
+	fs::path bench_dir = fs::temp_directory_path() / ("logloader_bench_" + std::to_string(getpid()));
+	fs::create_directories(bench_dir);
+
+	LogDownloader::Settings downloader_settings = {};
+	downloader_settings.pacing.link_reserve = link_reserve;
+
+	LogDownloader downloader(passthrough, downloader_settings);
+	const auto& entries = log_list.entries();
+	int result = 0;
+
+	for (uint32_t i = 0; i < num_downloads && i < entries.size(); i++) {
+		const auto& entry = entries[entries.size() - 1 - i];
+		fs::path path = bench_dir / ("LOG" + std::to_string(entry.id) + ".ulg");
+
+		// Progress is first reported once data has been written, which marks the first byte
+		auto start = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point first_byte {};
+
+		LogDownloader::Result download_result = downloader.download(entry, path.string(), [&](float) {
+			if (first_byte == std::chrono::steady_clock::time_point {}) {
+				first_byte = std::chrono::steady_clock::now();
+			}
+		});
+
+		std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+		std::chrono::duration<double, std::milli> ttfb = first_byte - start;
+
+		LOG("download op=transfer id=" << entry.id
+		    << " success=" << (download_result == LogDownloader::Result::Success)
+		    << " bytes=" << entry.size_bytes
+		    << " seconds=" << std::fixed << std::setprecision(3) << duration.count()
+		    << " kbytes_per_sec=" << entry.size_bytes / 1024.0 / duration.count()
+		    << " ttfb_ms=" << (first_byte == std::chrono::steady_clock::time_point {} ? -1.0 : ttfb.count()));
+
+		const DownloadPacer& pacer = downloader.pacer();
+		std::chrono::duration<double, std::milli> rtt = pacer.smoothed_rtt();
+
+		LOG("download op=pacing id=" << entry.id
+		    << " reserve=" << std::setprecision(2) << link_reserve
+		    << " bandwidth_kbytes_per_sec=" << std::setprecision(3) << pacer.bandwidth() / 1024
+		    << " window_bytes=" << pacer.window_bytes()
+		    << " rtt_ms=" << rtt.count()
+		    << " loss=" << pacer.loss());
+
+		if (download_result != LogDownloader::Result::Success) {
+			result = -1;
+		}
+
+		fs::remove(path);
+		fs::remove(LogDownloader::journal_path(path.string()));
+	}
+
+	fs::remove_all(bench_dir);
+
+	return result;
+}
+
+// Downloads from several vehicles on one connection at the same time, one thread per vehicle like
+// logloader's download workers, and reports the throughput of each vehicle and of the fleet.
+static int bench_fleet(const std::string& connection_url, uint32_t num_vehicles, uint32_t num_downloads)
+{
+	auto mavsdk = std::make_shared<mavsdk::Mavsdk>(mavsdk::Mavsdk::Configuration(1, MAV_COMP_ID_ONBOARD_COMPUTER, true));
+
+	if (mavsdk->add_any_connection(connection_url) != mavsdk::ConnectionResult::Success) {
+		LOG("Connection failed: " << connection_url);
+		return -1;
+	}
+
+	std::vector<std::shared_ptr<mavsdk::System>> systems;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+	while (systems.size() < num_vehicles && std::chrono::steady_clock::now() < deadline) {
+		systems.clear();
+
+		for (auto& system : mavsdk->systems()) {
+			if (system->has_autopilot()) {
+				systems.push_back(system);
+			}
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	if (systems.size() < num_vehicles) {
+		LOG("Timed out waiting for " << num_vehicles << " systems, found " << systems.size());
+		return -1;
+	}
+
+	systems.resize(num_vehicles);
+
+	fs::path bench_dir = fs::temp_directory_path() / ("logloader_bench_" + std::to_string(getpid()));
+	fs::create_directories(bench_dir);
+
+	std::atomic<uint64_t> total_bytes = 0;
+	std::atomic<bool> failed = false;
+	std::vector<std::thread> threads;
+	auto start = std::chrono::steady_clock::now();
+
+	for (auto& system : systems) {
+		threads.emplace_back([&, system] {
+			uint8_t vehicle_id = system->get_system_id();
+			auto log_files = std::make_shared<mavsdk::LogFiles>(system);
+			auto passthrough = std::make_shared<mavsdk::MavlinkPassthrough>(system);
+
+			LogList::Settings list_settings = {};
+			list_settings.vehicle_id = vehicle_id;
+			LogList log_list(log_files, passthrough, list_settings);
+			LogDownloader downloader(passthrough, LogDownloader::Settings {});
+
+			auto vehicle_start = std::chrono::steady_clock::now();
+
+			if (log_list.refresh() == LogList::Result::Failed) {
+				LOG("Failed to fetch the log list of system " << int(vehicle_id));
+				failed = true;
+				return;
+			}
+
+			const auto& entries = log_list.entries();
+			uint64_t bytes = 0;
+
+			for (uint32_t i = 0; i < num_downloads && i < entries.size(); i++) {
+				const auto& entry = entries[entries.size() - 1 - i];
+				fs::path path = bench_dir / ("sys" + std::to_string(vehicle_id) + "_LOG" + std::to_string(entry.id) + ".ulg");
+
+				if (downloader.download(entry, path.string(), [](float) {}) == LogDownloader::Result::Success) {
+					bytes += entry.size_bytes;
+
+				} else {
+					failed = true;
+				}
+
+				fs::remove(path);
+				fs::remove(LogDownloader::journal_path(path.string()));
+			}
+
+			std::chrono::duration<double> duration = std::chrono::steady_clock::now() - vehicle_start;
+			total_bytes += bytes;
+
+			LOG("fleet op=vehicle sysid=" << int(vehicle_id)
+			    << " logs=" << entries.size()
+			    << " bytes=" << bytes
+			    << " seconds=" << std::fixed << std::setprecision(3) << duration.count()
+			    << " kbytes_per_sec=" << bytes / 1024.0 / duration.count());
+		});
+	}
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+	LOG("fleet op=total vehicles=" << num_vehicles
+	    << " bytes=" << total_bytes
+	    << " seconds=" << std::fixed << std::setprecision(3) << duration.count()
+	    << " kbytes_per_sec=" << total_bytes / 1024.0 / duration.count());
+
+	fs::remove_all(bench_dir);
+
+	return failed ? -1 : 0;
+}
+
+// A day of flights with mostly small logs and the occasional multi gigabyte one, flights leave one
+// to three logs behind, turnarounds of 2 to 15 minutes over a link of about 1 MB/s
+static std::vector<DownloadScheduler::TraceEvent> synthetic_trace()
+{
+	using Type = DownloadScheduler::TraceEvent::Type;
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<double> flight_seconds(600, 1800);
+	std::uniform_real_distribution<double> window_seconds(120, 900);
+	std::uniform_real_distribution<double> link_variation(0.7, 1.3);
+	std::uniform_real_distribution<double> unit(0, 1);
+	std::uniform_int_distribution<int> logs_per_flight(1, 3);
+
+	std::vector<DownloadScheduler::TraceEvent> events;
+	double time = 0;
+
+	for (uint32_t flight = 0; flight < 100; flight++) {
+		events.push_back({time, 1, Type::Arm, 0, 0});
+		time += flight_seconds(rng);
+		events.push_back({time, 1, Type::Disarm, 0, 0});
+
+		for (int i = logs_per_flight(rng); i > 0; i--) {
+			double kind = unit(rng);
+			uint64_t size = kind < 0.8 ? uint64_t(1e6 + unit(rng) * 19e6)
+					: kind < 0.95 ? uint64_t(50e6 + unit(rng) * 150e6)
+					: uint64_t(1e9 + unit(rng) * 1e9);
+
+			events.push_back({time + 3, 1, Type::Log, size, 0});
+		}
+
+		// One measurement per window stands in for the link speed during it
+		events.push_back({time + 5, 1, Type::Download, uint64_t(60e6 * link_variation(rng)), 60});
+		time += window_seconds(rng);
+	}
+
+	events.push_back({time, 1, Type::Arm, 0, 0});
+
+	return events;
+}
+
+struct ScheduleResult {
+	uint32_t logs;
+	uint32_t completed;
+	uint64_t completed_bytes;
+	uint32_t on_time;        // Completed before the vehicle armed again after finding the log
+	uint64_t on_time_bytes;
+	double wait_seconds;     // Summed over completed logs, from finding the log to having it
+};
+
+// Replays the windows of one vehicle, downloads run at the throughput measured during each window
+static void simulate_vehicle(const std::vector<DownloadScheduler::TraceEvent>& events, DownloadScheduler::Policy policy,
+			     ScheduleResult& result)
+{
+	using Type = DownloadScheduler::TraceEvent::Type;
+
+	struct PendingLog {
+		Database::LogEntry entry;
+		double found;
+		uint64_t remaining;
+		bool missed_window;
+	};
+
+	DownloadScheduler::Settings settings = {};
+	settings.policy = policy;
+	DownloadScheduler scheduler(settings);
+
+	auto time_point = [](double seconds) {
+		return DownloadScheduler::Clock::time_point(std::chrono::duration_cast<DownloadScheduler::Clock::duration>(
+					std::chrono::duration<double>(seconds)));
+	};
+
+	std::vector<PendingLog> pending; // Newest first
+	double link_throughput = settings.initial_throughput;
+	double window_start = 0;
+	bool in_window = false;
+
+	for (const auto& event : events) {
+		switch (event.type) {
+		case Type::Log: {
+			PendingLog log = {};
+			log.entry.uuid = std::to_string(result.logs++);
+			log.entry.size_bytes = event.bytes;
+			log.found = event.time;
+			log.remaining = event.bytes;
+			pending.insert(pending.begin(), log);
+			break;
+		}
+
+		case Type::Download:
+			if (event.bytes > 0 && event.seconds > 0) {
+				link_throughput = event.bytes / event.seconds;
+			}
+
+			break;
+
+		case Type::Disarm:
+			in_window = true;
+			window_start = event.time;
+			scheduler.disarmed(time_point(event.time));
+			break;
+
+		case Type::Arm: {
+			if (!in_window) {
+				break;
+			}
+
+			double now = window_start;
+
+			while (now < event.time && !pending.empty()) {
+				std::vector<DownloadScheduler::Candidate> candidates;
+
+				for (const auto& log : pending) {
+					candidates.push_back({log.entry, log.remaining});
+				}
+
+				size_t index = scheduler.choose(candidates, time_point(now));
+				PendingLog& log = pending[index];
+				double seconds = log.remaining / link_throughput;
+
+				if (now + seconds > event.time) {
+					// Resumed from the journal in the next window
+					log.remaining -= std::min<uint64_t>(log.remaining, uint64_t((event.time - now) * link_throughput));
+					break;
+				}
+
+				now += seconds;
+				scheduler.download_finished(log.remaining, seconds);
+
+				result.completed++;
+				result.completed_bytes += log.entry.size_bytes;
+				result.wait_seconds += now - log.found;
+
+				if (!log.missed_window) {
+					result.on_time++;
+					result.on_time_bytes += log.entry.size_bytes;
+				}
+
+				pending.erase(pending.begin() + index);
+			}
+
+			for (auto& log : pending) {
+				log.missed_window = true;
+			}
+
+			scheduler.armed(time_point(event.time));
+			in_window = false;
+			break;
+		}
+		}
+	}
+}
+
+// Compares the download policies on recorded or generated arm/disarm windows, log sizes and link
+// throughput, printing one line per policy
+static int bench_schedule(const std::string& trace_path)
+{
+	std::vector<DownloadScheduler::TraceEvent> events;
+
+	if (trace_path.empty()) {
+		events = synthetic_trace();
+
+	} else if (!DownloadScheduler::load_trace(trace_path, events)) {
+		return -1;
+	}
+
+	// Vehicles are scheduled independently
+	std::map<uint8_t, std::vector<DownloadScheduler::TraceEvent>> vehicles;
+
+	for (const auto& event : events) {
+		vehicles[event.vehicle_id].push_back(event);
+	}
+
+	for (auto& [vehicle_id, vehicle_events] : vehicles) {
+		std::stable_sort(vehicle_events.begin(), vehicle_events.end(), [](const auto& a, const auto& b) {
+			return a.time < b.time;
+		});
+	}
+
+	using Policy = DownloadScheduler::Policy;
+
+	for (Policy policy : {Policy::NewestFirst, Policy::SmallestFirst, Policy::Deadline}) {
+		ScheduleResult result = {};
+
+		for (const auto& [vehicle_id, vehicle_events] : vehicles) {
+			simulate_vehicle(vehicle_events, policy, result);
+		}
+
+		LOG("schedule policy=" << DownloadScheduler::policy_name(policy)
+		    << " vehicles=" << vehicles.size()
+		    << " logs=" << result.logs
+		    << " completed=" << result.completed
+		    << " completed_mb=" << std::fixed << std::setprecision(1) << result.completed_bytes / 1e6
+		    << " on_time=" << result.on_time
+		    << " on_time_mb=" << result.on_time_bytes / 1e6
+		    << " mean_wait_s=" << (result.completed ? result.wait_seconds / result.completed : 0.0));
+	}
+
+	return 0;
+}
+
+// Appends one ULog message, header and payload
+static void write_ulog_message(std::ofstream& file, char type, const std::string& payload)
+{
+	uint16_t size = payload.size();
+	file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+	file.put(type);
+	file.write(payload.data(), payload.size());
+}
+
+template<typename T>
+static std::string ulog_bytes(T value)
+{
+	return std::string(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// A PX4 like log of about size_mb: a handful of topics logged round robin, 1 kHz in total
+static void write_synthetic_ulog(const fs::path& path, uint64_t size_mb)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+	const char magic[] = {'U', 'L', 'o', 'g', 0x01, 0x12, 0x35, 0x01};
+	uint64_t start_us = 20000000;
+	file.write(magic, sizeof(magic));
+	file.write(reinterpret_cast<const char*>(&start_us), sizeof(start_us));
+
+	const char* topics[] = {"sensor_combined", "vehicle_attitude", "vehicle_local_position", "actuator_outputs", "battery_status"};
+	const size_t num_topics = sizeof(topics) / sizeof(topics[0]);
+
+	for (const char* topic : topics) {
+		write_ulog_message(file, 'F', std::string(topic) + ":uint64_t timestamp;float[20] values;uint8_t[4] _padding0;");
+	}
+
+	auto write_info = [&file](const std::string& key, const std::string& value) {
+		write_ulog_message(file, 'I', std::string(1, char(key.size())) + key + value);
+	};
+
+	write_info("char[8] ver_hw", "ARKV6X\0\0");
+	write_info("char[40] ver_sw", "0123456789abcdef0123456789abcdef01234567");
+	write_info("uint32_t ver_sw_release", ulog_bytes<uint32_t>(0x010F00FF));
+	write_info("char[24] sys_uuid", "000600000000313233343536");
+
+	for (uint16_t msg_id = 0; msg_id < num_topics; msg_id++) {
+		write_ulog_message(file, 'A', std::string(1, '\0') + ulog_bytes(msg_id) + topics[msg_id]);
+	}
+
+	std::string data(2 + 8 + 20 * 4 + 4, '\0');
+	uint64_t target_bytes = size_mb * 1024 * 1024;
+	uint64_t timestamp = start_us;
+
+	for (uint64_t i = 0; uint64_t(file.tellp()) < target_bytes; i++) {
+		uint16_t msg_id = i % num_topics;
+		timestamp += 1000;
+		std::memcpy(data.data(), &msg_id, sizeof(msg_id));
+		std::memcpy(data.data() + 2, &timestamp, sizeof(timestamp));
+		write_ulog_message(file, 'D', data);
+	}
+}
+
+// Maps and parses every .ulg and .ulg.zst in the directory, the first pass may read from disk, the
+// best of the later ones is the parser itself
+static int bench_index(const std::string& logs_directory, uint32_t passes)
+{
+	fs::path bench_dir = fs::temp_directory_path() / ("logloader_bench_" + std::to_string(getpid()));
+	fs::path directory = logs_directory;
+
+	if (logs_directory.empty()) {
+		directory = bench_dir;
+		fs::create_directories(directory);
+
+		for (uint64_t size_mb : {1, 16, 64, 256}) {
+			write_synthetic_ulog(directory / ("synthetic_" + std::to_string(size_mb) + "mb.ulg"), size_mb);
+		}
+	}
+
+	std::vector<std::string> paths;
+	std::error_code ec;
+
+	for (const auto& file : fs::recursive_directory_iterator(directory, ec)) {
+		std::string path = file.path().string();
+
+		if (file.is_regular_file() && (path.ends_with(".ulg") || path.ends_with(".ulg.zst"))) {
+			paths.push_back(path);
+		}
+	}
+
+	if (ec || paths.empty()) {
+		LOG("No logs found in " << directory.string());
+		fs::remove_all(bench_dir);
+		return -1;
+	}
+
+	std::sort(paths.begin(), paths.end());
+
+	int result = 0;
+	double best_gb_per_s = 0;
+
+	for (uint32_t pass = 0; pass < std::max<uint32_t>(passes, 1); pass++) {
+		uint64_t total_bytes = 0;
+		uint64_t total_messages = 0;
+		double total_seconds = 0;
+
+		for (const auto& path : paths) {
+			Database::LogMetadata metadata;
+			LogIndexer::Stats stats = {};
+
+			auto start = std::chrono::steady_clock::now();
+			bool valid = LogIndexer::index_file(path, metadata, &stats);
+			std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+			if (!valid) {
+				LOG("index file=" << fs::path(path).filename().string() << " valid=0");
+				result = -1;
+				continue;
+			}
+
+			total_bytes += stats.bytes;
+			total_messages += stats.messages;
+			total_seconds += duration.count();
+
+			if (pass == 0) {
+				LOG("index file=" << fs::path(path).filename().string()
+				    << " mb=" << std::fixed << std::setprecision(1) << stats.bytes / 1e6
+				    << " messages=" << stats.messages
+				    << " duration_s=" << metadata.duration_s
+				    << " firmware=" << metadata.firmware_version
+				    << " hardware=" << metadata.hardware
+				    << " vehicle_uuid=" << metadata.vehicle_uuid
+				    << " topics=" << std::count(metadata.topics.begin(), metadata.topics.end(), ',') + !metadata.topics.empty()
+				    << " gb_per_s=" << std::setprecision(2) << stats.bytes / 1e9 / std::max(duration.count(), 1e-9));
+			}
+		}
+
+		double gb_per_s = total_bytes / 1e9 / std::max(total_seconds, 1e-9);
+		best_gb_per_s = std::max(best_gb_per_s, pass > 0 ? gb_per_s : 0.0);
+
+		LOG("index pass=" << pass + 1
+		    << " files=" << paths.size()
+		    << " mb=" << std::fixed << std::setprecision(1) << total_bytes / 1e6
+		    << " messages=" << total_messages
+		    << " seconds=" << std::setprecision(3) << total_seconds
+		    << " gb_per_s=" << std::setprecision(2) << gb_per_s);
+	}
+
+	if (passes > 1) {
+		LOG("index best_warm_gb_per_s=" << std::fixed << std::setprecision(2) << best_gb_per_s);
+	}
+
+	fs::remove_all(bench_dir);
+
+	return result;
+}
@@ -0,0 +1,547 @@
+#include "LogServerEmulator.hpp"
+#include "Log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+using namespace std::chrono_literals;
+
+// PX4 keeps at most this much LOG_DATA queued ahead of the link
+static constexpr auto MAX_LINK_BACKLOG = 10ms;
+
+// Without a bandwidth cap the backlog is bounded by size instead
+static constexpr size_t MAX_UNLIMITED_BACKLOG_BYTES = 256 * 1024;
+
+// Base date of the generated logs, 2023-11-14T22:13:20Z, one log every 10 minutes
+static constexpr uint32_t SYNTHETIC_BASE_TIME_UTC = 1700000000;
+static constexpr uint32_t SYNTHETIC_LOG_INTERVAL = 600;
+
+// MAVLink keeps parser state and sequence numbers per channel, every emulator in the process
+// takes a pair of its own
+static std::atomic<int> next_channel = MAVLINK_COMM_0;
+
+LogServerEmulator::LogServerEmulator(const Settings& settings)
+	: _settings(settings)
+	, _rng(settings.seed)
+	, _send_channel(next_channel.fetch_add(2))
+	, _receive_channel(_send_channel + 1)
+{}
+
+LogServerEmulator::~LogServerEmulator()
+{
+	stop();
+}
+
+bool LogServerEmulator::start()
+{
+	if (_receive_channel >= MAVLINK_COMM_NUM_BUFFERS) {
+		LOG_ERROR("Out of MAVLink channels, at most " << MAVLINK_COMM_NUM_BUFFERS / 2 << " emulators per process");
+		return false;
+	}
+
+	if (!load_logs() || !open_socket()) {
+		return false;
+	}
+
+	_should_exit = false;
+	_receive_thread = std::thread(&LogServerEmulator::receive_thread, this);
+	_send_thread = std::thread(&LogServerEmulator::send_thread, this);
+	_vehicle_thread = std::thread(&LogServerEmulator::vehicle_thread, this);
+
+	return true;
+}
+
+void LogServerEmulator::stop()
+{
+	_should_exit = true;
+	_cv.notify_all();
+
+	for (auto thread : {&_receive_thread, &_send_thread, &_vehicle_thread}) {
+		if (thread->joinable()) {
+			thread->join();
+		}
+	}
+
+	stop_streaming();
+
+	if (_socket >= 0) {
+		::close(_socket);
+		_socket = -1;
+	}
+}
+
+LogServerEmulator::Stats LogServerEmulator::stats() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _stats;
+}
+
+bool LogServerEmulator::load_logs()
+{
+	_logs.clear();
+
+	if (_settings.synthetic_logs > 0) {
+		for (uint32_t i = 0; i < _settings.synthetic_logs; i++) {
+			_logs.push_back({"", SYNTHETIC_BASE_TIME_UTC + i * SYNTHETIC_LOG_INTERVAL, _settings.synthetic_log_size});
+		}
+
+		return true;
+	}
+
+	std::error_code ec;
+	std::vector<std::string> paths;
+
+	for (const auto& file : fs::directory_iterator(_settings.logs_directory, ec)) {
+		if (file.is_regular_file() && file.path().extension() == ".ulg") {
+			paths.push_back(file.path().string());
+		}
+	}
+
+	if (ec) {
+		LOG("Could not read " << _settings.logs_directory << ": " << ec.message());
+		return false;
+	}
+
+	// LOG_ENTRY IDs follow the order of the files on the SD card
+	std::sort(paths.begin(), paths.end());
+
+	for (const auto& path : paths) {
+		struct stat st {};
+
+		if (stat(path.c_str(), &st) != 0 || st.st_size > UINT32_MAX) {
+			LOG("Skipping " << path);
+			continue;
+		}
+
+		_logs.push_back({path, static_cast<uint32_t>(st.st_mtime), static_cast<uint32_t>(st.st_size)});
+	}
+
+	if (_logs.size() > UINT16_MAX) {
+		_logs.resize(UINT16_MAX);
+	}
+
+	return true;
+}
+
+bool LogServerEmulator::open_socket()
+{
+	_socket = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (_socket < 0) {
+		LOG("Could not create socket: " << strerror(errno));
+		return false;
+	}
+
+	// Replies from the ground side come back to whatever port the kernel picks here
+	sockaddr_in local = {};
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if (bind(_socket, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) != 0) {
+		LOG("Could not bind socket: " << strerror(errno));
+		return false;
+	}
+
+	_target.sin_family = AF_INET;
+	_target.sin_port = htons(_settings.target_port);
+
+	if (inet_pton(AF_INET, _settings.target_host.c_str(), &_target.sin_addr) != 1) {
+		LOG("Invalid target address: " << _settings.target_host);
+		return false;
+	}
+
+	return true;
+}
+
+void LogServerEmulator::receive_thread()
+{
+	// Parsing uses its own channel, the sequence numbers of the sending side live in _send_channel
+	mavlink_status_t status {};
+	mavlink_message_t message {};
+	uint8_t buffer[2048];
+
+	while (!_should_exit) {
+		pollfd fds = {.fd = _socket, .events = POLLIN, .revents = 0};
+
+		if (poll(&fds, 1, 100) <= 0) {
+			continue;
+		}
+
+		ssize_t length = recv(_socket, buffer, sizeof(buffer), 0);
+
+		for (ssize_t i = 0; i < length; i++) {
+			if (mavlink_parse_char(_receive_channel, buffer[i], &message, &status) != MAVLINK_FRAMING_OK) {
+				continue;
+			}
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stats.messages_received++;
+
+			if (link_drops()) {
+				_stats.messages_dropped++;
+				continue;
+			}
+
+			// Parsed messages are queued as raw bytes so both directions share the same queue type
+			std::vector<uint8_t> bytes(sizeof(message));
+			std::memcpy(bytes.data(), &message, sizeof(message));
+			_incoming.push({std::chrono::steady_clock::now() + _settings.link.latency, _sequence++, std::move(bytes)});
+			_cv.notify_all();
+		}
+	}
+}
+
+void LogServerEmulator::send_thread()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	while (!_should_exit) {
+		if (_outgoing.empty()) {
+			_cv.wait(lock);
+			continue;
+		}
+
+		if (_outgoing.top().deliver_at > std::chrono::steady_clock::now()) {
+			_cv.wait_until(lock, _outgoing.top().deliver_at);
+			continue;
+		}
+
+		Packet packet = _outgoing.top();
+		_outgoing.pop();
+		_outgoing_bytes -= packet.bytes.size();
+
+		lock.unlock();
+		sendto(_socket, packet.bytes.data(), packet.bytes.size(), 0, reinterpret_cast<const sockaddr*>(&_target),
+		       sizeof(_target));
+		lock.lock();
+
+		// Room for more LOG_DATA
+		_cv.notify_all();
+	}
+}
+
+void LogServerEmulator::vehicle_thread()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	auto next_heartbeat = std::chrono::steady_clock::now();
+	_next_flight_event = next_heartbeat + _settings.flights.ground;
+
+	while (!_should_exit) {
+		auto now = std::chrono::steady_clock::now();
+
+		update_flight(now);
+
+		if (now >= next_heartbeat) {
+			send_heartbeat();
+			send_sys_status();
+			next_heartbeat = now + 1s;
+		}
+
+		while (!_incoming.empty() && _incoming.top().deliver_at <= now) {
+			mavlink_message_t message;
+			std::memcpy(&message, _incoming.top().bytes.data(), sizeof(message));
+			_incoming.pop();
+			handle_message(message);
+		}
+
+		while (_streaming && !link_busy()) {
+			send_next_log_data();
+		}
+
+		auto wake_at = next_heartbeat;
+
+		if (_settings.flights.flight.count()) {
+			wake_at = std::min(wake_at, _next_flight_event);
+		}
+
+		if (_logger_running && !_armed) {
+			wake_at = std::min(wake_at, _logger_stop_at);
+		}
+
+		if (!_incoming.empty()) {
+			wake_at = std::min(wake_at, _incoming.top().deliver_at);
+		}
+
+		// While streaming the send thread wakes us up when the link drains
+		if (_streaming && _settings.link.bandwidth_bytes_per_second) {
+			wake_at = std::min(wake_at, _link_free_at - MAX_LINK_BACKLOG);
+		}
+
+		_cv.wait_until(lock, wake_at);
+	}
+}
+
+void LogServerEmulator::handle_message(const mavlink_message_t& message)
+{
+	switch (message.msgid) {
+	case MAVLINK_MSG_ID_LOG_REQUEST_LIST: {
+			mavlink_log_request_list_t request;
+			mavlink_msg_log_request_list_decode(&message, &request);
+
+			if (request.target_system == _settings.system_id || request.target_system == 0) {
+				handle_request_list(request);
+			}
+
+			break;
+		}
+
+	case MAVLINK_MSG_ID_LOG_REQUEST_DATA: {
+			mavlink_log_request_data_t request;
+			mavlink_msg_log_request_data_decode(&message, &request);
+
+			if (request.target_system == _settings.system_id || request.target_system == 0) {
+				handle_request_data(request);
+			}
+
+			break;
+		}
+
+	case MAVLINK_MSG_ID_LOG_REQUEST_END:
+		if (_preempting) {
+			// Includes the link latency in both directions
+			_preempting = false;
+			std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - _armed_at;
+			_stats.preemptions++;
+			_stats.preemption_ms_max = std::max(_stats.preemption_ms_max, latency.count());
+			LOG("Transfer stopped " << int(latency.count()) << " ms after arming");
+		}
+
+		stop_streaming();
+		break;
+
+	default:
+		break;
+	}
+}
+
+void LogServerEmulator::handle_request_list(const mavlink_log_request_list_t& request)
+{
+	// Listing aborts a transfer in progress, same as PX4
+	stop_streaming();
+
+	uint16_t num_logs = _logs.size();
+	uint16_t last_log_num = num_logs > 0 ? num_logs - 1 : 0;
+	mavlink_message_t message;
+
+	if (num_logs == 0) {
+		mavlink_msg_log_entry_pack_chan(_settings.system_id, MAV_COMP_ID_AUTOPILOT1, _send_channel, &message,
+						0, 0, 0, 0, 0);
+		send_message(message);
+		return;
+	}
+
+	for (uint32_t id = request.start; id <= std::min(request.end, last_log_num); id++) {
+		const Log& log = _logs[id];
+		mavlink_msg_log_entry_pack_chan(_settings.system_id, MAV_COMP_ID_AUTOPILOT1, _send_channel, &message,
+						id, num_logs, last_log_num, log.time_utc, log.size_bytes);
+		send_message(message);
+	}
+}
+
+void LogServerEmulator::handle_request_data(const mavlink_log_request_data_t& request)
+{
+	if (request.id >= _logs.size()) {
+		return;
+	}
+
+	const Log& log = _logs[request.id];
+
+	// Past the end of the log PX4 answers with a single empty LOG_DATA
+	if (request.ofs >= log.size_bytes) {
+		stop_streaming();
+
+		uint8_t data[MAVLINK_MSG_LOG_DATA_FIELD_DATA_LEN] {};
+		mavlink_message_t message;
+		mavlink_msg_log_data_pack_chan(_settings.system_id, MAV_COMP_ID_AUTOPILOT1, _send_channel, &message,
+					       request.id, request.ofs, 0, data);
+		send_message(message);
+		return;
+	}
+
+	_streaming = true;
+	_stream_id = request.id;
+	_stream_offset = request.ofs;
+	_stream_end = std::min<uint64_t>(log.size_bytes, uint64_t(request.ofs) + request.count);
+	_cv.notify_all();
+}
+
+void LogServerEmulator::stop_streaming()
+{
+	_streaming = false;
+
+	if (_stream_fd >= 0) {
+		::close(_stream_fd);
+		_stream_fd = -1;
+	}
+}
+
+void LogServerEmulator::update_flight(std::chrono::steady_clock::time_point now)
+{
+	if (_settings.flights.flight.count() && now >= _next_flight_event) {
+		_armed = !_armed;
+		_next_flight_event = now + (_armed ? _settings.flights.flight : _settings.flights.ground);
+
+		if (_armed) {
+			_logger_running = true;
+			_armed_at = now;
+			_preempting = _streaming;
+
+		} else {
+			_logger_stop_at = now + _settings.flights.logger_stop;
+		}
+
+		LOG(int(_settings.system_id) << (_armed ? ": Armed" : ": Disarmed"));
+
+		// PX4 sends both right away on a state change
+		send_heartbeat();
+		send_sys_status();
+	}
+
+	if (_logger_running && !_armed && now >= _logger_stop_at) {
+		_logger_running = false;
+		send_sys_status();
+	}
+}
+
+void LogServerEmulator::send_heartbeat()
+{
+	uint8_t base_mode = MAV_MODE_FLAG_CUSTOM_MODE_ENABLED | (_armed ? MAV_MODE_FLAG_SAFETY_ARMED : 0);
+	uint8_t system_status = _armed ? MAV_STATE_ACTIVE : MAV_STATE_STANDBY;
+
+	mavlink_message_t message;
+	mavlink_msg_heartbeat_pack_chan(_settings.system_id, MAV_COMP_ID_AUTOPILOT1, _send_channel, &message,
+					MAV_TYPE_QUADROTOR, MAV_AUTOPILOT_PX4, base_mode, 0, system_status);
+	send_message(message);
+}
+
+void LogServerEmulator::send_sys_status()
+{
+	// Only the logger is reported, the fields differ between MAVLink versions so the struct is encoded
+	mavlink_sys_status_t sys_status {};
+	sys_status.onboard_control_sensors_present = MAV_SYS_STATUS_LOGGING;
+	sys_status.onboard_control_sensors_enabled = _logger_running ? MAV_SYS_STATUS_LOGGING : 0;
+	sys_status.onboard_control_sensors_health = MAV_SYS_STATUS_LOGGING;
+
+	mavlink_message_t message;
+	mavlink_msg_sys_status_encode_chan(_settings.system_id, MAV_COMP_ID_AUTOPILOT1, _send_channel, &message, &sys_status);
+	send_message(message);
+}
+
+void LogServerEmulator::send_next_log_data()
+{
+	uint8_t data[MAVLINK_MSG_LOG_DATA_FIELD_DATA_LEN] {};
+	uint32_t length = std::min<uint32_t>(sizeof(data), _stream_end - _stream_offset);
+
+	if (!read_log(_stream_id, _stream_offset, data, length)) {
+		stop_streaming();
+		return;
+	}
+
+	mavlink_message_t message;
+	mavlink_msg_log_data_pack_chan(_settings.system_id, MAV_COMP_ID_AUTOPILOT1, _send_channel, &message,
+				       _stream_id, _stream_offset, length, data);
+	send_message(message);
+
+	_stats.log_data_bytes += length;
+	_stats.log_data_bytes_armed += _armed ? length : 0;
+	_stream_offset += length;
+
+	if (_stream_offset >= _stream_end) {
+		_streaming = false;
+	}
+}
+
+bool LogServerEmulator::read_log(uint16_t id, uint32_t offset, uint8_t* data, uint32_t length)
+{
+	const Log& log = _logs[id];
+
+	// Generated logs have content derived from the position so downloads can be verified
+	if (log.path.empty()) {
+		for (uint32_t i = 0; i < length; i++) {
+			data[i] = static_cast<uint8_t>((offset + i) * 31 + id);
+		}
+
+		return true;
+	}
+
+	if (_stream_fd < 0 || _stream_fd_id != id) {
+		if (_stream_fd >= 0) {
+			::close(_stream_fd);
+		}
+
+		_stream_fd = ::open(log.path.c_str(), O_RDONLY);
+		_stream_fd_id = id;
+
+		if (_stream_fd < 0) {
+			LOG("Could not open " << log.path << ": " << strerror(errno));
+			return false;
+		}
+	}
+
+	return pread(_stream_fd, data, length, offset) == static_cast<ssize_t>(length);
+}
+
+void LogServerEmulator::send_message(const mavlink_message_t& message)
+{
+	uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
+	uint16_t length = mavlink_msg_to_send_buffer(buffer, &message);
+	auto now = std::chrono::steady_clock::now();
+
+	_stats.messages_sent++;
+
+	// Time on the wire is spent even if the message is lost afterwards
+	if (_settings.link.bandwidth_bytes_per_second) {
+		auto start = std::max(now, _link_free_at);
+		auto duration = std::chrono::microseconds(uint64_t(length) * 1000000 / _settings.link.bandwidth_bytes_per_second);
+		_link_free_at = start + duration;
+
+	} else {
+		_link_free_at = now;
+	}
+
+	if (link_drops()) {
+		_stats.messages_dropped++;
+		return;
+	}
+
+	Packet packet = {_link_free_at + _settings.link.latency, _sequence++, std::vector<uint8_t>(buffer, buffer + length)};
+
+	if (_settings.link.reorder > 0 && std::uniform_real_distribution<double>(0, 1)(_rng) < _settings.link.reorder) {
+		packet.deliver_at += link_jitter();
+	}
+
+	_outgoing_bytes += length;
+	_outgoing.push(std::move(packet));
+	_cv.notify_all();
+}
+
+bool LogServerEmulator::link_drops()
+{
+	return _settings.link.loss > 0 && std::uniform_real_distribution<double>(0, 1)(_rng) < _settings.link.loss;
+}
+
+std::chrono::microseconds LogServerEmulator::link_jitter()
+{
+	// Held back long enough for a few of the following messages to overtake it
+	auto max_delay = std::max<std::chrono::microseconds>(_settings.link.latency, 5ms);
+	return std::chrono::microseconds(std::uniform_int_distribution<int64_t>(1000, max_delay.count())(_rng));
+}
+
+bool LogServerEmulator::link_busy() const
+{
+	if (_settings.link.bandwidth_bytes_per_second) {
+		return _link_free_at > std::chrono::steady_clock::now() + MAX_LINK_BACKLOG;
+	}
+
+	return _outgoing_bytes > MAX_UNLIMITED_BACKLOG_BYTES;
+}
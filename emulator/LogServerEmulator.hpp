@@ -0,0 +1,156 @@
+#pragma once
+
+// The MAVLink C library is the one bundled with MAVSDK, pulled in through the passthrough plugin header
+#include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+
+// Pretends to be a PX4 autopilot serving its SD card logs over UDP. Implements the vehicle side of
+// LOG_REQUEST_LIST / LOG_ENTRY / LOG_REQUEST_DATA / LOG_DATA / LOG_REQUEST_END and sends a heartbeat
+// so MAVSDK discovers it as an autopilot. Messages pass through an emulated link with configurable
+// latency, bandwidth, loss and reordering, which makes download throughput reproducible without hardware.
+// Optionally the vehicle flies on a fixed cycle, reporting the armed state in the heartbeat and the
+// logger in SYS_STATUS like PX4, to measure how fast transfers stop on arming.
+class LogServerEmulator
+{
+public:
+	struct LinkSettings {
+		std::chrono::microseconds latency {0};   // One way delay, applied in both directions
+		uint32_t bandwidth_bytes_per_second {0}; // Vehicle to ground capacity, 0 for unlimited
+		double loss {0};                         // Probability of a message being dropped, both directions
+		double reorder {0};                      // Probability of a message being held back and overtaken
+	};
+
+	struct FlightSettings {
+		std::chrono::seconds ground {0};         // Disarmed time between flights, 0 to never arm
+		std::chrono::seconds flight {0};         // Armed time of each flight
+		std::chrono::milliseconds logger_stop {1000}; // The logger closes the log this long after the disarm
+	};
+
+	struct Settings {
+		std::string logs_directory;              // .ulg files served in file name order
+		uint32_t synthetic_logs {0};             // Serve this many generated logs instead of a directory
+		uint32_t synthetic_log_size {1024 * 1024};
+		std::string target_host {"127.0.0.1"};   // Where the ground side (logloader) listens
+		uint16_t target_port {14551};
+		uint8_t system_id {1};
+		LinkSettings link;
+		FlightSettings flights;
+		uint32_t seed {1};                       // Seed for the loss and reorder decisions
+	};
+
+	struct Stats {
+		uint64_t messages_sent;
+		uint64_t messages_dropped;
+		uint64_t messages_received;
+		uint64_t log_data_bytes;
+		uint64_t log_data_bytes_armed;           // Sent while armed, before the ground stopped the transfer
+		uint32_t preemptions;                    // Transfers stopped by the ground after an arm
+		double preemption_ms_max;                // Longest time from arming to LOG_REQUEST_END
+	};
+
+	explicit LogServerEmulator(const Settings& settings);
+	~LogServerEmulator();
+
+	bool start();
+	void stop();
+
+	size_t num_logs() const { return _logs.size(); }
+	Stats stats() const;
+
+private:
+	struct Log {
+		std::string path;   // Empty for synthetic logs
+		uint32_t time_utc;
+		uint32_t size_bytes;
+	};
+
+	struct Packet {
+		std::chrono::steady_clock::time_point deliver_at;
+		uint64_t sequence;  // Keeps packets with the same deadline in FIFO order
+		std::vector<uint8_t> bytes;
+
+		bool operator>(const Packet& other) const
+		{
+			return deliver_at != other.deliver_at ? deliver_at > other.deliver_at : sequence > other.sequence;
+		}
+	};
+
+	using PacketQueue = std::priority_queue<Packet, std::vector<Packet>, std::greater<Packet>>;
+
+	bool load_logs();
+	bool open_socket();
+
+	void receive_thread();
+	void send_thread();
+	void vehicle_thread();
+
+	// Vehicle side, caller must hold _mutex
+	void handle_message(const mavlink_message_t& message);
+	void handle_request_list(const mavlink_log_request_list_t& request);
+	void handle_request_data(const mavlink_log_request_data_t& request);
+	void stop_streaming();
+	void update_flight(std::chrono::steady_clock::time_point now);
+	void send_heartbeat();
+	void send_sys_status();
+	void send_next_log_data();
+	bool read_log(uint16_t id, uint32_t offset, uint8_t* data, uint32_t length);
+
+	// Emulated link, caller must hold _mutex
+	void send_message(const mavlink_message_t& message);
+	bool link_drops();
+	std::chrono::microseconds link_jitter();
+	bool link_busy() const;
+
+	Settings _settings;
+	std::vector<Log> _logs;
+
+	int _socket = -1;
+	sockaddr_in _target {};
+
+	mutable std::mutex _mutex;
+	std::condition_variable _cv;
+	std::mt19937 _rng;
+
+	int _send_channel;                    // Packing, only used with _mutex held
+	int _receive_channel;                 // Parsing on the receive thread
+
+	PacketQueue _outgoing;                // Vehicle to ground
+	PacketQueue _incoming;                // Ground to vehicle, delayed before being handled
+	std::chrono::steady_clock::time_point _link_free_at {};
+	uint64_t _sequence = 0;
+	size_t _outgoing_bytes = 0;
+
+	// Transfer in progress, a new LOG_REQUEST_DATA replaces it like on PX4
+	bool _streaming = false;
+	uint16_t _stream_id = 0;
+	uint32_t _stream_offset = 0;
+	uint32_t _stream_end = 0;
+	int _stream_fd = -1;
+	uint16_t _stream_fd_id = 0;
+
+	// Flight cycle
+	bool _armed = false;
+	bool _logger_running = false;
+	bool _preempting = false;             // Armed while streaming, waiting for the ground to stop
+	std::chrono::steady_clock::time_point _armed_at {};
+	std::chrono::steady_clock::time_point _next_flight_event {};
+	std::chrono::steady_clock::time_point _logger_stop_at {};
+
+	Stats _stats {};
+
+	std::atomic<bool> _should_exit = false;
+	std::thread _receive_thread;
+	std::thread _send_thread;
+	std::thread _vehicle_thread;
+};
@@ -0,0 +1,49 @@
+#!/bin/bash
+
+# End to end download benchmark against the log server emulator. Fetches the log list from
+# emulated vehicles with 10, 100 and 1000 logs and downloads the newest log from each. Then
+# downloads from fleets of 1, 2, 4 and 8 vehicles at once to measure how throughput scales.
+# Extra arguments are passed to logloader_emulator to shape the link, e.g.
+#   emulator/benchmark.sh --latency-ms 20 --bandwidth-kbps 1000 --loss 0.01
+THIS_DIR="$(dirname "$(realpath "$BASH_SOURCE")")"
+BUILD_DIR="${BUILD_DIR:-$THIS_DIR/../build}"
+PORT="${PORT:-14570}"
+LOG_SIZE="${LOG_SIZE:-4194304}"
+FLEET_SIZES="${FLEET_SIZES:-1 2 4 8}"
+
+if [ ! -x "$BUILD_DIR/logloader_emulator" ] || [ ! -x "$BUILD_DIR/logloader_bench" ]; then
+	echo "Build the benchmarks first: make bench"
+	exit 1
+fi
+
+result=0
+
+for num_logs in 10 100 1000; do
+	"$BUILD_DIR/logloader_emulator" --synthetic $num_logs --log-size $LOG_SIZE --target 127.0.0.1:$PORT "$@" > /dev/null &
+	emulator_pid=$!
+
+	"$BUILD_DIR/logloader_bench" download udp://:$PORT 1 | grep '^download' | sed "s/^download /download vehicle_logs=$num_logs /"
+
+	if [ ${PIPESTATUS[0]} -ne 0 ]; then
+		result=1
+	fi
+
+	kill -INT $emulator_pid
+	wait $emulator_pid
+done
+
+for num_vehicles in $FLEET_SIZES; do
+	"$BUILD_DIR/logloader_emulator" --synthetic 10 --vehicles $num_vehicles --log-size $LOG_SIZE --target 127.0.0.1:$PORT "$@" > /dev/null &
+	emulator_pid=$!
+
+	"$BUILD_DIR/logloader_bench" fleet udp://:$PORT $num_vehicles 1 | grep '^fleet'
+
+	if [ ${PIPESTATUS[0]} -ne 0 ]; then
+		result=1
+	fi
+
+	kill -INT $emulator_pid
+	wait $emulator_pid
+done
+
+exit $result
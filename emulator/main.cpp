@@ -0,0 +1,167 @@
+#include "LogServerEmulator.hpp"
+#include "Log.hpp"
+
+#include <signal.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+static void signal_handler(int signum);
+static void usage();
+
+std::atomic<bool> _should_exit = false;
+
+int main(int argc, char* argv[])
+{
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+
+	LogServerEmulator::Settings settings;
+	uint32_t num_vehicles = 1;
+
+	try {
+		for (int i = 1; i < argc; i++) {
+			std::string option = argv[i];
+
+			if (option == "--help" || i + 1 >= argc) {
+				usage();
+				return option == "--help" ? 0 : -1;
+			}
+
+			std::string value = argv[++i];
+
+			if (option == "--logs") {
+				settings.logs_directory = value;
+
+			} else if (option == "--synthetic") {
+				settings.synthetic_logs = std::stoul(value);
+
+			} else if (option == "--log-size") {
+				settings.synthetic_log_size = std::stoul(value);
+
+			} else if (option == "--target") {
+				size_t colon = value.find(':');
+				settings.target_host = value.substr(0, colon);
+				settings.target_port = colon != std::string::npos ? std::stoul(value.substr(colon + 1)) : settings.target_port;
+
+			} else if (option == "--sysid") {
+				settings.system_id = std::stoul(value);
+
+			} else if (option == "--vehicles") {
+				num_vehicles = std::stoul(value);
+
+			} else if (option == "--latency-ms") {
+				settings.link.latency = std::chrono::microseconds(uint64_t(std::stod(value) * 1000));
+
+			} else if (option == "--bandwidth-kbps") {
+				settings.link.bandwidth_bytes_per_second = std::stod(value) * 1000 / 8;
+
+			} else if (option == "--loss") {
+				settings.link.loss = std::stod(value);
+
+			} else if (option == "--reorder") {
+				settings.link.reorder = std::stod(value);
+
+			} else if (option == "--flights") {
+				size_t colon = value.find(':');
+				settings.flights.ground = std::chrono::seconds(std::stoul(value.substr(0, colon)));
+				settings.flights.flight = std::chrono::seconds(colon != std::string::npos ? std::stoul(value.substr(colon + 1)) : 0);
+
+			} else if (option == "--seed") {
+				settings.seed = std::stoul(value);
+
+			} else {
+				usage();
+				return -1;
+			}
+		}
+
+	} catch (const std::exception& err) {
+		std::cerr << "Invalid argument: " << err.what() << "\n";
+		return -1;
+	}
+
+	if ((settings.logs_directory.empty() && settings.synthetic_logs == 0)
+	    || num_vehicles == 0 || settings.system_id + num_vehicles - 1 > 255) {
+		usage();
+		return -1;
+	}
+
+	// Each vehicle has its own socket and link, like a fleet with one radio per drone
+	std::vector<std::unique_ptr<LogServerEmulator>> emulators;
+
+	for (uint32_t i = 0; i < num_vehicles; i++) {
+		LogServerEmulator::Settings vehicle_settings = settings;
+		vehicle_settings.system_id = settings.system_id + i;
+		vehicle_settings.seed = settings.seed + i;
+
+		auto emulator = std::make_unique<LogServerEmulator>(vehicle_settings);
+
+		if (!emulator->start()) {
+			return -1;
+		}
+
+		LOG("Serving " << emulator->num_logs() << " logs as system " << int(vehicle_settings.system_id)
+		    << " to " << settings.target_host << ":" << settings.target_port);
+		emulators.push_back(std::move(emulator));
+	}
+
+	while (!_should_exit) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	LogServerEmulator::Stats total = {};
+	size_t num_logs = 0;
+
+	for (auto& emulator : emulators) {
+		emulator->stop();
+
+		auto stats = emulator->stats();
+		total.messages_sent += stats.messages_sent;
+		total.messages_received += stats.messages_received;
+		total.messages_dropped += stats.messages_dropped;
+		total.log_data_bytes += stats.log_data_bytes;
+		total.log_data_bytes_armed += stats.log_data_bytes_armed;
+		total.preemptions += stats.preemptions;
+		total.preemption_ms_max = std::max(total.preemption_ms_max, stats.preemption_ms_max);
+		num_logs += emulator->num_logs();
+	}
+
+	LOG("emulator vehicles=" << emulators.size()
+	    << " logs=" << num_logs
+	    << " sent=" << total.messages_sent
+	    << " received=" << total.messages_received
+	    << " dropped=" << total.messages_dropped
+	    << " log_data_bytes=" << total.log_data_bytes
+	    << " log_data_bytes_armed=" << total.log_data_bytes_armed
+	    << " preemptions=" << total.preemptions
+	    << " preemption_ms_max=" << int(total.preemption_ms_max));
+
+	return 0;
+}
+
+static void usage()
+{
+	std::cerr << "Usage: logloader_emulator (--logs <dir> | --synthetic <count>) [options]\n"
+		  << "  --logs <dir>              Serve the .ulg files in this directory\n"
+		  << "  --synthetic <count>       Serve generated logs instead\n"
+		  << "  --log-size <bytes>        Size of the generated logs (default 1048576)\n"
+		  << "  --target <host:port>      Address logloader listens on (default 127.0.0.1:14551)\n"
+		  << "  --sysid <id>              MAVLink system ID of the vehicle (default 1)\n"
+		  << "  --vehicles <count>        Emulate this many vehicles with consecutive system IDs (default 1, at most 8)\n"
+		  << "  --latency-ms <ms>         One way link latency\n"
+		  << "  --bandwidth-kbps <kbit/s> Vehicle to ground bandwidth cap\n"
+		  << "  --loss <0..1>             Probability of dropping a message\n"
+		  << "  --reorder <0..1>          Probability of delivering a message late\n"
+		  << "  --flights <ground>:<air>  Arm for <air> seconds after every <ground> seconds disarmed\n"
+		  << "  --seed <n>                Seed for the loss and reorder decisions\n";
+}
+
+static void signal_handler(int signum)
+{
+	(void)signum;
+	_should_exit = true;
+}
@@ -0,0 +1,27 @@
+#include "Backoff.hpp"
+
+#include <algorithm>
+
+Backoff::Backoff(const Backoff::Settings& settings)
+	: _settings(settings)
+	, _rng(std::random_device {}())
+{}
+
+std::chrono::milliseconds Backoff::delay(uint32_t failures)
+{
+	using namespace std::chrono;
+
+	if (failures == 0) {
+		return milliseconds(0);
+	}
+
+	// 2^31 seconds is far beyond any sensible max, stop doubling before it overflows
+	milliseconds ceiling = duration_cast<milliseconds>(std::max(_settings.max, _settings.initial));
+	milliseconds delay = duration_cast<milliseconds>(_settings.initial) * (int64_t(1) << std::min<uint32_t>(failures - 1, 31));
+	delay = std::min(delay, ceiling);
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::uniform_int_distribution<int64_t> jitter(delay.count() / 2, delay.count());
+
+	return milliseconds(jitter(_rng));
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <random>
+
+// Jittered exponential backoff. The n-th consecutive failure waits a random time between half and
+// all of initial * 2^(n-1), capped at max, so retries of many logs or processes spread out instead
+// of hitting a recovering server at the same moment.
+class Backoff
+{
+public:
+	struct Settings {
+		std::chrono::seconds initial {30};
+		std::chrono::seconds max {3600};
+	};
+
+	Backoff(const Settings& settings);
+
+	std::chrono::milliseconds delay(uint32_t failures);
+
+private:
+	Settings _settings;
+	std::mutex _mutex; // Shared by the upload workers of a backend
+	std::mt19937 _rng;
+};
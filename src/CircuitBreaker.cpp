@@ -0,0 +1,89 @@
+#include "CircuitBreaker.hpp"
+
+#include <algorithm>
+
+CircuitBreaker::CircuitBreaker(const CircuitBreaker::Settings& settings)
+	: _settings(settings)
+	, _cooldown(settings.cooldown)
+{
+	_settings.failure_threshold = std::max<uint32_t>(_settings.failure_threshold, 1);
+}
+
+bool CircuitBreaker::allow(Clock::time_point now)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	switch (_state) {
+	case State::Closed:
+		return true;
+
+	case State::Open:
+		if (now < _retry_at) {
+			return false;
+		}
+
+		_state = State::HalfOpen;
+		return true;
+
+	case State::HalfOpen:
+		return false;
+	}
+
+	return false;
+}
+
+bool CircuitBreaker::available(Clock::time_point now) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	return _state == State::Closed || (_state == State::Open && now >= _retry_at);
+}
+
+void CircuitBreaker::record_success()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_state = State::Closed;
+	_failures = 0;
+	_trips = 0;
+}
+
+void CircuitBreaker::record_failure(Clock::time_point now)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (_state == State::Closed && ++_failures < _settings.failure_threshold) {
+		return;
+	}
+
+	// Uploads that were already in flight when the circuit opened do not extend the cooldown
+	if (_state == State::Open) {
+		return;
+	}
+
+	_state = State::Open;
+	_failures = 0;
+	_retry_at = now + _cooldown.delay(++_trips);
+}
+
+void CircuitBreaker::release()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	// Back to open with the cooldown already expired, the next request becomes the probe
+	if (_state == State::HalfOpen) {
+		_state = State::Open;
+	}
+}
+
+CircuitBreaker::State CircuitBreaker::state() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _state;
+}
+
+CircuitBreaker::Clock::time_point CircuitBreaker::retry_at() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _retry_at;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+#include "Backoff.hpp"
+
+// Stops all uploads to a backend that is down. After failure_threshold consecutive connection
+// failures the circuit opens and every request is refused until the cooldown expires. The circuit
+// is then half open and lets a single probe through: it closes again when the probe succeeds and
+// reopens with a longer cooldown when it fails.
+class CircuitBreaker
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	enum class State {
+		Closed,  // Requests go through
+		Open,    // Requests are refused until the cooldown expires
+		HalfOpen // One probe is in flight
+	};
+
+	struct Settings {
+		uint32_t failure_threshold {3};
+		Backoff::Settings cooldown {std::chrono::seconds(30), std::chrono::seconds(900)};
+	};
+
+	CircuitBreaker(const Settings& settings);
+
+	// Must be followed by record_success(), record_failure() or release() when it returns true
+	bool allow(Clock::time_point now = Clock::now());
+
+	// Whether allow() would let a request through, does not take the probe
+	bool available(Clock::time_point now = Clock::now()) const;
+
+	void record_success();
+	void record_failure(Clock::time_point now = Clock::now());
+
+	// The request ended before reaching the server, a half open probe can be sent again
+	void release();
+
+	State state() const;
+
+	// When an open circuit becomes half open
+	Clock::time_point retry_at() const;
+
+private:
+	Settings _settings;
+	Backoff _cooldown;
+
+	mutable std::mutex _mutex;
+	State _state = State::Closed;
+	uint32_t _failures = 0;  // Consecutive failures while closed
+	uint32_t _trips = 0;     // Consecutive times the circuit opened, lengthens the cooldown
+	Clock::time_point _retry_at {};
+};
@@ -0,0 +1,114 @@
+#include "ConnectionPool.hpp"
+#include "Log.hpp"
+
+#define CPPHTTPLIB_OPENSSL_SUPPORT
+#include <httplib.h>
+
+ConnectionPool::ConnectionPool(const ConnectionPool::Settings& settings)
+	: _settings(settings)
+	, _metrics(Metrics::instance().backend(settings.name))
+{}
+
+ConnectionPool::~ConnectionPool()
+{
+	clear();
+}
+
+ConnectionPool::Lease::Lease(ConnectionPool* pool, std::unique_ptr<httplib::Client> client)
+	: _pool(pool)
+	, _client(std::move(client))
+{}
+
+ConnectionPool::Lease::Lease(Lease&& other) noexcept
+	: _pool(other._pool)
+	, _client(std::move(other._client))
+{}
+
+ConnectionPool::Lease::~Lease()
+{
+	if (_client) {
+		_pool->release(std::move(_client));
+	}
+}
+
+ConnectionPool::Lease ConnectionPool::acquire()
+{
+	std::unique_ptr<httplib::Client> client;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto now = std::chrono::steady_clock::now();
+
+		// Most recently used clients are at the back and the most likely to still be connected
+		while (!_idle_clients.empty() && !client) {
+			IdleClient idle = std::move(_idle_clients.back());
+			_idle_clients.pop_back();
+
+			if (now - idle.last_used > _settings.idle_timeout) {
+				// The server has most likely closed this connection already, reconnect from scratch
+				idle.client->stop();
+				_idle_reconnects++;
+				continue;
+			}
+
+			client = std::move(idle.client);
+		}
+	}
+
+	if (client && client->is_socket_open()) {
+		_handshakes_saved++;
+		_metrics.connections_reused.increment();
+
+	} else {
+		if (!client) {
+			client = create_client();
+		}
+
+		_connections_opened++;
+		_metrics.connections_opened.increment();
+	}
+
+	return Lease(this, std::move(client));
+}
+
+void ConnectionPool::release(std::unique_ptr<httplib::Client> client)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (_idle_clients.size() < _settings.max_idle) {
+		_idle_clients.push_back({std::move(client), std::chrono::steady_clock::now()});
+	}
+}
+
+ConnectionPool::Stats ConnectionPool::stats() const
+{
+	return {
+		.connections_opened = _connections_opened.load(),
+		.handshakes_saved = _handshakes_saved.load(),
+		.idle_reconnects = _idle_reconnects.load(),
+	};
+}
+
+void ConnectionPool::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	for (auto& idle : _idle_clients) {
+		idle.client->stop();
+	}
+
+	_idle_clients.clear();
+}
+
+std::unique_ptr<httplib::Client> ConnectionPool::create_client() const
+{
+	std::string scheme_host_port = (_settings.https ? "https://" : "http://") + _settings.host;
+	auto client = std::make_unique<httplib::Client>(scheme_host_port);
+
+	client->set_keep_alive(true);
+	client->set_connection_timeout(_settings.connection_timeout.count());
+	client->set_read_timeout(_settings.read_timeout.count());
+	client->set_write_timeout(_settings.write_timeout.count());
+
+	return client;
+}
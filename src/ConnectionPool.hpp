@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Metrics.hpp"
+
+namespace httplib
+{
+class Client;
+}
+
+// Pool of long lived keep-alive HTTP(S) clients for a single server. Clients are handed out
+// through a Lease and returned to the pool when the lease goes out of scope, so consecutive
+// requests reuse an already established TCP/TLS connection instead of handshaking again.
+class ConnectionPool
+{
+public:
+	struct Settings {
+		std::string host;        // Host (and optional port) without the scheme
+		std::string name;        // Backend the pool belongs to, labels the connection metrics
+		bool https {true};
+		size_t max_idle {2};     // Maximum number of idle clients kept open
+		std::chrono::seconds idle_timeout {30}; // Idle connections older than this are reconnected
+		std::chrono::seconds connection_timeout {10};
+		std::chrono::seconds read_timeout {30};
+		std::chrono::seconds write_timeout {30};
+	};
+
+	struct Stats {
+		uint64_t connections_opened;   // Requests that required a new TCP/TLS handshake
+		uint64_t handshakes_saved;     // Requests served on an already open connection
+		uint64_t idle_reconnects;      // Connections dropped because they exceeded the idle timeout
+	};
+
+	class Lease
+	{
+	public:
+		Lease(ConnectionPool* pool, std::unique_ptr<httplib::Client> client);
+		Lease(Lease&& other) noexcept;
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+		~Lease();
+
+		httplib::Client* operator->() const { return _client.get(); }
+		httplib::Client& operator*() const { return *_client; }
+
+	private:
+		ConnectionPool* _pool;
+		std::unique_ptr<httplib::Client> _client;
+	};
+
+	ConnectionPool(const Settings& settings);
+	~ConnectionPool();
+
+	Lease acquire();
+	Stats stats() const;
+
+	// Close all idle connections
+	void clear();
+
+private:
+	struct IdleClient {
+		std::unique_ptr<httplib::Client> client;
+		std::chrono::steady_clock::time_point last_used;
+	};
+
+	std::unique_ptr<httplib::Client> create_client() const;
+	void release(std::unique_ptr<httplib::Client> client);
+
+	Settings _settings;
+	Metrics::Backend& _metrics;
+
+	std::mutex _mutex;
+	std::vector<IdleClient> _idle_clients;
+
+	std::atomic<uint64_t> _connections_opened {};
+	std::atomic<uint64_t> _handshakes_saved {};
+	std::atomic<uint64_t> _idle_reconnects {};
+};
@@ -0,0 +1,1554 @@
+#include "Database.hpp"
+#include "Log.hpp"
+#include "Metrics.hpp"
+#include "XXHash64.hpp"
+
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+static int64_t unix_seconds(std::chrono::system_clock::time_point time);
+
+Database::Database(const Database::Settings& settings)
+	: _settings(settings)
+{
+	if (!init_database()) {
+		LOG_ERROR("Failed to initialize database: " << _settings.db_path);
+	}
+}
+
+Database::~Database()
+{
+	close_database();
+}
+
+Database::StatementReset::~StatementReset()
+{
+	if (_stmt) {
+		sqlite3_reset(_stmt);
+		sqlite3_clear_bindings(_stmt);
+	}
+
+	std::chrono::duration<double> duration = std::chrono::steady_clock::now() - _start;
+	Metrics::instance().sqlite_query_seconds.observe(duration.count());
+}
+
+bool Database::init_database()
+{
+	int rc = sqlite3_open(_settings.db_path.c_str(), &_db);
+
+	if (rc != SQLITE_OK) {
+		LOG_ERROR("Cannot open database: " << sqlite3_errmsg(_db));
+		sqlite3_close(_db);
+		_db = nullptr;
+		return false;
+	}
+
+	// Tables as of the first release of the shared database, everything after that is a migration
+	const char* create_logs_table =
+		"CREATE TABLE IF NOT EXISTS logs ("
+		"  uuid TEXT PRIMARY KEY,"  // UUID of the log
+		"  id INTEGER,"             // Original log ID
+		"  date TEXT,"              // ISO8601 date from log
+		"  size_bytes INTEGER,"     // Size in bytes
+		"  downloaded INTEGER DEFAULT 0" // Has it been downloaded
+		");";
+
+	// Create uploads table
+	const char* create_uploads_table =
+		"CREATE TABLE IF NOT EXISTS uploads ("
+		"  backend_id TEXT,"         // Name of the backend
+		"  uuid TEXT,"               // UUID of the log
+		"  state INTEGER,"           // UploadState
+		"  attempts INTEGER DEFAULT 0," // Number of upload attempts
+		"  message TEXT,"            // Last result, or the reason for rejection
+		"  updated_at TEXT,"         // When the state last changed
+		"  PRIMARY KEY (backend_id, uuid)"
+		");";
+
+	if (!execute_query(create_logs_table) || !execute_query(create_uploads_table) || !migrate()) {
+		return false;
+	}
+
+	// Prepare all queries once, they are reset and rebound on every call
+	return prepare_statement(_statements.log_exists,
+				 "SELECT COUNT(*) FROM logs WHERE uuid = ?")
+	       && prepare_statement(_statements.insert_log,
+				    "INSERT INTO logs (uuid, id, date, size_bytes, downloaded, vehicle_id) "
+				    "VALUES (?, ?, ?, ?, 0, ?) "
+				    "ON CONFLICT(uuid) DO NOTHING")
+	       && prepare_statement(_statements.update_download_status,
+				    "UPDATE logs SET downloaded = ? WHERE uuid = ?")
+	       && prepare_statement(_statements.update_compressed_size,
+				    "UPDATE logs SET compressed_size = ? WHERE uuid = ?")
+	       && prepare_statement(_statements.num_logs_to_download,
+				    "SELECT value FROM counters WHERE name = 'pending_downloads'")
+	       && prepare_statement(_statements.next_log_to_download,
+				    "SELECT uuid, id, date, size_bytes, downloaded, compressed_size, vehicle_id "
+				    "FROM logs WHERE downloaded = 0 "
+				    "ORDER BY date DESC, size_bytes DESC LIMIT 1")
+	       && prepare_statement(_statements.num_vehicle_logs_to_download,
+				    "SELECT pending_downloads FROM vehicles WHERE vehicle_id = ?")
+	       && prepare_statement(_statements.next_vehicle_log_to_download,
+				    "SELECT uuid, id, date, size_bytes, downloaded, compressed_size, vehicle_id "
+				    "FROM logs WHERE vehicle_id = ? AND downloaded = 0 "
+				    "ORDER BY date DESC, size_bytes DESC LIMIT 1")
+	       && prepare_statement(_statements.vehicle_logs_to_download,
+				    "SELECT uuid, id, date, size_bytes, downloaded, compressed_size, vehicle_id "
+				    "FROM logs WHERE vehicle_id = ?1 AND downloaded = 0 "
+				    "ORDER BY date DESC, size_bytes DESC LIMIT ?2")
+	       && prepare_statement(_statements.num_logs_to_upload,
+				    "SELECT pending_uploads FROM backends WHERE backend_id = ?")
+	       && prepare_statement(_statements.next_log_to_upload,
+				    "SELECT l.uuid, l.id, l.date, l.size_bytes, l.downloaded, l.compressed_size, l.vehicle_id "
+				    "FROM upload_queue q JOIN logs l ON l.uuid = q.uuid "
+				    "WHERE q.backend_id = ?1 AND q.next_retry <= ?2 "
+				    "ORDER BY q.date DESC, q.size_bytes DESC LIMIT 1")
+	       && prepare_statement(_statements.logs_to_upload,
+				    "SELECT l.uuid, l.id, l.date, l.size_bytes, l.downloaded, l.compressed_size, l.vehicle_id "
+				    "FROM upload_queue q JOIN logs l ON l.uuid = q.uuid "
+				    "WHERE q.backend_id = ?1 AND q.next_retry <= ?3 "
+				    "ORDER BY q.date DESC, q.size_bytes DESC LIMIT ?2")
+	       && prepare_statement(_statements.upload_attempts,
+				    "SELECT attempts FROM uploads WHERE backend_id = ? AND uuid = ?")
+	       && prepare_statement(_statements.set_upload_retry,
+				    "UPDATE upload_queue SET next_retry = ?3 WHERE backend_id = ?1 AND uuid = ?2")
+	       && prepare_statement(_statements.next_upload_retry,
+				    "SELECT MIN(next_retry) FROM upload_queue WHERE backend_id = ?1 AND next_retry > ?2")
+	       && prepare_statement(_statements.register_backend,
+				    "INSERT INTO backends (backend_id) VALUES (?) "
+				    "ON CONFLICT(backend_id) DO NOTHING")
+	       && prepare_statement(_statements.set_backend_enabled,
+				    "UPDATE backends SET upload_enabled = ?2 WHERE backend_id = ?1")
+	       && prepare_statement(_statements.fill_upload_queue,
+				    "INSERT OR IGNORE INTO upload_queue (backend_id, uuid, date, size_bytes) "
+				    "SELECT ?1, l.uuid, l.date, l.size_bytes FROM logs l "
+				    "WHERE l.downloaded = 1 AND l.evicted = 0 "
+				    "AND NOT EXISTS (SELECT 1 FROM uploads u WHERE u.backend_id = ?1 AND u.uuid = l.uuid AND u.state != 0)")
+	       && prepare_statement(_statements.set_upload_state,
+				    "INSERT INTO uploads (backend_id, uuid, state, attempts, message, updated_at) "
+				    "VALUES (?, ?, ?, 1, ?, datetime('now', 'localtime')) "
+				    "ON CONFLICT(backend_id, uuid) DO UPDATE SET "
+				    "state = excluded.state, attempts = attempts + 1, "
+				    "message = excluded.message, updated_at = excluded.updated_at")
+	       && prepare_statement(_statements.is_blacklisted,
+				    "SELECT COUNT(*) FROM uploads WHERE backend_id = ? AND uuid = ? AND state = 2")
+	       && prepare_statement(_statements.filepath_from_uuid,
+				    "SELECT id, date, compressed_size, vehicle_id FROM logs WHERE uuid = ?")
+	       && prepare_statement(_statements.stored_bytes,
+				    "SELECT value FROM counters WHERE name = 'stored_bytes'")
+	       && prepare_statement(_statements.uploaded_logs_to_evict,
+				    "SELECT l.uuid, l.id, l.date, l.size_bytes, l.downloaded, l.compressed_size, l.vehicle_id "
+				    "FROM logs l WHERE l.downloaded = 1 AND l.evicted = 0 "
+				    "AND NOT EXISTS (SELECT 1 FROM backends b WHERE b.upload_enabled = 1 "
+				    "AND NOT EXISTS (SELECT 1 FROM uploads u WHERE u.backend_id = b.backend_id AND u.uuid = l.uuid AND u.state = 1)) "
+				    "ORDER BY l.date ASC, l.size_bytes ASC LIMIT ?")
+	       && prepare_statement(_statements.logs_to_evict,
+				    "SELECT uuid, id, date, size_bytes, downloaded, compressed_size, vehicle_id "
+				    "FROM logs WHERE downloaded = 1 AND evicted = 0 "
+				    "ORDER BY date ASC, size_bytes ASC LIMIT ?")
+	       && prepare_statement(_statements.set_evicted,
+				    "UPDATE logs SET evicted = 1 WHERE uuid = ?")
+	       && prepare_statement(_statements.logs_to_index,
+				    "SELECT uuid FROM logs WHERE downloaded = 1 AND evicted = 0 AND indexed = 0 "
+				    "ORDER BY date DESC LIMIT ?")
+	       && prepare_statement(_statements.set_log_metadata,
+				    "UPDATE logs SET indexed = 1, duration_s = ?2, vehicle_uuid = ?3, firmware_version = ?4, "
+				    "hardware = ?5, topics = ?6 WHERE uuid = ?1")
+	       && prepare_statement(_statements.set_index_failed,
+				    "UPDATE logs SET indexed = -1 WHERE uuid = ?")
+	       && prepare_statement(_statements.log_metadata,
+				    "SELECT duration_s, vehicle_uuid, firmware_version, hardware, topics "
+				    "FROM logs WHERE uuid = ? AND indexed = 1")
+	       && prepare_statement(_statements.set_content_hash,
+				    "UPDATE logs SET content_hash = ?2, head_hash = ?3, tail_hash = ?4 WHERE uuid = ?1")
+	       && prepare_statement(_statements.has_end_hashes,
+				    "SELECT COUNT(*) FROM logs WHERE size_bytes = ? AND head_hash IS NOT NULL AND tail_hash IS NOT NULL")
+	       && prepare_statement(_statements.duplicate_by_ends,
+				    "SELECT o.uuid FROM logs o WHERE o.size_bytes = ?2 AND o.head_hash = ?3 AND o.tail_hash = ?4 AND o.uuid != ?1 "
+				    "AND o.duplicate_of IS NULL AND o.downloaded = 1 "
+				    "AND (o.evicted = 0 OR NOT EXISTS (SELECT 1 FROM backends b WHERE b.upload_enabled = 1 "
+				    "AND NOT EXISTS (SELECT 1 FROM uploads u WHERE u.backend_id = b.backend_id AND u.uuid = o.uuid AND u.state = 1))) "
+				    "LIMIT 1")
+	       && prepare_statement(_statements.duplicate_by_content,
+				    "SELECT o.uuid FROM logs o WHERE o.content_hash = ?2 AND o.uuid != ?1 "
+				    "AND o.duplicate_of IS NULL AND o.downloaded = 1 "
+				    "AND (o.evicted = 0 OR NOT EXISTS (SELECT 1 FROM backends b WHERE b.upload_enabled = 1 "
+				    "AND NOT EXISTS (SELECT 1 FROM uploads u WHERE u.backend_id = b.backend_id AND u.uuid = o.uuid AND u.state = 1))) "
+				    "LIMIT 1")
+	       && prepare_statement(_statements.set_duplicate_of,
+				    "UPDATE logs SET duplicate_of = ?2, evicted = 1 WHERE uuid = ?1")
+	       && prepare_statement(_statements.uploaded_duplicate,
+				    "SELECT o.uuid FROM logs l JOIN logs o ON o.content_hash = l.content_hash AND o.uuid != l.uuid "
+				    "JOIN uploads u ON u.uuid = o.uuid AND u.backend_id = ?1 AND u.state = 1 "
+				    "WHERE l.uuid = ?2 LIMIT 1");
+}
+
+void Database::close_database()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	// Statements must be finalized before the connection can be closed
+	_statements = {};
+
+	if (_db) {
+		sqlite3_close(_db);
+		_db = nullptr;
+	}
+}
+
+bool Database::register_backend(const std::string& backend_id, bool upload_enabled)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.register_backend.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, backend_id.c_str(), -1, SQLITE_STATIC);
+
+	if (sqlite3_step(stmt) != SQLITE_DONE) {
+		LOG_ERROR("SQL error registering backend " << backend_id << ": " << sqlite3_errmsg(_db));
+		return false;
+	}
+
+	bool added = sqlite3_changes(_db) > 0;
+
+	// Logs only wait for the backends that upload, see get_logs_to_evict()
+	sqlite3_stmt* enabled = _statements.set_backend_enabled.get();
+	StatementReset enabled_reset(enabled);
+
+	sqlite3_bind_text(enabled, 1, backend_id.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_int(enabled, 2, upload_enabled);
+
+	if (sqlite3_step(enabled) != SQLITE_DONE) {
+		LOG_ERROR("SQL error updating backend " << backend_id << ": " << sqlite3_errmsg(_db));
+		return false;
+	}
+
+	if (!added) {
+		return true;
+	}
+
+	// A new backend starts out with every downloaded log in its queue
+	sqlite3_stmt* fill = _statements.fill_upload_queue.get();
+	StatementReset fill_reset(fill);
+
+	sqlite3_bind_text(fill, 1, backend_id.c_str(), -1, SQLITE_STATIC);
+
+	return sqlite3_step(fill) == SQLITE_DONE;
+}
+
+bool Database::import_legacy_database(const std::string& path, const std::string& backend_id)
+{
+	if (!fs::exists(path)) {
+		return true;
+	}
+
+	LOG("Importing " << path << " for backend " << backend_id);
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = nullptr;
+
+	if (sqlite3_prepare_v2(_db, "ATTACH DATABASE ? AS legacy", -1, &stmt, nullptr) != SQLITE_OK) {
+		LOG_ERROR("SQL error preparing attach: " << sqlite3_errmsg(_db));
+		return false;
+	}
+
+	sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_STATIC);
+	bool attached = sqlite3_step(stmt) == SQLITE_DONE;
+	sqlite3_finalize(stmt);
+
+	if (!attached) {
+		LOG_ERROR("SQL error attaching " << path << ": " << sqlite3_errmsg(_db));
+		return false;
+	}
+
+	// Log catalog and download status are the same in every legacy database, the upload status
+	// and the blacklist become the uploads rows of the backend
+	const char* import_queries[] = {
+		"INSERT OR IGNORE INTO logs (uuid, id, date, size_bytes, downloaded) "
+		"SELECT uuid, id, date, size_bytes, downloaded FROM legacy.logs",
+
+		"UPDATE logs SET downloaded = 1 "
+		"WHERE uuid IN (SELECT uuid FROM legacy.logs WHERE downloaded = 1)",
+
+		"INSERT OR IGNORE INTO uploads (backend_id, uuid, state, attempts, message, updated_at) "
+		"SELECT ?1, uuid, 2, 1, reason, timestamp FROM legacy.blacklist",
+
+		"INSERT OR IGNORE INTO uploads (backend_id, uuid, state, attempts, message, updated_at) "
+		"SELECT ?1, uuid, 1, 1, '', datetime('now', 'localtime') FROM legacy.logs WHERE uploaded = 1",
+	};
+
+	bool success = execute_query("BEGIN TRANSACTION");
+
+	for (const char* query : import_queries) {
+		if (!success) {
+			break;
+		}
+
+		if (sqlite3_prepare_v2(_db, query, -1, &stmt, nullptr) != SQLITE_OK) {
+			LOG_ERROR("SQL error preparing import: " << sqlite3_errmsg(_db));
+			success = false;
+			break;
+		}
+
+		if (sqlite3_bind_parameter_count(stmt) > 0) {
+			sqlite3_bind_text(stmt, 1, backend_id.c_str(), -1, SQLITE_STATIC);
+		}
+
+		success = sqlite3_step(stmt) == SQLITE_DONE;
+
+		if (!success) {
+			LOG_ERROR("SQL error importing " << path << ": " << sqlite3_errmsg(_db));
+		}
+
+		sqlite3_finalize(stmt);
+	}
+
+	// Legacy databases still use the old UUIDs
+	success = success && rehash_uuids() && execute_query("COMMIT");
+
+	if (!success) {
+		execute_query("ROLLBACK");
+	}
+
+	execute_query("DETACH DATABASE legacy");
+
+	if (success) {
+		// Keep the old file around but make sure it is only imported once
+		std::error_code ec;
+		fs::rename(path, path + ".imported", ec);
+
+		if (ec) {
+			LOG("Failed to rename " << path << ": " << ec.message());
+		}
+	}
+
+	return success;
+}
+
+std::string Database::generate_uuid(const mavsdk::LogFiles::Entry& entry, uint8_t vehicle_id)
+{
+	return uuid_to_string(uuid_hash(entry, vehicle_id));
+}
+
+uint64_t Database::uuid_hash(const mavsdk::LogFiles::Entry& entry, uint8_t vehicle_id)
+{
+	// Build "[sys<id>/]<date>_<size_bytes>[_<log id>]" on the stack, dates from the vehicle are 20 characters
+	char buffer[64];
+	char* start = buffer;
+	size_t date_length = entry.date.size();
+	bool undated = entry.date.starts_with("1970");
+
+	if (date_length + 1 + 10 + 7 + 11 > sizeof(buffer)) {
+		std::string key = entry.date + "_" + std::to_string(entry.size_bytes);
+
+		if (undated) {
+			key += "_" + std::to_string(entry.id);
+		}
+
+		if (vehicle_id != 1) {
+			key = "sys" + std::to_string(vehicle_id) + "/" + key;
+		}
+
+		return xxhash64(key.data(), key.size());
+	}
+
+	if (vehicle_id != 1) {
+		std::memcpy(start, "sys", 3);
+		start = std::to_chars(start + 3, buffer + sizeof(buffer), vehicle_id).ptr;
+		*start++ = '/';
+	}
+
+	std::memcpy(start, entry.date.data(), date_length);
+	start[date_length] = '_';
+	char* end = std::to_chars(start + date_length + 1, buffer + sizeof(buffer), entry.size_bytes).ptr;
+
+	if (undated) {
+		*end++ = '_';
+		end = std::to_chars(end, buffer + sizeof(buffer), entry.id).ptr;
+	}
+
+	return xxhash64(buffer, end - buffer);
+}
+
+std::string Database::uuid_to_string(uint64_t hash)
+{
+	static const char digits[] = "0123456789abcdef";
+
+	std::string uuid(16, '0');
+
+	for (int i = 15; i >= 0; i--) {
+		uuid[i] = digits[hash & 0xF];
+		hash >>= 4;
+	}
+
+	return uuid;
+}
+
+bool Database::uuid_from_string(const std::string& uuid, uint64_t& hash)
+{
+	auto [ptr, ec] = std::from_chars(uuid.data(), uuid.data() + uuid.size(), hash, 16);
+	return ec == std::errc() && ptr == uuid.data() + uuid.size();
+}
+
+bool Database::add_log_entry(const mavsdk::LogFiles::Entry& entry, uint8_t vehicle_id)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return insert_log(entry, vehicle_id) != InsertResult::Failed;
+}
+
+std::vector<std::string> Database::add_log_entries(const std::vector<mavsdk::LogFiles::Entry>& entries, uint8_t vehicle_id)
+{
+	std::vector<std::string> added_uuids;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	// Apply the whole list in a single transaction so it costs one commit instead of one per entry
+	if (!execute_query("BEGIN TRANSACTION")) {
+		return added_uuids;
+	}
+
+	for (const auto& entry : entries) {
+		InsertResult result = insert_log(entry, vehicle_id);
+
+		if (result == InsertResult::Failed) {
+			LOG_ERROR("SQL error adding log entry: " << sqlite3_errmsg(_db));
+			execute_query("ROLLBACK");
+			return {};
+		}
+
+		if (result == InsertResult::Added) {
+			added_uuids.push_back(generate_uuid(entry, vehicle_id));
+		}
+	}
+
+	if (!execute_query("COMMIT")) {
+		execute_query("ROLLBACK");
+		return {};
+	}
+
+	return added_uuids;
+}
+
+Database::InsertResult Database::insert_log(const mavsdk::LogFiles::Entry& entry, uint8_t vehicle_id)
+{
+	std::string uuid = generate_uuid(entry, vehicle_id);
+
+	sqlite3_stmt* stmt = _statements.insert_log.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_int(stmt, 2, entry.id);
+	sqlite3_bind_text(stmt, 3, entry.date.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_int(stmt, 4, entry.size_bytes);
+	sqlite3_bind_int(stmt, 5, vehicle_id);
+
+	if (sqlite3_step(stmt) != SQLITE_DONE) {
+		return InsertResult::Failed;
+	}
+
+	// No rows are changed when the log already exists
+	return sqlite3_changes(_db) > 0 ? InsertResult::Added : InsertResult::Exists;
+}
+
+bool Database::log_exists(const std::string& uuid)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.log_exists.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
+
+	return sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0;
+}
+
+bool Database::update_download_status(const std::string& uuid, bool downloaded)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.update_download_status.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_int(stmt, 1, downloaded ? 1 : 0);
+	sqlite3_bind_text(stmt, 2, uuid.c_str(), -1, SQLITE_STATIC);
+
+	return sqlite3_step(stmt) == SQLITE_DONE;
+}
+
+bool Database::update_compressed_size(const std::string& uuid, uint64_t compressed_size)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.update_compressed_size.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_int64(stmt, 1, compressed_size);
+	sqlite3_bind_text(stmt, 2, uuid.c_str(), -1, SQLITE_STATIC);
+
+	return sqlite3_step(stmt) == SQLITE_DONE;
+}
+
+bool Database::set_evicted(const std::string& uuid)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.set_evicted.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
+
+	return sqlite3_step(stmt) == SQLITE_DONE;
+}
+
+uint64_t Database::stored_bytes()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.stored_bytes.get();
+	StatementReset reset(stmt);
+
+	uint64_t bytes = 0;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		bytes = sqlite3_column_int64(stmt, 0);
+	}
+
+	return bytes;
+}
+
+std::vector<Database::LogEntry> Database::get_logs_to_evict(bool uploaded_only, uint32_t limit)
+{
+	std::vector<LogEntry> entries;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = uploaded_only ? _statements.uploaded_logs_to_evict.get() : _statements.logs_to_evict.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_int(stmt, 1, limit);
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		entries.push_back(row_to_log_entry(stmt));
+	}
+
+	return entries;
+}
+
+std::vector<std::string> Database::get_logs_to_index(uint32_t limit)
+{
+	std::vector<std::string> uuids;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.logs_to_index.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_int(stmt, 1, limit);
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		const unsigned char* uuid_text = sqlite3_column_text(stmt, 0);
+
+		if (uuid_text != nullptr) {
+			uuids.emplace_back(reinterpret_cast<const char*>(uuid_text));
+		}
+	}
+
+	return uuids;
+}
+
+bool Database::set_log_metadata(const std::string& uuid, const LogMetadata& metadata)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.set_log_metadata.get();
+	StatementReset reset(stmt);
+
+	// Fields missing from the log are NULL rather than empty
+	auto bind_text = [stmt](int index, const std::string& value) {
+		if (value.empty()) {
+			sqlite3_bind_null(stmt, index);
+
+		} else {
+			sqlite3_bind_text(stmt, index, value.c_str(), -1, SQLITE_STATIC);
+		}
+	};
+
+	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_double(stmt, 2, metadata.duration_s);
+	bind_text(3, metadata.vehicle_uuid);
+	bind_text(4, metadata.firmware_version);
+	bind_text(5, metadata.hardware);
+	bind_text(6, metadata.topics);
+
+	if (sqlite3_step(stmt) != SQLITE_DONE) {
+		LOG_ERROR("SQL error storing metadata of " << uuid << ": " << sqlite3_errmsg(_db));
+		return false;
+	}
+
+	return true;
+}
+
+bool Database::set_index_failed(const std::string& uuid)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.set_index_failed.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
+
+	return sqlite3_step(stmt) == SQLITE_DONE;
+}
+
+bool Database::get_log_metadata(const std::string& uuid, LogMetadata& metadata)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.log_metadata.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
+
+	if (sqlite3_step(stmt) != SQLITE_ROW) {
+		return false;
+	}
+
+	auto column_text = [stmt](int column) {
+		const unsigned char* text = sqlite3_column_text(stmt, column);
+		return text ? std::string(reinterpret_cast<const char*>(text)) : std::string();
+	};
+
+	metadata.duration_s = sqlite3_column_double(stmt, 0);
+	metadata.vehicle_uuid = column_text(1);
+	metadata.firmware_version = column_text(2);
+	metadata.hardware = column_text(3);
+	metadata.topics = column_text(4);
+
+	return true;
+}
+
+bool Database::set_content_hash(const std::string& uuid, const std::string& content_hash, const std::string& head_hash,
+				const std::string& tail_hash)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.set_content_hash.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, content_hash.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 3, head_hash.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 4, tail_hash.c_str(), -1, SQLITE_STATIC);
+
+	return sqlite3_step(stmt) == SQLITE_DONE;
+}
+
+bool Database::has_end_hashes(uint32_t size_bytes)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.has_end_hashes.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_int64(stmt, 1, size_bytes);
+
+	return sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0;
+}
+
+std::string Database::find_duplicate_by_ends(const std::string& uuid, uint32_t size_bytes, const std::string& head_hash,
+		const std::string& tail_hash)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.duplicate_by_ends.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 2, size_bytes);
+	sqlite3_bind_text(stmt, 3, head_hash.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 4, tail_hash.c_str(), -1, SQLITE_STATIC);
+
+	return query_uuid(stmt);
+}
+
+std::string Database::find_duplicate_by_content(const std::string& uuid, const std::string& content_hash)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.duplicate_by_content.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, content_hash.c_str(), -1, SQLITE_STATIC);
+
+	return query_uuid(stmt);
+}
+
+bool Database::set_duplicate(const std::string& uuid, const std::string& original_uuid)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (!execute_query("BEGIN TRANSACTION")) {
+		return false;
+	}
+
+	// Downloaded first and evicted second so that the triggers take it out of the upload queues
+	sqlite3_stmt* downloaded = _statements.update_download_status.get();
+	StatementReset downloaded_reset(downloaded);
+
+	sqlite3_bind_int(downloaded, 1, 1);
+	sqlite3_bind_text(downloaded, 2, uuid.c_str(), -1, SQLITE_STATIC);
+
+	sqlite3_stmt* duplicate = _statements.set_duplicate_of.get();
+	StatementReset duplicate_reset(duplicate);
+
+	sqlite3_bind_text(duplicate, 1, uuid.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_text(duplicate, 2, original_uuid.c_str(), -1, SQLITE_STATIC);
+
+	if (sqlite3_step(downloaded) != SQLITE_DONE || sqlite3_step(duplicate) != SQLITE_DONE || !execute_query("COMMIT")) {
+		LOG_ERROR("SQL error marking " << uuid << " as duplicate: " << sqlite3_errmsg(_db));
+		execute_query("ROLLBACK");
+		return false;
+	}
+
+	return true;
+}
+
+std::string Database::uploaded_duplicate(const std::string& backend_id, const std::string& uuid)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.uploaded_duplicate.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, backend_id.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, uuid.c_str(), -1, SQLITE_STATIC);
+
+	return query_uuid(stmt);
+}
+
+uint32_t Database::num_logs_to_download()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.num_logs_to_download.get();
+	StatementReset reset(stmt);
+
+	uint32_t log_count = 0;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		log_count = sqlite3_column_int(stmt, 0);
+	}
+
+	return log_count;
+}
+
+Database::LogEntry Database::get_next_log_to_download()
+{
+	LogEntry empty_entry;
+	empty_entry.uuid = ""; // Empty UUID indicates not found
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.next_log_to_download.get();
+	StatementReset reset(stmt);
+
+	LogEntry entry = empty_entry;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		entry = row_to_log_entry(stmt);
+	}
+
+	return entry;
+}
+
+uint32_t Database::num_logs_to_download(uint8_t vehicle_id)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.num_vehicle_logs_to_download.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_int(stmt, 1, vehicle_id);
+
+	uint32_t log_count = 0;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		log_count = sqlite3_column_int(stmt, 0);
+	}
+
+	return log_count;
+}
+
+Database::LogEntry Database::get_next_log_to_download(uint8_t vehicle_id)
+{
+	LogEntry empty_entry;
+	empty_entry.uuid = ""; // Empty UUID indicates not found
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.next_vehicle_log_to_download.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_int(stmt, 1, vehicle_id);
+
+	LogEntry entry = empty_entry;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		entry = row_to_log_entry(stmt);
+	}
+
+	return entry;
+}
+
+std::vector<Database::LogEntry> Database::get_logs_to_download(uint8_t vehicle_id, uint32_t limit)
+{
+	std::vector<LogEntry> entries;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.vehicle_logs_to_download.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_int(stmt, 1, vehicle_id);
+	sqlite3_bind_int(stmt, 2, limit);
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		entries.push_back(row_to_log_entry(stmt));
+	}
+
+	return entries;
+}
+
+uint32_t Database::num_logs_to_upload(const std::string& backend_id)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.num_logs_to_upload.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, backend_id.c_str(), -1, SQLITE_STATIC);
+
+	uint32_t log_count = 0;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		log_count = sqlite3_column_int(stmt, 0);
+	}
+
+	return log_count;
+}
+
+Database::LogEntry Database::get_next_log_to_upload(const std::string& backend_id)
+{
+	LogEntry empty_entry;
+	empty_entry.uuid = ""; // Empty UUID indicates not found
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.next_log_to_upload.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, backend_id.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 2, unix_seconds(std::chrono::system_clock::now()));
+
+	LogEntry entry = empty_entry;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		entry = row_to_log_entry(stmt);
+	}
+
+	return entry;
+}
+
+std::vector<Database::LogEntry> Database::get_logs_to_upload(const std::string& backend_id, uint32_t limit)
+{
+	std::vector<LogEntry> entries;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.logs_to_upload.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, backend_id.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_int(stmt, 2, limit);
+	sqlite3_bind_int64(stmt, 3, unix_seconds(std::chrono::system_clock::now()));
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		entries.push_back(row_to_log_entry(stmt));
+	}
+
+	return entries;
+}
+
+bool Database::set_upload_state(const std::string& backend_id, const std::string& uuid, UploadState state,
+				const std::string& message)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.set_upload_state.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, backend_id.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, uuid.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_int(stmt, 3, static_cast<int>(state));
+	sqlite3_bind_text(stmt, 4, message.c_str(), -1, SQLITE_STATIC);
+
+	return sqlite3_step(stmt) == SQLITE_DONE;
+}
+
+uint32_t Database::upload_attempts(const std::string& backend_id, const std::string& uuid)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.upload_attempts.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, backend_id.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, uuid.c_str(), -1, SQLITE_STATIC);
+
+	uint32_t attempts = 0;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		attempts = sqlite3_column_int(stmt, 0);
+	}
+
+	return attempts;
+}
+
+bool Database::set_upload_retry(const std::string& backend_id, const std::string& uuid,
+				std::chrono::system_clock::time_point next_retry)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.set_upload_retry.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, backend_id.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, uuid.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 3, unix_seconds(next_retry));
+
+	return sqlite3_step(stmt) == SQLITE_DONE;
+}
+
+std::chrono::system_clock::time_point Database::next_upload_retry(const std::string& backend_id)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.next_upload_retry.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, backend_id.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 2, unix_seconds(std::chrono::system_clock::now()));
+
+	std::chrono::system_clock::time_point next_retry {};
+
+	// MIN() of no rows is NULL
+	if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+		next_retry = std::chrono::system_clock::time_point(std::chrono::seconds(sqlite3_column_int64(stmt, 0)));
+	}
+
+	return next_retry;
+}
+
+bool Database::is_blacklisted(const std::string& backend_id, const std::string& uuid)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	sqlite3_stmt* stmt = _statements.is_blacklisted.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, backend_id.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, uuid.c_str(), -1, SQLITE_STATIC);
+
+	bool blacklisted = false;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		blacklisted = sqlite3_column_int(stmt, 0) > 0;
+	}
+
+	return blacklisted;
+}
+
+std::string Database::vehicle_directory(uint8_t vehicle_id) const
+{
+	if (vehicle_id == 1) {
+		return _settings.logs_directory;
+	}
+
+	return _settings.logs_directory + "sys" + std::to_string(vehicle_id) + "/";
+}
+
+std::string Database::filepath_from_entry(const mavsdk::LogFiles::Entry& entry, uint8_t vehicle_id) const
+{
+	std::ostringstream ss;
+	ss << vehicle_directory(vehicle_id) << "LOG" << std::setfill('0') << std::setw(4) << entry.id << "_" << entry.date << ".ulg";
+	return ss.str();
+}
+
+std::string Database::filepath_from_uuid(const std::string& uuid) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	// Look up the log entry by UUID
+	sqlite3_stmt* stmt = _statements.filepath_from_uuid.get();
+	StatementReset reset(stmt);
+
+	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
+
+	std::string filepath;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		int id = sqlite3_column_int(stmt, 0);
+		const unsigned char* date_text = sqlite3_column_text(stmt, 1);
+
+		if (date_text != nullptr) {
+			std::string date = reinterpret_cast<const char*>(date_text);
+			std::ostringstream ss;
+			ss << vehicle_directory(sqlite3_column_int(stmt, 3)) << "LOG" << std::setfill('0') << std::setw(4) << id << "_" << date << ".ulg";
+
+			if (sqlite3_column_int64(stmt, 2) > 0) {
+				ss << ".zst";
+			}
+
+			filepath = ss.str();
+		}
+	}
+
+	return filepath;
+}
+
+uint8_t Database::vehicle_from_filepath(const std::string& filepath)
+{
+	std::string directory = fs::path(filepath).parent_path().filename().string();
+	unsigned vehicle_id = 0;
+
+	if (directory.size() <= 3 || directory.compare(0, 3, "sys") != 0) {
+		return 1;
+	}
+
+	auto [ptr, ec] = std::from_chars(directory.data() + 3, directory.data() + directory.size(), vehicle_id);
+
+	if (ec != std::errc() || ptr != directory.data() + directory.size() || vehicle_id == 0 || vehicle_id > 255) {
+		return 1;
+	}
+
+	return vehicle_id;
+}
+
+bool Database::execute_query(const std::string& query)
+{
+	char* error_msg = nullptr;
+	int rc = sqlite3_exec(_db, query.c_str(), nullptr, nullptr, &error_msg);
+
+	if (rc != SQLITE_OK) {
+		LOG_ERROR("SQL error: " << error_msg);
+		sqlite3_free(error_msg);
+		return false;
+	}
+
+	return true;
+}
+
+bool Database::has_column(const char* table, const char* column)
+{
+	std::string query = std::string("SELECT COUNT(*) FROM pragma_table_info('") + table + "') WHERE name = ?";
+	sqlite3_stmt* stmt = nullptr;
+
+	if (sqlite3_prepare_v2(_db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+		LOG_ERROR("SQL error preparing \"" << query << "\": " << sqlite3_errmsg(_db));
+		return false;
+	}
+
+	sqlite3_bind_text(stmt, 1, column, -1, SQLITE_STATIC);
+	bool exists = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) > 0;
+	sqlite3_finalize(stmt);
+
+	return exists;
+}
+
+bool Database::add_column_if_missing(const char* table, const char* column, const char* definition)
+{
+	if (has_column(table, column)) {
+		return true;
+	}
+
+	return execute_query(std::string("ALTER TABLE ") + table + " ADD COLUMN " + column + " " + definition);
+}
+
+bool Database::migrate()
+{
+	// Applied in order to databases with an older user_version, each in its own transaction.
+	// Append new migrations to the end, never change one that has been released.
+	const std::vector<Migration> migrations = {
+		{1, "stable XXH64 UUIDs", [this] { return rehash_uuids(); }},
+
+		{2, "compressed log archive", [this] { return add_column_if_missing("logs", "compressed_size", "INTEGER DEFAULT 0"); }},
+
+		{3, "indexed work queues", [this] { return create_work_queues(); }},
+
+		{4, "multi-vehicle namespaces", [this] { return create_vehicle_queues(); }},
+
+		{5, "upload retry backoff", [this] { return create_upload_retry(); }},
+
+		{6, "log retention", [this] { return create_retention(); }},
+
+		{7, "flight catalog", [this] { return create_flight_catalog(); }},
+
+		{8, "content hashes", [this] { return create_content_hashes(); }},
+
+		{9, "tail hashes", [this] { return add_column_if_missing("logs", "tail_hash", "TEXT"); }},
+	};
+
+	int version = user_version();
+
+	for (const auto& migration : migrations) {
+		if (migration.version <= version) {
+			continue;
+		}
+
+		LOG("Migrating database to version " << migration.version << ": " << migration.description);
+
+		bool success = execute_query("BEGIN TRANSACTION")
+			       && migration.apply()
+			       && execute_query("PRAGMA user_version = " + std::to_string(migration.version))
+			       && execute_query("COMMIT");
+
+		if (!success) {
+			LOG_ERROR("Database migration to version " << migration.version << " failed");
+			execute_query("ROLLBACK");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Database::create_work_queues()
+{
+	// Pending downloads are served by a partial index, pending uploads live in their own table with
+	// one row per backend and log. Triggers keep both and their counters in step with the state
+	// columns, so no caller has to remember to maintain them.
+	const char* queries[] = {
+		"CREATE INDEX logs_pending_download ON logs (date DESC, size_bytes DESC) WHERE downloaded = 0",
+
+		"CREATE TABLE counters ("
+		"  name TEXT PRIMARY KEY,"
+		"  value INTEGER DEFAULT 0"
+		")",
+
+		"CREATE TABLE backends ("
+		"  backend_id TEXT PRIMARY KEY,"
+		"  pending_uploads INTEGER DEFAULT 0" // Number of rows in upload_queue
+		")",
+
+		// Date and size are copied from logs so the queue can be ordered by its own index
+		"CREATE TABLE upload_queue ("
+		"  backend_id TEXT,"
+		"  uuid TEXT,"
+		"  date TEXT,"
+		"  size_bytes INTEGER,"
+		"  PRIMARY KEY (backend_id, uuid)"
+		")",
+
+		"CREATE INDEX upload_queue_order ON upload_queue (backend_id, date DESC, size_bytes DESC)",
+		"CREATE INDEX upload_queue_uuid ON upload_queue (uuid)",
+
+		// Upload counters
+		"CREATE TRIGGER upload_queue_insert AFTER INSERT ON upload_queue BEGIN "
+		"  UPDATE backends SET pending_uploads = pending_uploads + 1 WHERE backend_id = NEW.backend_id; "
+		"END",
+
+		"CREATE TRIGGER upload_queue_delete AFTER DELETE ON upload_queue BEGIN "
+		"  UPDATE backends SET pending_uploads = pending_uploads - 1 WHERE backend_id = OLD.backend_id; "
+		"END",
+
+		// Log state
+		"CREATE TRIGGER logs_insert AFTER INSERT ON logs BEGIN "
+		"  UPDATE counters SET value = value + 1 WHERE name = 'pending_downloads' AND NEW.downloaded = 0; "
+		"  INSERT OR IGNORE INTO upload_queue (backend_id, uuid, date, size_bytes) "
+		"  SELECT b.backend_id, NEW.uuid, NEW.date, NEW.size_bytes FROM backends b "
+		"  WHERE NEW.downloaded = 1 "
+		"  AND NOT EXISTS (SELECT 1 FROM uploads u WHERE u.backend_id = b.backend_id AND u.uuid = NEW.uuid AND u.state != 0); "
+		"END",
+
+		"CREATE TRIGGER logs_downloaded AFTER UPDATE OF downloaded ON logs WHEN OLD.downloaded != NEW.downloaded BEGIN "
+		"  UPDATE counters SET value = value + (CASE WHEN NEW.downloaded = 0 THEN 1 ELSE -1 END) WHERE name = 'pending_downloads'; "
+		"  DELETE FROM upload_queue WHERE uuid = NEW.uuid AND NEW.downloaded = 0; "
+		"  INSERT OR IGNORE INTO upload_queue (backend_id, uuid, date, size_bytes) "
+		"  SELECT b.backend_id, NEW.uuid, NEW.date, NEW.size_bytes FROM backends b "
+		"  WHERE NEW.downloaded = 1 "
+		"  AND NOT EXISTS (SELECT 1 FROM uploads u WHERE u.backend_id = b.backend_id AND u.uuid = NEW.uuid AND u.state != 0); "
+		"END",
+
+		"CREATE TRIGGER logs_uuid AFTER UPDATE OF uuid ON logs WHEN OLD.uuid != NEW.uuid BEGIN "
+		"  UPDATE OR IGNORE upload_queue SET uuid = NEW.uuid WHERE uuid = OLD.uuid; "
+		"  DELETE FROM upload_queue WHERE uuid = OLD.uuid; "
+		"END",
+
+		"CREATE TRIGGER logs_delete AFTER DELETE ON logs BEGIN "
+		"  UPDATE counters SET value = value - 1 WHERE name = 'pending_downloads' AND OLD.downloaded = 0; "
+		"  DELETE FROM upload_queue WHERE uuid = OLD.uuid; "
+		"END",
+
+		// Upload state, a log leaves the queue of a backend once it is uploaded or rejected
+		"CREATE TRIGGER uploads_insert AFTER INSERT ON uploads WHEN NEW.state != 0 BEGIN "
+		"  DELETE FROM upload_queue WHERE backend_id = NEW.backend_id AND uuid = NEW.uuid; "
+		"END",
+
+		"CREATE TRIGGER uploads_update AFTER UPDATE ON uploads BEGIN "
+		"  DELETE FROM upload_queue WHERE backend_id = NEW.backend_id AND uuid = NEW.uuid AND NEW.state != 0; "
+		"  INSERT OR IGNORE INTO upload_queue (backend_id, uuid, date, size_bytes) "
+		"  SELECT b.backend_id, l.uuid, l.date, l.size_bytes FROM backends b JOIN logs l ON l.uuid = NEW.uuid "
+		"  WHERE b.backend_id = NEW.backend_id AND NEW.state = 0 AND l.downloaded = 1; "
+		"END",
+
+		"CREATE TRIGGER uploads_delete AFTER DELETE ON uploads WHEN OLD.state != 0 BEGIN "
+		"  INSERT OR IGNORE INTO upload_queue (backend_id, uuid, date, size_bytes) "
+		"  SELECT b.backend_id, l.uuid, l.date, l.size_bytes FROM backends b JOIN logs l ON l.uuid = OLD.uuid "
+		"  WHERE b.backend_id = OLD.backend_id AND l.downloaded = 1; "
+		"END",
+
+		// Fill the queues from the existing state, every backend seen so far gets one
+		"INSERT INTO counters (name, value) SELECT 'pending_downloads', COUNT(*) FROM logs WHERE downloaded = 0",
+
+		"INSERT INTO backends (backend_id) SELECT DISTINCT backend_id FROM uploads",
+
+		"INSERT INTO upload_queue (backend_id, uuid, date, size_bytes) "
+		"SELECT b.backend_id, l.uuid, l.date, l.size_bytes FROM backends b JOIN logs l "
+		"WHERE l.downloaded = 1 "
+		"AND NOT EXISTS (SELECT 1 FROM uploads u WHERE u.backend_id = b.backend_id AND u.uuid = l.uuid AND u.state != 0)",
+	};
+
+	for (const char* query : queries) {
+		if (!execute_query(query)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Database::create_vehicle_queues()
+{
+	// Existing logs were all downloaded from system 1. Each vehicle keeps its own pending download
+	// count next to the global one, both are maintained by triggers in the same way.
+	if (!add_column_if_missing("logs", "vehicle_id", "INTEGER NOT NULL DEFAULT 1")) {
+		return false;
+	}
+
+	const char* queries[] = {
+		"CREATE INDEX logs_vehicle_pending_download ON logs (vehicle_id, date DESC, size_bytes DESC) WHERE downloaded = 0",
+
+		"CREATE TABLE vehicles ("
+		"  vehicle_id INTEGER PRIMARY KEY,"
+		"  pending_downloads INTEGER DEFAULT 0"
+		")",
+
+		"CREATE TRIGGER logs_insert_vehicle AFTER INSERT ON logs BEGIN "
+		"  INSERT OR IGNORE INTO vehicles (vehicle_id) VALUES (NEW.vehicle_id); "
+		"  UPDATE vehicles SET pending_downloads = pending_downloads + 1 WHERE vehicle_id = NEW.vehicle_id AND NEW.downloaded = 0; "
+		"END",
+
+		"CREATE TRIGGER logs_downloaded_vehicle AFTER UPDATE OF downloaded ON logs WHEN OLD.downloaded != NEW.downloaded BEGIN "
+		"  UPDATE vehicles SET pending_downloads = pending_downloads + (CASE WHEN NEW.downloaded = 0 THEN 1 ELSE -1 END) "
+		"  WHERE vehicle_id = NEW.vehicle_id; "
+		"END",
+
+		"CREATE TRIGGER logs_delete_vehicle AFTER DELETE ON logs BEGIN "
+		"  UPDATE vehicles SET pending_downloads = pending_downloads - 1 WHERE vehicle_id = OLD.vehicle_id AND OLD.downloaded = 0; "
+		"END",
+
+		"INSERT INTO vehicles (vehicle_id, pending_downloads) "
+		"SELECT vehicle_id, SUM(downloaded = 0) FROM logs GROUP BY vehicle_id",
+	};
+
+	for (const char* query : queries) {
+		if (!execute_query(query)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Database::create_upload_retry()
+{
+	// Unix time before which a log that failed temporarily is not handed out again, 0 when due.
+	// Rows that re-enter the queue start out due, the attempts of the uploads row are kept.
+	return add_column_if_missing("upload_queue", "next_retry", "INTEGER NOT NULL DEFAULT 0")
+	       && execute_query("CREATE INDEX upload_queue_retry ON upload_queue (backend_id, next_retry)");
+}
+
+bool Database::create_retention()
+{
+	// Evicted logs stay in the catalog as downloaded so they are not fetched again, their file is
+	// gone and they leave the upload queues. The bytes of stored logs are summed up by triggers.
+	if (!add_column_if_missing("logs", "evicted", "INTEGER NOT NULL DEFAULT 0")
+	    || !add_column_if_missing("backends", "upload_enabled", "INTEGER NOT NULL DEFAULT 1")) {
+		return false;
+	}
+
+	auto stored_size = [](const std::string& row) {
+		return "(CASE WHEN " + row + ".downloaded = 1 AND " + row + ".evicted = 0 THEN "
+		       "(CASE WHEN " + row + ".compressed_size > 0 THEN " + row + ".compressed_size ELSE " + row + ".size_bytes END) "
+		       "ELSE 0 END)";
+	};
+
+	const std::string queries[] = {
+		"CREATE INDEX logs_stored ON logs (date, size_bytes) WHERE downloaded = 1 AND evicted = 0",
+
+		"CREATE TRIGGER logs_insert_stored AFTER INSERT ON logs BEGIN "
+		"  UPDATE counters SET value = value + " + stored_size("NEW") + " WHERE name = 'stored_bytes'; "
+		"END",
+
+		"CREATE TRIGGER logs_update_stored AFTER UPDATE OF downloaded, compressed_size, evicted ON logs BEGIN "
+		"  UPDATE counters SET value = value - " + stored_size("OLD") + " + " + stored_size("NEW") + " WHERE name = 'stored_bytes'; "
+		"END",
+
+		"CREATE TRIGGER logs_delete_stored AFTER DELETE ON logs BEGIN "
+		"  UPDATE counters SET value = value - " + stored_size("OLD") + " WHERE name = 'stored_bytes'; "
+		"END",
+
+		"CREATE TRIGGER logs_evicted AFTER UPDATE OF evicted ON logs WHEN NEW.evicted = 1 AND OLD.evicted = 0 BEGIN "
+		"  DELETE FROM upload_queue WHERE uuid = NEW.uuid; "
+		"END",
+
+		"INSERT INTO counters (name, value) SELECT 'stored_bytes', COALESCE(SUM(" + stored_size("logs") + "), 0) FROM logs",
+	};
+
+	for (const auto& query : queries) {
+		if (!execute_query(query)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Database::create_flight_catalog()
+{
+	// Filled in by LogIndexer once a log is downloaded. indexed is 0 until then, 1 once the
+	// metadata columns are set and -1 if the log could not be parsed.
+	const std::pair<const char*, const char*> columns[] = {
+		{"indexed", "INTEGER NOT NULL DEFAULT 0"},
+		{"duration_s", "REAL"},
+		{"vehicle_uuid", "TEXT"},
+		{"firmware_version", "TEXT"},
+		{"hardware", "TEXT"},
+		{"topics", "TEXT"},
+	};
+
+	for (const auto& [column, definition] : columns) {
+		if (!add_column_if_missing("logs", column, definition)) {
+			return false;
+		}
+	}
+
+	const char* queries[] = {
+		"CREATE INDEX logs_unindexed ON logs (date DESC) WHERE downloaded = 1 AND evicted = 0 AND indexed = 0",
+
+		"CREATE INDEX logs_vehicle_uuid ON logs (vehicle_uuid, date) WHERE indexed = 1",
+
+		// The catalog as it is meant to be queried, e.g. with the sqlite3 shell
+		"CREATE VIEW flights AS "
+		"SELECT uuid, vehicle_id, id, date, size_bytes, duration_s, vehicle_uuid, firmware_version, hardware, topics "
+		"FROM logs WHERE indexed = 1",
+	};
+
+	for (const char* query : queries) {
+		if (!execute_query(query)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Database::create_content_hashes()
+{
+	// SHA-256 of the raw log and of its first bytes, NULL for logs downloaded before. A duplicate
+	// points at the log whose content it shares and has no file of its own.
+	if (!add_column_if_missing("logs", "content_hash", "TEXT")
+	    || !add_column_if_missing("logs", "head_hash", "TEXT")
+	    || !add_column_if_missing("logs", "duplicate_of", "TEXT")) {
+		return false;
+	}
+
+	// Undated logs now include their log ID in the UUID
+	return execute_query("CREATE INDEX logs_content_hash ON logs (content_hash) WHERE content_hash IS NOT NULL")
+	       && execute_query("CREATE INDEX logs_head_hash ON logs (size_bytes, head_hash) WHERE head_hash IS NOT NULL")
+	       && rehash_uuids();
+}
+
+int Database::user_version()
+{
+	sqlite3_stmt* stmt = nullptr;
+	int version = 0;
+
+	if (sqlite3_prepare_v2(_db, "PRAGMA user_version", -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+		version = sqlite3_column_int(stmt, 0);
+	}
+
+	sqlite3_finalize(stmt);
+	return version;
+}
+
+bool Database::rehash_uuids()
+{
+	// Map every UUID that differs from what generate_uuid() gives for the date and size of the log
+	if (!execute_query("CREATE TEMP TABLE IF NOT EXISTS uuid_map (old_uuid TEXT PRIMARY KEY, new_uuid TEXT)")
+	    || !execute_query("DELETE FROM temp.uuid_map")) {
+		return false;
+	}
+
+	sqlite3_stmt* select = nullptr;
+	sqlite3_stmt* insert = nullptr;
+
+	// Databases older than the multi-vehicle migration only hold logs of system 1
+	const char* select_query = has_column("logs", "vehicle_id")
+				   ? "SELECT uuid, date, size_bytes, vehicle_id, id FROM logs"
+				   : "SELECT uuid, date, size_bytes, 1, id FROM logs";
+
+	bool success = sqlite3_prepare_v2(_db, select_query, -1, &select, nullptr) == SQLITE_OK
+		       && sqlite3_prepare_v2(_db, "INSERT OR IGNORE INTO temp.uuid_map (old_uuid, new_uuid) VALUES (?, ?)", -1, &insert,
+					     nullptr) == SQLITE_OK;
+
+	uint32_t num_changed = 0;
+
+	while (success && sqlite3_step(select) == SQLITE_ROW) {
+		const unsigned char* uuid_text = sqlite3_column_text(select, 0);
+		const unsigned char* date_text = sqlite3_column_text(select, 1);
+
+		mavsdk::LogFiles::Entry entry;
+		entry.date = date_text ? reinterpret_cast<const char*>(date_text) : "";
+		entry.size_bytes = sqlite3_column_int(select, 2);
+		entry.id = sqlite3_column_int(select, 4);
+
+		std::string old_uuid = uuid_text ? reinterpret_cast<const char*>(uuid_text) : "";
+		std::string new_uuid = generate_uuid(entry, sqlite3_column_int(select, 3));
+
+		if (old_uuid == new_uuid) {
+			continue;
+		}
+
+		sqlite3_bind_text(insert, 1, old_uuid.c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_text(insert, 2, new_uuid.c_str(), -1, SQLITE_STATIC);
+		success = sqlite3_step(insert) == SQLITE_DONE;
+		sqlite3_reset(insert);
+		num_changed++;
+	}
+
+	sqlite3_finalize(select);
+	sqlite3_finalize(insert);
+
+	if (!success) {
+		LOG_ERROR("SQL error collecting UUIDs: " << sqlite3_errmsg(_db));
+		return false;
+	}
+
+	if (num_changed == 0) {
+		return execute_query("DROP TABLE temp.uuid_map");
+	}
+
+	LOG("Migrating " << num_changed << " log UUIDs");
+
+	// A log can already exist under its new UUID, e.g. when a legacy database is imported. That
+	// row is kept and only picks up the download flag, upload states already recorded for it win.
+	const char* migrate_queries[] = {
+		"UPDATE logs SET downloaded = 1 WHERE uuid IN "
+		"(SELECT m.new_uuid FROM temp.uuid_map m JOIN logs o ON o.uuid = m.old_uuid WHERE o.downloaded = 1)",
+
+		"DELETE FROM logs WHERE uuid IN "
+		"(SELECT old_uuid FROM temp.uuid_map WHERE new_uuid IN (SELECT uuid FROM logs))",
+
+		"UPDATE logs SET uuid = (SELECT new_uuid FROM temp.uuid_map WHERE old_uuid = logs.uuid) "
+		"WHERE uuid IN (SELECT old_uuid FROM temp.uuid_map)",
+
+		"UPDATE OR IGNORE uploads SET uuid = (SELECT new_uuid FROM temp.uuid_map WHERE old_uuid = uploads.uuid) "
+		"WHERE uuid IN (SELECT old_uuid FROM temp.uuid_map)",
+
+		"DELETE FROM uploads WHERE uuid IN (SELECT old_uuid FROM temp.uuid_map)",
+
+		"DROP TABLE temp.uuid_map",
+	};
+
+	for (const char* query : migrate_queries) {
+		if (!execute_query(query)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Database::prepare_statement(Statement& statement, const char* query)
+{
+	sqlite3_stmt* stmt = nullptr;
+
+	if (sqlite3_prepare_v2(_db, query, -1, &stmt, nullptr) != SQLITE_OK) {
+		LOG_ERROR("SQL error preparing \"" << query << "\": " << sqlite3_errmsg(_db));
+		return false;
+	}
+
+	statement.reset(stmt);
+	return true;
+}
+
+std::string Database::query_uuid(sqlite3_stmt* stmt)
+{
+	std::string uuid;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		const unsigned char* uuid_text = sqlite3_column_text(stmt, 0);
+
+		if (uuid_text != nullptr) {
+			uuid = reinterpret_cast<const char*>(uuid_text);
+		}
+	}
+
+	return uuid;
+}
+
+Database::LogEntry Database::row_to_log_entry(sqlite3_stmt* stmt)
+{
+	LogEntry entry;
+
+	const unsigned char* uuid_text = sqlite3_column_text(stmt, 0);
+
+	if (uuid_text != nullptr) {
+		entry.uuid = reinterpret_cast<const char*>(uuid_text);
+
+	} else {
+		entry.uuid = "";
+	}
+
+	entry.id = sqlite3_column_int(stmt, 1);
+
+	const unsigned char* date_text = sqlite3_column_text(stmt, 2);
+
+	if (date_text != nullptr) {
+		entry.date = reinterpret_cast<const char*>(date_text);
+
+	} else {
+		entry.date = "";
+	}
+
+	entry.size_bytes = sqlite3_column_int(stmt, 3);
+	entry.downloaded = sqlite3_column_int(stmt, 4) != 0;
+	entry.compressed_size = sqlite3_column_int64(stmt, 5);
+	entry.vehicle_id = sqlite3_column_int(stmt, 6);
+
+	return entry;
+}
+
+static int64_t unix_seconds(std::chrono::system_clock::time_point time)
+{
+	return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+}
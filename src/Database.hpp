@@ -0,0 +1,233 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+#include <mavsdk/plugins/log_files/log_files.h>
+
+// Single state database shared by all backends. The logs table is the catalog of logs found on
+// the vehicle and their download status, the uploads table holds the upload state of a log for
+// each backend. A backend only gets a row in uploads once the state of a log changes for it.
+class Database
+{
+public:
+	struct Settings {
+		std::string db_path;
+		std::string logs_directory;
+	};
+
+	struct LogEntry {
+		std::string uuid;
+		uint32_t id {};
+		std::string date;
+		uint32_t size_bytes {};
+		bool downloaded {};
+		uint64_t compressed_size {}; // Size of the archived log, 0 if it is stored uncompressed
+		uint8_t vehicle_id {1};      // MAVLink system ID of the vehicle the log was downloaded from
+	};
+
+	// Flight metadata read from the ULog by LogIndexer, queryable through the flights view
+	struct LogMetadata {
+		double duration_s {};         // First to last timestamp of the logged data
+		std::string vehicle_uuid;     // sys_uuid of the autopilot
+		std::string firmware_version; // ver_sw_release, the git hash of ver_sw for builds without one
+		std::string hardware;         // ver_hw
+		std::string topics;           // Logged topics, sorted and comma separated
+	};
+
+	enum class UploadState {
+		Pending = 0,  // Not uploaded yet, or failed temporarily
+		Uploaded = 1,
+		Rejected = 2  // Permanently refused by the backend, never retried
+	};
+
+	Database(const Settings& settings);
+	~Database();
+
+	// Database initialization
+	bool init_database();
+	void close_database();
+
+	// Backends must be registered before they have an upload queue. Logs are only kept for the
+	// backends that upload.
+	bool register_backend(const std::string& backend_id, bool upload_enabled = true);
+
+	// Merges a per-server database from older versions into this one for the given backend
+	bool import_legacy_database(const std::string& path, const std::string& backend_id);
+
+	// Log entry management
+	// UUID is the XXH64 hash of "<date>_<size_bytes>" as 16 hex digits. Logs of vehicles other than
+	// system 1 hash "sys<id>/<date>_<size_bytes>" so that two vehicles never share a UUID, system 1
+	// keeps the UUIDs of single vehicle installs. Vehicles without a time source date their logs in
+	// 1970, those append "_<log id>" so that flights of the same size do not collide.
+	static std::string generate_uuid(const mavsdk::LogFiles::Entry& entry, uint8_t vehicle_id = 1);
+	static uint64_t uuid_hash(const mavsdk::LogFiles::Entry& entry, uint8_t vehicle_id = 1); // Does not allocate
+	static std::string uuid_to_string(uint64_t hash);
+	static bool uuid_from_string(const std::string& uuid, uint64_t& hash);
+	bool add_log_entry(const mavsdk::LogFiles::Entry& entry, uint8_t vehicle_id = 1);
+	// Adds all entries in one transaction, returns the UUIDs of the entries that were not known yet
+	std::vector<std::string> add_log_entries(const std::vector<mavsdk::LogFiles::Entry>& entries, uint8_t vehicle_id = 1);
+	bool log_exists(const std::string& uuid);
+	bool update_download_status(const std::string& uuid, bool downloaded);
+	bool update_compressed_size(const std::string& uuid, uint64_t compressed_size);
+
+	// Retention: the file of an evicted log is gone, it stays in the catalog so it is not
+	// downloaded again. Stored bytes are those of the downloaded logs that are not evicted.
+	bool set_evicted(const std::string& uuid);
+	uint64_t stored_bytes();
+	// Stored logs oldest first, with uploaded_only those that every enabled backend has accepted.
+	// A log a backend rejected is not uploaded and is only evicted without uploaded_only.
+	std::vector<LogEntry> get_logs_to_evict(bool uploaded_only, uint32_t limit);
+
+	// Flight catalog: downloaded logs are indexed once, those that can not be parsed are not retried
+	std::vector<std::string> get_logs_to_index(uint32_t limit);
+	bool set_log_metadata(const std::string& uuid, const LogMetadata& metadata);
+	bool set_index_failed(const std::string& uuid);
+	bool get_log_metadata(const std::string& uuid, LogMetadata& metadata);
+
+	// Deduplication by the SHA-256 of the raw log and of its first and last bytes. A log is a
+	// duplicate of another with the same content that is still stored, or that every enabled
+	// backend has. Logs without a tail hash are only matched by their content.
+	bool set_content_hash(const std::string& uuid, const std::string& content_hash, const std::string& head_hash,
+			      const std::string& tail_hash);
+	bool has_end_hashes(uint32_t size_bytes);
+	std::string find_duplicate_by_ends(const std::string& uuid, uint32_t size_bytes, const std::string& head_hash,
+					   const std::string& tail_hash);
+	std::string find_duplicate_by_content(const std::string& uuid, const std::string& content_hash);
+	// Stays in the catalog as downloaded and evicted, its content is that of the original
+	bool set_duplicate(const std::string& uuid, const std::string& original_uuid);
+	// Another log with the same content that the backend has accepted, empty if there is none
+	std::string uploaded_duplicate(const std::string& backend_id, const std::string& uuid);
+
+	// Download queries, across all vehicles or for one
+	uint32_t num_logs_to_download();
+	uint32_t num_logs_to_download(uint8_t vehicle_id);
+	LogEntry get_next_log_to_download();
+	LogEntry get_next_log_to_download(uint8_t vehicle_id);
+	// Pending logs of a vehicle, newest first
+	std::vector<LogEntry> get_logs_to_download(uint8_t vehicle_id, uint32_t limit);
+
+	// Upload queries, per backend. num_logs_to_upload() includes logs waiting for a retry, the
+	// others skip them until they are due.
+	uint32_t num_logs_to_upload(const std::string& backend_id);
+	LogEntry get_next_log_to_upload(const std::string& backend_id);
+	std::vector<LogEntry> get_logs_to_upload(const std::string& backend_id, uint32_t limit);
+	bool set_upload_state(const std::string& backend_id, const std::string& uuid, UploadState state,
+			      const std::string& message = "");
+	bool is_blacklisted(const std::string& backend_id, const std::string& uuid);
+
+	// Temporary failures back off: a log is not returned by the upload queries before its next
+	// retry. Attempts counts every state change recorded with set_upload_state().
+	uint32_t upload_attempts(const std::string& backend_id, const std::string& uuid);
+	bool set_upload_retry(const std::string& backend_id, const std::string& uuid,
+			      std::chrono::system_clock::time_point next_retry);
+	// Earliest retry of a log that is not due yet, the epoch when there is none
+	std::chrono::system_clock::time_point next_upload_retry(const std::string& backend_id);
+
+	// Logs of system 1 are stored in the logs directory itself, other vehicles in logs/sys<id>/
+	std::string vehicle_directory(uint8_t vehicle_id) const;
+	std::string filepath_from_entry(const mavsdk::LogFiles::Entry& entry, uint8_t vehicle_id = 1) const;
+	// Path of the stored log, <log>.ulg.zst if it has been compressed
+	std::string filepath_from_uuid(const std::string& uuid) const;
+	// Vehicle a stored log belongs to, from the sys<id> directory it is in
+	static uint8_t vehicle_from_filepath(const std::string& filepath);
+
+private:
+	struct StatementDeleter {
+		void operator()(sqlite3_stmt* stmt) const { sqlite3_finalize(stmt); }
+	};
+
+	using Statement = std::unique_ptr<sqlite3_stmt, StatementDeleter>;
+
+	// Resets a cached statement and clears its bindings when leaving scope. The time in between
+	// is recorded as the query latency.
+	class StatementReset
+	{
+	public:
+		explicit StatementReset(sqlite3_stmt* stmt) : _stmt(stmt), _start(std::chrono::steady_clock::now()) {}
+		~StatementReset();
+		StatementReset(const StatementReset&) = delete;
+		StatementReset& operator=(const StatementReset&) = delete;
+
+	private:
+		sqlite3_stmt* _stmt;
+		std::chrono::steady_clock::time_point _start;
+	};
+
+	// Prepared once in init_database() and finalized in close_database()
+	struct Statements {
+		Statement log_exists;
+		Statement insert_log;
+		Statement update_download_status;
+		Statement update_compressed_size;
+		Statement num_logs_to_download;
+		Statement next_log_to_download;
+		Statement num_vehicle_logs_to_download;
+		Statement next_vehicle_log_to_download;
+		Statement vehicle_logs_to_download;
+		Statement num_logs_to_upload;
+		Statement next_log_to_upload;
+		Statement logs_to_upload;
+		Statement upload_attempts;
+		Statement set_upload_retry;
+		Statement next_upload_retry;
+		Statement set_upload_state;
+		Statement is_blacklisted;
+		Statement filepath_from_uuid;
+		Statement register_backend;
+		Statement set_backend_enabled;
+		Statement fill_upload_queue;
+		Statement stored_bytes;
+		Statement uploaded_logs_to_evict;
+		Statement logs_to_evict;
+		Statement set_evicted;
+		Statement logs_to_index;
+		Statement set_log_metadata;
+		Statement set_index_failed;
+		Statement log_metadata;
+		Statement set_content_hash;
+		Statement has_end_hashes;
+		Statement duplicate_by_ends;
+		Statement duplicate_by_content;
+		Statement set_duplicate_of;
+		Statement uploaded_duplicate;
+	};
+
+	struct Migration {
+		int version;                 // user_version of the database once applied
+		const char* description;
+		std::function<bool()> apply; // Runs inside a transaction
+	};
+
+	enum class InsertResult {
+		Added,
+		Exists,
+		Failed
+	};
+
+	bool execute_query(const std::string& query);
+	bool has_column(const char* table, const char* column);
+	bool add_column_if_missing(const char* table, const char* column, const char* definition);
+	bool migrate();
+	bool create_work_queues();
+	bool create_vehicle_queues();
+	bool create_upload_retry();
+	bool create_retention();
+	bool create_flight_catalog();
+	bool create_content_hashes();
+	int user_version();
+	bool rehash_uuids(); // Caller must hold _mutex and have a transaction open
+	bool prepare_statement(Statement& statement, const char* query);
+	InsertResult insert_log(const mavsdk::LogFiles::Entry& entry, uint8_t vehicle_id); // Caller must hold _mutex
+	std::string query_uuid(sqlite3_stmt* stmt); // Caller must hold _mutex and bind the statement
+	LogEntry row_to_log_entry(sqlite3_stmt* stmt);
+
+	Settings _settings;
+	sqlite3* _db = nullptr;
+	Statements _statements;
+	mutable std::mutex _mutex; // Statements are shared between the download and upload threads
+};
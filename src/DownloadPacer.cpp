@@ -0,0 +1,193 @@
+#include "DownloadPacer.hpp"
+
+#include <algorithm>
+
+// Rounds the bandwidth estimate looks back over, a drop in capacity is followed after this many ranges
+static constexpr size_t BANDWIDTH_ROUNDS = 10;
+
+// The minimum round trip is measured again after this long, the route may have changed
+static constexpr auto MIN_RTT_EXPIRY = std::chrono::seconds(10);
+
+// Startup ends when the bandwidth grew by less than this over as many rounds
+static constexpr double STARTUP_GROWTH = 1.25;
+static constexpr uint32_t STARTUP_ROUNDS = 3;
+
+// A round trip this much above the minimum means data is queueing on the link
+static constexpr double QUEUE_RTT_FACTOR = 2;
+static constexpr auto QUEUE_RTT_MARGIN = std::chrono::milliseconds(20);
+
+// Delivery rates are only taken from ranges that arrived over more than a few messages, two
+// chunks handed over together would otherwise read as an arbitrarily fast link
+static constexpr uint32_t MIN_RATE_SAMPLE_BYTES = 1024;
+
+static constexpr double LOSS_SMOOTHING = 0.25;
+static constexpr double MIN_PACING_GAIN = 0.5;
+static constexpr double PACING_GAIN_DECREASE = 0.95;
+static constexpr double PACING_GAIN_INCREASE = 0.01;
+static constexpr uint32_t MAX_BACKOFF = 5;
+
+DownloadPacer::DownloadPacer(const Settings& settings)
+	: _settings(settings)
+{
+	_settings.link_reserve = std::clamp(_settings.link_reserve, 0.0, 0.9);
+	_settings.min_window_bytes = std::max<uint32_t>(_settings.min_window_bytes, 1);
+	_settings.max_window_bytes = std::max(_settings.max_window_bytes, _settings.min_window_bytes);
+	_window_bytes = std::clamp(_settings.initial_window_bytes, _settings.min_window_bytes, _settings.max_window_bytes);
+}
+
+DownloadPacer::Clock::duration DownloadPacer::timeout() const
+{
+	if (_srtt == Clock::duration::zero()) {
+		return Clock::duration::max();
+	}
+
+	// RFC 6298, doubled for every range in a row that got nothing
+	Clock::duration timeout = std::max<Clock::duration>(_srtt + 4 * _rttvar, _settings.min_timeout);
+	return timeout * (1 << _backoff);
+}
+
+DownloadPacer::Clock::time_point DownloadPacer::pipelined_request(Clock::time_point first_arrival, uint32_t bytes) const
+{
+	if (_bandwidth <= 0) {
+		return Clock::time_point::max();
+	}
+
+	auto duration = std::chrono::duration<double>(bytes / (_bandwidth * _pacing_gain));
+	return first_arrival + std::chrono::duration_cast<Clock::duration>(duration) - _min_rtt;
+}
+
+uint32_t DownloadPacer::bdp_bytes() const
+{
+	return _bandwidth * std::chrono::duration<double>(_min_rtt).count();
+}
+
+double DownloadPacer::pacing_rate() const
+{
+	return (1 - _settings.link_reserve) * _bandwidth * _pacing_gain;
+}
+
+void DownloadPacer::start(Clock::time_point now)
+{
+	// A gap left by the last transfer is still kept
+	if (_next_request == Clock::time_point::max()) {
+		_next_request = now;
+	}
+
+	_backoff = 0;
+}
+
+void DownloadPacer::request_sent(Clock::time_point now, uint32_t bytes)
+{
+	double rate = pacing_rate();
+
+	if (rate <= 0) {
+		// Not measured yet, the next request waits for this range to finish
+		_next_request = Clock::time_point::max();
+		return;
+	}
+
+	_next_request = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(bytes / rate));
+}
+
+void DownloadPacer::range_finished(Clock::time_point now, const Sample& sample)
+{
+	double lost = sample.requested_bytes ? 1 - std::min(1.0, double(sample.received_bytes) / sample.requested_bytes) : 0;
+	_loss = (1 - LOSS_SMOOTHING) * _loss + LOSS_SMOOTHING * lost;
+
+	bool queueing = false;
+
+	if (sample.first_arrival != Clock::time_point {}) {
+		Clock::duration rtt = sample.first_arrival - sample.sent;
+		update_rtt(now, rtt);
+		queueing = rtt > QUEUE_RTT_FACTOR * _min_rtt && rtt - _min_rtt > QUEUE_RTT_MARGIN;
+		_backoff = 0;
+
+		if (sample.interval_bytes >= MIN_RATE_SAMPLE_BYTES && sample.last_arrival > sample.first_arrival) {
+			std::chrono::duration<double> interval = sample.last_arrival - sample.first_arrival;
+			update_bandwidth(sample.interval_bytes / interval.count());
+		}
+
+	} else {
+		_backoff = std::min(_backoff + 1, MAX_BACKOFF);
+	}
+
+	if (sample.truncated) {
+		// The data that was cut off is requested again, only the pacing was wrong
+		_pacing_gain = std::max(MIN_PACING_GAIN, _pacing_gain * PACING_GAIN_DECREASE);
+
+	} else {
+		if (lost <= _settings.loss_threshold) {
+			_pacing_gain = std::min(1.0, _pacing_gain + PACING_GAIN_INCREASE);
+		}
+
+		update_window(lost > _settings.loss_threshold, queueing);
+	}
+
+	// Nothing could be paced when the range was requested
+	if (_next_request == Clock::time_point::max()) {
+		double rate = pacing_rate();
+		_next_request = rate > 0 ? sample.sent + std::chrono::duration_cast<Clock::duration>(
+					std::chrono::duration<double>(sample.requested_bytes / rate)) : now;
+	}
+}
+
+void DownloadPacer::update_rtt(Clock::time_point now, Clock::duration rtt)
+{
+	if (_srtt == Clock::duration::zero()) {
+		_srtt = rtt;
+		_rttvar = rtt / 2;
+
+	} else {
+		_rttvar = (3 * _rttvar + std::chrono::abs(_srtt - rtt)) / 4;
+		_srtt = (7 * _srtt + rtt) / 8;
+	}
+
+	if (_min_rtt == Clock::duration::zero() || rtt <= _min_rtt || now - _min_rtt_time > MIN_RTT_EXPIRY) {
+		_min_rtt = rtt;
+		_min_rtt_time = now;
+	}
+}
+
+void DownloadPacer::update_bandwidth(double rate)
+{
+	_rate_samples.push_back(rate);
+
+	if (_rate_samples.size() > BANDWIDTH_ROUNDS) {
+		_rate_samples.pop_front();
+	}
+
+	_bandwidth = *std::max_element(_rate_samples.begin(), _rate_samples.end());
+}
+
+void DownloadPacer::update_window(bool congested, bool queueing)
+{
+	if (congested) {
+		_window_bytes /= 2;
+		_startup = false;
+
+	} else if (_startup) {
+		_window_bytes *= 2;
+
+		// Leave startup once the bandwidth stops growing
+		if (_bandwidth >= _startup_bandwidth * STARTUP_GROWTH) {
+			_startup_bandwidth = _bandwidth;
+			_startup_rounds = 0;
+
+		} else if (++_startup_rounds >= STARTUP_ROUNDS) {
+			_startup = false;
+		}
+
+	} else if (!queueing) {
+		_window_bytes += _settings.min_window_bytes;
+	}
+
+	// A range may not hold the link for longer than a burst
+	double max_window = _settings.max_window_bytes;
+
+	if (_bandwidth > 0) {
+		max_window = std::min(max_window, _bandwidth * std::chrono::duration<double>(_settings.max_burst).count());
+	}
+
+	_window_bytes = std::clamp<uint32_t>(_window_bytes, _settings.min_window_bytes,
+					     std::max<uint32_t>(max_window, _settings.min_window_bytes));
+}
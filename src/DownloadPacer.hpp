@@ -0,0 +1,91 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+
+// Congestion control for LOG_REQUEST_DATA. The vehicle streams a requested range as fast as the
+// link takes it, which starves telemetry for as long as the range lasts, and leaves the link idle
+// for a round trip between ranges. The pacer bounds each range to a short burst and spaces the
+// requests so that on average only (1 - link_reserve) of the link is used by the download:
+// - the link bandwidth is the highest delivery rate seen within a range over the last rounds
+// - requests are sent window / pacing rate apart, and without waiting for the previous range to
+//   finish: once it started arriving the next request is timed to reach the vehicle as it ends.
+//   A range cut short by the next request means the bandwidth was overestimated.
+// - the window doubles until the bandwidth stops growing, then grows additively while ranges
+//   arrive complete and is halved when they lose data (AIMD). It does not grow while the round
+//   trip is inflated by a queue on the link.
+// - the round trip from a request to its first LOG_DATA gives the timeout for re-requesting.
+class DownloadPacer
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	struct Settings {
+		double link_reserve {0.2};                   // Share of the link bandwidth left to other traffic
+		uint32_t initial_window_bytes {4 * 1024};
+		uint32_t min_window_bytes {1024};
+		uint32_t max_window_bytes {90 * 1024};       // Largest range asked for in one LOG_REQUEST_DATA
+		std::chrono::milliseconds max_burst {250};   // Longest one range may hold the link
+		double loss_threshold {0.05};                // Share of a range lost that counts as congestion
+		std::chrono::milliseconds min_timeout {200}; // Lower bound of the round trip based timeout
+	};
+
+	// One requested range once it is finished
+	struct Sample {
+		uint32_t requested_bytes;
+		uint32_t received_bytes;
+		uint32_t interval_bytes;         // Received after the first LOG_DATA, until the last one
+		Clock::time_point sent;
+		Clock::time_point first_arrival; // Default constructed when nothing arrived
+		Clock::time_point last_arrival;
+		bool truncated;                  // The vehicle moved on to the next range before the end of this one
+	};
+
+	explicit DownloadPacer(const Settings& settings);
+
+	uint32_t window_bytes() const { return _window_bytes; }
+	Clock::time_point next_request() const { return _next_request; }
+	Clock::duration timeout() const;
+
+	// Earliest time for a request to reach the vehicle after it streamed a range of this size that
+	// started arriving at first_arrival, one minimum round trip before the range ends
+	Clock::time_point pipelined_request(Clock::time_point first_arrival, uint32_t bytes) const;
+
+	// A transfer starts with no ranges outstanding
+	void start(Clock::time_point now);
+	void request_sent(Clock::time_point now, uint32_t bytes);
+	void range_finished(Clock::time_point now, const Sample& sample);
+
+	double bandwidth() const { return _bandwidth; } // Bytes per second, 0 until measured
+	double pacing_rate() const;                     // Bytes per second the requests are spaced for
+	Clock::duration min_rtt() const { return _min_rtt; }
+	Clock::duration smoothed_rtt() const { return _srtt; }
+	uint32_t bdp_bytes() const;                     // Bytes the link delivers in a minimum round trip
+	double loss() const { return _loss; }           // Moving average of the share of a range lost
+
+private:
+	void update_rtt(Clock::time_point now, Clock::duration rtt);
+	void update_bandwidth(double rate);
+	void update_window(bool congested, bool queueing);
+
+	Settings _settings;
+
+	uint32_t _window_bytes;
+	Clock::time_point _next_request {};
+	double _pacing_gain = 1;    // Lowered when ranges are cut short, the bandwidth estimate is too high
+	bool _startup = true;
+	double _startup_bandwidth = 0;
+	uint32_t _startup_rounds = 0;
+
+	std::deque<double> _rate_samples; // Delivery rates of the last rounds, the bandwidth is their maximum
+	double _bandwidth = 0;
+
+	Clock::duration _min_rtt {};
+	Clock::time_point _min_rtt_time {};
+	Clock::duration _srtt {};
+	Clock::duration _rttvar {};
+	uint32_t _backoff = 0;      // Consecutive ranges that got no data, doubles the timeout
+
+	double _loss = 0;
+};
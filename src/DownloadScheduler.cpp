@@ -0,0 +1,304 @@
+#include "DownloadScheduler.hpp"
+#include "Log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+// The deadline policy solves a 0/1 knapsack over the newest logs with the byte budget split into
+// this many buckets, costs are rounded up so a chosen set always fits
+static constexpr size_t KNAPSACK_BUCKETS = 1024;
+static constexpr size_t KNAPSACK_MAX_ITEMS = 512;
+
+DownloadScheduler::DownloadScheduler(const Settings& settings, uint8_t vehicle_id)
+	: _settings(settings)
+	, _vehicle_id(vehicle_id)
+{
+	if (!_settings.trace_path.empty()) {
+		// Several vehicles append to the same file, each line is a single write
+		_trace_fd = ::open(_settings.trace_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+		if (_trace_fd < 0) {
+			LOG_WARNING("Could not open download trace " << _settings.trace_path << ": " << strerror(errno));
+		}
+	}
+}
+
+DownloadScheduler::~DownloadScheduler()
+{
+	if (_trace_fd >= 0) {
+		::close(_trace_fd);
+	}
+}
+
+size_t DownloadScheduler::choose(const std::vector<Candidate>& candidates, Clock::time_point now) const
+{
+	if (candidates.size() <= 1) {
+		return 0;
+	}
+
+	switch (_settings.policy) {
+	case Policy::NewestFirst:
+		return 0;
+
+	case Policy::SmallestFirst: {
+		auto smallest = std::min_element(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+			return a.remaining_bytes < b.remaining_bytes;
+		});
+
+		return smallest - candidates.begin();
+	}
+
+	case Policy::Deadline:
+		return choose_deadline(candidates, throughput() * seconds_left(now));
+	}
+
+	return 0;
+}
+
+size_t DownloadScheduler::choose_deadline(const std::vector<Candidate>& candidates, double budget_bytes) const
+{
+	if (budget_bytes <= 0) {
+		return 0;
+	}
+
+	// Only logs that can finish on their own before the next arm are worth packing
+	std::vector<size_t> items;
+
+	for (size_t i = 0; i < candidates.size() && items.size() < KNAPSACK_MAX_ITEMS; i++) {
+		if (candidates[i].remaining_bytes <= budget_bytes) {
+			items.push_back(i);
+		}
+	}
+
+	// Nothing completes in time, whatever is downloaded now resumes in the next window
+	if (items.empty()) {
+		return 0;
+	}
+
+	double bucket_bytes = budget_bytes / KNAPSACK_BUCKETS;
+	std::vector<size_t> costs(items.size());
+	std::vector<double> best(KNAPSACK_BUCKETS + 1, 0);
+	std::vector<std::vector<bool>> taken(items.size(), std::vector<bool>(KNAPSACK_BUCKETS + 1));
+
+	for (size_t k = 0; k < items.size(); k++) {
+		const Candidate& candidate = candidates[items[k]];
+		costs[k] = std::clamp<size_t>(size_t(std::ceil(candidate.remaining_bytes / bucket_bytes)), 1, KNAPSACK_BUCKETS);
+
+		// A completed log makes its whole size available, newer logs win ties
+		double value = double(candidate.entry.size_bytes) + double(items.size() - k);
+
+		for (size_t capacity = KNAPSACK_BUCKETS; capacity >= costs[k]; capacity--) {
+			if (best[capacity - costs[k]] + value > best[capacity]) {
+				best[capacity] = best[capacity - costs[k]] + value;
+				taken[k][capacity] = true;
+			}
+		}
+	}
+
+	// Of the chosen set, start with the log that finishes first in case the window is shorter than expected
+	size_t chosen = items.size();
+	size_t capacity = KNAPSACK_BUCKETS;
+
+	for (size_t k = items.size(); k-- > 0;) {
+		if (!taken[k][capacity]) {
+			continue;
+		}
+
+		capacity -= costs[k];
+
+		if (chosen == items.size() || candidates[items[k]].remaining_bytes <= candidates[items[chosen]].remaining_bytes) {
+			chosen = k;
+		}
+	}
+
+	return chosen < items.size() ? items[chosen] : 0;
+}
+
+void DownloadScheduler::disarmed(Clock::time_point now, bool observed)
+{
+	if (_in_window) {
+		return;
+	}
+
+	_in_window = true;
+	_window_observed = observed;
+	_window_start = now;
+
+	if (observed) {
+		trace("disarm");
+	}
+}
+
+void DownloadScheduler::armed(Clock::time_point now)
+{
+	if (!_in_window) {
+		return;
+	}
+
+	_in_window = false;
+	trace("arm");
+
+	if (!_window_observed) {
+		return;
+	}
+
+	double seconds = std::chrono::duration<double>(now - _window_start).count();
+	_window_seconds = _window_seconds == 0 ? seconds : (1 - _settings.smoothing) * _window_seconds + _settings.smoothing * seconds;
+
+	LOG_DEBUG("Disarmed for " << seconds << " seconds, expected window " << _window_seconds << " seconds");
+}
+
+void DownloadScheduler::log_found(uint64_t size_bytes)
+{
+	trace("log", size_bytes);
+}
+
+void DownloadScheduler::download_finished(uint64_t bytes, double seconds)
+{
+	trace("download", bytes, seconds);
+
+	if (bytes == 0 || seconds <= 0) {
+		return;
+	}
+
+	double sample = bytes / seconds;
+	_throughput = _throughput == 0 ? sample : (1 - _settings.smoothing) * _throughput + _settings.smoothing * sample;
+}
+
+double DownloadScheduler::throughput() const
+{
+	return _throughput > 0 ? _throughput : _settings.initial_throughput;
+}
+
+double DownloadScheduler::window_seconds() const
+{
+	return _window_seconds > 0 ? _window_seconds : std::chrono::duration<double>(_settings.initial_window).count();
+}
+
+double DownloadScheduler::seconds_left(Clock::time_point now) const
+{
+	if (!_in_window) {
+		return 0;
+	}
+
+	double elapsed = std::chrono::duration<double>(now - _window_start).count();
+	double expected = window_seconds();
+
+	// Once a window outlasts the estimate it is assumed to go on for as long again
+	return elapsed < expected ? expected - elapsed : expected;
+}
+
+bool DownloadScheduler::parse_policy(const std::string& name, Policy& policy)
+{
+	for (Policy candidate : {Policy::NewestFirst, Policy::SmallestFirst, Policy::Deadline}) {
+		if (name == policy_name(candidate)) {
+			policy = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const char* DownloadScheduler::policy_name(Policy policy)
+{
+	switch (policy) {
+	case Policy::NewestFirst:
+		return "newest";
+
+	case Policy::SmallestFirst:
+		return "smallest";
+
+	case Policy::Deadline:
+		return "deadline";
+	}
+
+	return "newest";
+}
+
+bool DownloadScheduler::load_trace(const std::string& path, std::vector<TraceEvent>& events)
+{
+	std::ifstream file(path);
+
+	if (!file) {
+		LOG_ERROR("Could not open " << path);
+		return false;
+	}
+
+	std::string line;
+	size_t line_number = 0;
+
+	while (std::getline(file, line)) {
+		line_number++;
+
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		std::istringstream fields(line);
+		std::string time, vehicle, type, bytes, seconds;
+		TraceEvent event = {};
+
+		std::getline(fields, time, ',');
+		std::getline(fields, vehicle, ',');
+		std::getline(fields, type, ',');
+		std::getline(fields, bytes, ',');
+		std::getline(fields, seconds, ',');
+
+		try {
+			event.time = std::stod(time);
+			event.vehicle_id = std::stoul(vehicle);
+			event.bytes = bytes.empty() ? 0 : std::stoull(bytes);
+			event.seconds = seconds.empty() ? 0 : std::stod(seconds);
+
+		} catch (const std::exception&) {
+			LOG_ERROR(path << ":" << line_number << ": invalid trace line");
+			return false;
+		}
+
+		if (type == "disarm") {
+			event.type = TraceEvent::Type::Disarm;
+
+		} else if (type == "arm") {
+			event.type = TraceEvent::Type::Arm;
+
+		} else if (type == "log") {
+			event.type = TraceEvent::Type::Log;
+
+		} else if (type == "download") {
+			event.type = TraceEvent::Type::Download;
+
+		} else {
+			LOG_ERROR(path << ":" << line_number << ": unknown event " << type);
+			return false;
+		}
+
+		events.push_back(event);
+	}
+
+	return true;
+}
+
+void DownloadScheduler::trace(const char* event, uint64_t bytes, double seconds) const
+{
+	if (_trace_fd < 0) {
+		return;
+	}
+
+	double time = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+	char line[128];
+	int length = snprintf(line, sizeof(line), "%.3f,%u,%s,%llu,%.3f\n", time, unsigned(_vehicle_id), event,
+			      static_cast<unsigned long long>(bytes), seconds);
+
+	if (::write(_trace_fd, line, length) != length) {
+		LOG_DEBUG("Failed to write download trace");
+	}
+}
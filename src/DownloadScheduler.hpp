@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Database.hpp"
+
+// Decides which pending log of a vehicle is downloaded next. Keeps a moving average of the link
+// throughput from finished downloads and of how long the vehicle stays disarmed, which together
+// give the number of bytes that can still be fetched before the next arm. Events can be recorded
+// to a trace file so the policies can be compared offline with `logloader_bench schedule`.
+class DownloadScheduler
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	enum class Policy {
+		NewestFirst,   // Most recent log first, regardless of size
+		SmallestFirst, // Fewest remaining bytes first, completes the most logs
+		Deadline       // Completes the most bytes that fit in the rest of the window, newest first when none fit
+	};
+
+	struct Settings {
+		Policy policy {Policy::NewestFirst};
+		double initial_throughput {100e3};          // Bytes per second until a download has been measured
+		std::chrono::seconds initial_window {600};  // Expected disarmed time until a window has been observed
+		double smoothing {0.25};                    // Weight of a new sample in the moving averages
+		std::string trace_path;                     // Append events to this CSV file, empty to disable
+	};
+
+	struct Candidate {
+		Database::LogEntry entry;
+		uint64_t remaining_bytes; // Less than the size when a partial download is resumed
+	};
+
+	// One line of a trace file: <unix time>,<vehicle>,<disarm|arm|log|download>,<bytes>,<seconds>
+	struct TraceEvent {
+		enum class Type {
+			Disarm,
+			Arm,
+			Log,      // A new log was found on the vehicle
+			Download  // A download finished, bytes transferred in seconds
+		};
+
+		double time;
+		uint8_t vehicle_id;
+		Type type;
+		uint64_t bytes;
+		double seconds;
+	};
+
+	DownloadScheduler(const Settings& settings, uint8_t vehicle_id = 1);
+	~DownloadScheduler();
+
+	DownloadScheduler(const DownloadScheduler&) = delete;
+	DownloadScheduler& operator=(const DownloadScheduler&) = delete;
+
+	Policy policy() const { return _settings.policy; }
+
+	// Index of the log to download next, candidates must be ordered newest first
+	size_t choose(const std::vector<Candidate>& candidates, Clock::time_point now) const;
+
+	// A window that was already open when logloader started is not used for the estimate
+	void disarmed(Clock::time_point now, bool observed = true);
+	void armed(Clock::time_point now);
+	void log_found(uint64_t size_bytes);
+	void download_finished(uint64_t bytes, double seconds);
+
+	double throughput() const;     // Bytes per second
+	double window_seconds() const; // Expected length of a disarmed window
+	double seconds_left(Clock::time_point now) const;
+
+	static bool parse_policy(const std::string& name, Policy& policy);
+	static const char* policy_name(Policy policy);
+	static bool load_trace(const std::string& path, std::vector<TraceEvent>& events);
+
+private:
+	size_t choose_deadline(const std::vector<Candidate>& candidates, double budget_bytes) const;
+	void trace(const char* event, uint64_t bytes = 0, double seconds = 0) const;
+
+	Settings _settings;
+	uint8_t _vehicle_id;
+
+	double _throughput = 0;      // 0 until the first download finished
+	double _window_seconds = 0;  // 0 until the first window closed
+	bool _in_window = false;
+	bool _window_observed = false;
+	Clock::time_point _window_start {};
+
+	int _trace_fd = -1;
+};
@@ -0,0 +1,142 @@
+#include "HealthMonitor.hpp"
+#include "Log.hpp"
+
+#define CPPHTTPLIB_OPENSSL_SUPPORT
+#include <httplib.h>
+
+HealthMonitor::HealthMonitor(ConnectionPool& connection_pool, const HealthMonitor::Settings& settings)
+	: _connection_pool(connection_pool)
+	, _settings(settings)
+	, _metrics(Metrics::instance().backend(settings.name))
+	, _retry_backoff({settings.retry_interval, settings.interval})
+{}
+
+HealthMonitor::~HealthMonitor()
+{
+	stop();
+}
+
+void HealthMonitor::start(ChangeCallback on_change)
+{
+	if (_running) {
+		return;
+	}
+
+	_on_change = std::move(on_change);
+	_should_exit = false;
+	_running = true;
+	_thread = std::thread(&HealthMonitor::run, this);
+}
+
+void HealthMonitor::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_should_exit = true;
+	}
+
+	_cv.notify_all();
+
+	if (_thread.joinable()) {
+		_thread.join();
+	}
+
+	_running = false;
+	_on_change = nullptr;
+}
+
+HealthMonitor::Status HealthMonitor::status() const
+{
+	return {
+		.state = state(),
+		.rtt = std::chrono::microseconds(_rtt_us.load(std::memory_order_relaxed)),
+		.last_checked = Clock::time_point(Clock::duration(_last_checked.load(std::memory_order_relaxed))),
+	};
+}
+
+bool HealthMonitor::up()
+{
+	if (_running) {
+		return state() == State::Up;
+	}
+
+	auto last_checked = Clock::time_point(Clock::duration(_last_checked.load(std::memory_order_relaxed)));
+
+	if (state() != State::Up || Clock::now() - last_checked > _settings.interval) {
+		return check();
+	}
+
+	return true;
+}
+
+bool HealthMonitor::check()
+{
+	auto start = Clock::now();
+	bool reachable = false;
+
+	{
+		auto connection = _connection_pool.acquire();
+		httplib::Result res = connection->Get("/");
+		reachable = res && res->status == 200;
+	}
+
+	auto now = Clock::now();
+	_last_checked.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+
+	if (reachable) {
+		auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(now - start);
+		_rtt_us.store(rtt.count(), std::memory_order_relaxed);
+		_metrics.rtt_ms.set(rtt.count() / 1000);
+	}
+
+	State state = reachable ? State::Up : State::Down;
+	State previous = _state.exchange(state, std::memory_order_acq_rel);
+	_metrics.up.set(reachable);
+
+	if (state != previous) {
+		if (reachable) {
+			LOG(_settings.name << " is reachable, " << _rtt_us.load(std::memory_order_relaxed) / 1000 << " ms round trip");
+
+		} else {
+			LOG(_settings.name << " is unreachable");
+		}
+
+		if (_on_change) {
+			_on_change(state);
+		}
+	}
+
+	return reachable;
+}
+
+void HealthMonitor::report_failure()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_check_requested = true;
+	}
+
+	_cv.notify_all();
+}
+
+void HealthMonitor::run()
+{
+	while (true) {
+		bool reachable = check();
+		_failed_checks = reachable ? 0 : _failed_checks + 1;
+
+		auto interval = reachable ? std::chrono::duration_cast<std::chrono::milliseconds>(_settings.interval)
+				: _retry_backoff.delay(_failed_checks);
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		_cv.wait_for(lock, interval, [this] { return _should_exit || _check_requested; });
+
+		if (_should_exit) {
+			break;
+		}
+
+		_check_requested = false;
+	}
+
+	LOG_DEBUG("Health monitor for " << _settings.name << " exiting");
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Backoff.hpp"
+#include "ConnectionPool.hpp"
+#include "Metrics.hpp"
+
+// Checks in the background whether a backend is reachable, so uploads read a cached state instead
+// of probing the server before every file. A reachable backend is checked every interval, one that
+// is down with a jittered backoff from retry_interval up to interval. The state, the round trip
+// time of the last successful check and the time of the last check are atomics and never block.
+class HealthMonitor
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	enum class State {
+		Unknown, // Not checked yet
+		Up,
+		Down
+	};
+
+	struct Settings {
+		std::string name;                           // Backend, labels the metrics and log lines
+		std::chrono::seconds interval {30};
+		std::chrono::seconds retry_interval {5};
+	};
+
+	struct Status {
+		State state;
+		std::chrono::microseconds rtt;
+		Clock::time_point last_checked;
+	};
+
+	// Called on the thread that noticed the change
+	using ChangeCallback = std::function<void(State state)>;
+
+	HealthMonitor(ConnectionPool& connection_pool, const Settings& settings);
+	~HealthMonitor();
+
+	void start(ChangeCallback on_change);
+	void stop();
+
+	State state() const { return _state.load(std::memory_order_acquire); }
+	Status status() const;
+
+	// Cached state while the monitor runs, without it the backend is checked when the state is
+	// not known to be up or has gone stale
+	bool up();
+
+	// Probe the backend now and update the cached state
+	bool check();
+
+	// An upload lost its connection, check again without waiting for the interval
+	void report_failure();
+
+private:
+	void run();
+
+	ConnectionPool& _connection_pool;
+	Settings _settings;
+	Metrics::Backend& _metrics;
+	Backoff _retry_backoff;
+	ChangeCallback _on_change;
+
+	std::atomic<State> _state = State::Unknown;
+	std::atomic<int64_t> _rtt_us {};
+	std::atomic<int64_t> _last_checked {}; // Clock ticks
+	uint32_t _failed_checks = 0;           // Consecutive, only touched by the monitor thread
+
+	std::thread _thread;
+	std::atomic<bool> _running = false;
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	bool _should_exit = false;
+	bool _check_requested = false;
+};
@@ -0,0 +1,315 @@
+#include "Log.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <unistd.h>
+
+// Number of lines the ring buffer holds, must be a power of two
+static constexpr size_t CAPACITY = 4096;
+
+// How often the flush thread writes out the buffered lines
+static constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(20);
+
+static const char* level_name(LogLevel level);
+static const char* level_tag(LogLevel level);
+static void write_all(int fd, const std::string& data);
+static void append_json_string(std::string& out, const std::string& text);
+
+Logger& Logger::instance()
+{
+	static Logger logger;
+	return logger;
+}
+
+Logger::Logger()
+#ifdef DEBUG_BUILD
+	: _level(LogLevel::Debug)
+#else
+	: _level(LogLevel::Info)
+#endif
+	, _lines(std::make_unique<Line[]>(CAPACITY))
+{
+	for (size_t i = 0; i < CAPACITY; i++) {
+		_lines[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+Logger::~Logger()
+{
+	stop();
+}
+
+void Logger::start(const Settings& settings)
+{
+	set_level(settings.level);
+	_json = settings.json;
+	_progress_interval_ms = settings.progress_interval.count();
+
+	if (_running) {
+		return;
+	}
+
+	_should_exit = false;
+	_thread = std::thread(&Logger::flush_thread, this);
+	_running = true;
+}
+
+void Logger::stop()
+{
+	if (!_running) {
+		return;
+	}
+
+	// New lines are written directly from here on, the thread writes out what is left
+	_running = false;
+	_should_exit = true;
+
+	if (_thread.joinable()) {
+		_thread.join();
+	}
+}
+
+void Logger::write(LogLevel level, std::string text)
+{
+	if (_running && push(level, text)) {
+		return;
+	}
+
+	if (_running) {
+		_dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	std::string line;
+	format(line, level, std::chrono::system_clock::now(), text);
+	write_all(level == LogLevel::Error ? STDERR_FILENO : STDOUT_FILENO, line);
+}
+
+bool Logger::progress_due(std::atomic<int64_t>& last_time)
+{
+	int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+			      std::chrono::steady_clock::now().time_since_epoch()).count();
+	int64_t last = last_time.load(std::memory_order_relaxed);
+
+	if (last != 0 && now - last < _progress_interval_ms.load(std::memory_order_relaxed)) {
+		return false;
+	}
+
+	// Only one of several threads racing for the same call site wins
+	return last_time.compare_exchange_strong(last, now, std::memory_order_relaxed);
+}
+
+bool Logger::parse_level(const std::string& name, LogLevel& level)
+{
+	for (LogLevel candidate : {LogLevel::Debug, LogLevel::Info, LogLevel::Warning, LogLevel::Error}) {
+		if (name == level_name(candidate)) {
+			level = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool Logger::push(LogLevel level, std::string& text)
+{
+	size_t position = _enqueue_position.load(std::memory_order_relaxed);
+	Line* line = nullptr;
+
+	while (true) {
+		line = &_lines[position & (CAPACITY - 1)];
+		size_t sequence = line->sequence.load(std::memory_order_acquire);
+		intptr_t difference = intptr_t(sequence) - intptr_t(position);
+
+		if (difference == 0) {
+			// Slot is free, claim it
+			if (_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				break;
+			}
+
+		} else if (difference < 0) {
+			// Full, the flush thread has not caught up
+			return false;
+
+		} else {
+			// Another producer claimed it first
+			position = _enqueue_position.load(std::memory_order_relaxed);
+		}
+	}
+
+	line->level = level;
+	line->time = std::chrono::system_clock::now();
+	line->text = std::move(text);
+	line->sequence.store(position + 1, std::memory_order_release);
+
+	return true;
+}
+
+void Logger::flush_thread()
+{
+	while (!_should_exit) {
+		flush();
+		std::this_thread::sleep_for(FLUSH_INTERVAL);
+	}
+
+	flush();
+}
+
+void Logger::flush()
+{
+	std::string out;
+	std::string err;
+
+	while (true) {
+		Line& line = _lines[_dequeue_position & (CAPACITY - 1)];
+		size_t sequence = line.sequence.load(std::memory_order_acquire);
+
+		if (intptr_t(sequence) - intptr_t(_dequeue_position + 1) < 0) {
+			break;
+		}
+
+		format(line.level == LogLevel::Error ? err : out, line.level, line.time, line.text);
+		line.text.clear();
+		line.sequence.store(_dequeue_position + CAPACITY, std::memory_order_release);
+		_dequeue_position++;
+	}
+
+	uint64_t dropped = _dropped.exchange(0, std::memory_order_relaxed);
+
+	if (dropped > 0) {
+		format(out, LogLevel::Warning, std::chrono::system_clock::now(), "Dropped " + std::to_string(dropped) + " log lines");
+	}
+
+	if (!out.empty()) {
+		write_all(STDOUT_FILENO, out);
+	}
+
+	if (!err.empty()) {
+		write_all(STDERR_FILENO, err);
+	}
+}
+
+void Logger::format(std::string& out, LogLevel level, std::chrono::system_clock::time_point time, const std::string& text) const
+{
+	if (!_json) {
+		out += level_tag(level);
+		out += text;
+		out += "\n";
+		return;
+	}
+
+	time_t seconds = std::chrono::system_clock::to_time_t(time);
+	auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count() % 1000;
+	struct tm utc {};
+	gmtime_r(&seconds, &utc);
+
+	char timestamp[32];
+	size_t length = strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", &utc);
+	snprintf(timestamp + length, sizeof(timestamp) - length, ".%03dZ", int(milliseconds));
+
+	out += "{\"time\":\"";
+	out += timestamp;
+	out += "\",\"level\":\"";
+	out += level_name(level);
+	out += "\",\"message\":";
+	append_json_string(out, text);
+	out += "}\n";
+}
+
+static const char* level_name(LogLevel level)
+{
+	switch (level) {
+	case LogLevel::Debug:
+		return "debug";
+
+	case LogLevel::Info:
+		return "info";
+
+	case LogLevel::Warning:
+		return "warning";
+
+	case LogLevel::Error:
+		return "error";
+	}
+
+	return "info";
+}
+
+// Prefix of plain text lines, info lines are printed as they are
+static const char* level_tag(LogLevel level)
+{
+	switch (level) {
+	case LogLevel::Debug:
+		return "[DEBUG] ";
+
+	case LogLevel::Warning:
+		return "[WARNING] ";
+
+	case LogLevel::Error:
+		return "[ERROR] ";
+
+	default:
+		return "";
+	}
+}
+
+static void write_all(int fd, const std::string& data)
+{
+	size_t written = 0;
+
+	while (written < data.size()) {
+		ssize_t result = ::write(fd, data.data() + written, data.size() - written);
+
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return;
+		}
+
+		written += result;
+	}
+}
+
+static void append_json_string(std::string& out, const std::string& text)
+{
+	out += '"';
+
+	for (char c : text) {
+		switch (c) {
+		case '"':
+			out += "\\\"";
+			break;
+
+		case '\\':
+			out += "\\\\";
+			break;
+
+		case '\n':
+			out += "\\n";
+			break;
+
+		case '\r':
+			out += "\\r";
+			break;
+
+		case '\t':
+			out += "\\t";
+			break;
+
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+				out += escaped;
+
+			} else {
+				out += c;
+			}
+		}
+	}
+
+	out += '"';
+}
@@ -1,12 +1,91 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <memory>
 #include <sstream>
+#include <string>
+#include <thread>
 
-#define LOG(x) std::cout << x << std::endl
+enum class LogLevel {
+	Debug,
+	Info,
+	Warning,
+	Error
+};
 
-#ifdef DEBUG_BUILD
-#define LOG_DEBUG(x) std::cout << "[DEBUG] " << x << std::endl
-#else
-#define LOG_DEBUG(x) do {} while(0)
-#endif
+// Asynchronous logger behind the LOG macros. Call sites format their line and push it into a
+// lock-free ring buffer, a background thread batches the lines into a single write() every few
+// milliseconds. When the buffer is full lines are dropped and counted instead of blocking the
+// caller. Until start() is called, and after stop(), lines are written synchronously.
+class Logger
+{
+public:
+	struct Settings {
+		LogLevel level {LogLevel::Info};
+		bool json {};                                      // One JSON object per line instead of plain text
+		std::chrono::milliseconds progress_interval {1000}; // Minimum time between progress lines, see progress_due()
+	};
+
+	static Logger& instance();
+
+	void start(const Settings& settings);
+	void stop(); // Writes out everything that is still buffered
+
+	void set_level(LogLevel level) { _level.store(level, std::memory_order_relaxed); }
+	LogLevel level() const { return _level.load(std::memory_order_relaxed); }
+	bool enabled(LogLevel level) const { return level >= this->level(); }
+
+	void write(LogLevel level, std::string text);
+
+	// True at most once per progress_interval for each last_time, e.g. one per download in progress
+	bool progress_due(std::atomic<int64_t>& last_time);
+
+	static bool parse_level(const std::string& name, LogLevel& level);
+
+private:
+	struct Line {
+		std::atomic<size_t> sequence;
+		LogLevel level;
+		std::chrono::system_clock::time_point time;
+		std::string text;
+	};
+
+	Logger();
+	~Logger();
+
+	bool push(LogLevel level, std::string& text);
+	void flush_thread();
+	void flush();
+	void format(std::string& out, LogLevel level, std::chrono::system_clock::time_point time, const std::string& text) const;
+
+	std::atomic<LogLevel> _level;
+	std::atomic<bool> _json = false;
+	std::atomic<int64_t> _progress_interval_ms = 1000;
+
+	// Bounded multi-producer ring buffer, the flush thread is the only consumer
+	std::unique_ptr<Line[]> _lines;
+	std::atomic<size_t> _enqueue_position = 0;
+	size_t _dequeue_position = 0;
+	std::atomic<uint64_t> _dropped = 0;
+
+	std::atomic<bool> _running = false;
+	std::atomic<bool> _should_exit = false;
+	std::thread _thread;
+};
+
+#define LOG_AT(level, x) \
+	do { \
+		if (Logger::instance().enabled(level)) { \
+			std::ostringstream log_stream_; \
+			log_stream_ << x; \
+			Logger::instance().write(level, log_stream_.str()); \
+		} \
+	} while (0)
+
+#define LOG(x) LOG_AT(LogLevel::Info, x)
+#define LOG_DEBUG(x) LOG_AT(LogLevel::Debug, x)
+#define LOG_WARNING(x) LOG_AT(LogLevel::Warning, x)
+#define LOG_ERROR(x) LOG_AT(LogLevel::Error, x)
@@ -0,0 +1,245 @@
+#include "LogArchive.hpp"
+#include "Log.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <time.h>
+#include <zstd.h>
+
+namespace fs = std::filesystem;
+
+static constexpr char COMPRESSED_EXTENSION[] = ".zst";
+
+// ZSTD_FRAMEHEADERSIZE_MAX, which zstd.h only defines for static linking
+static constexpr size_t FRAME_HEADER_SIZE_MAX = 18;
+
+static double thread_cpu_seconds();
+static unsigned long long frame_content_size(const std::string& path);
+
+LogArchive::LogArchive(const LogArchive::Settings& settings)
+	: _settings(settings)
+{}
+
+bool LogArchive::is_compressed(const std::string& path)
+{
+	return fs::path(path).extension() == COMPRESSED_EXTENSION;
+}
+
+std::string LogArchive::raw_path(const std::string& path)
+{
+	return is_compressed(path) ? path.substr(0, path.size() - std::strlen(COMPRESSED_EXTENSION)) : path;
+}
+
+uint64_t LogArchive::raw_size(const std::string& path)
+{
+	std::error_code ec;
+
+	if (!is_compressed(path)) {
+		uint64_t size = fs::file_size(path, ec);
+		return ec ? 0 : size;
+	}
+
+	unsigned long long size = frame_content_size(path);
+
+	if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR) {
+		return 0;
+	}
+
+	return size;
+}
+
+// ZSTD_CONTENTSIZE_UNKNOWN or ZSTD_CONTENTSIZE_ERROR if the frame header does not tell
+static unsigned long long frame_content_size(const std::string& path)
+{
+	char header[FRAME_HEADER_SIZE_MAX];
+	std::ifstream file(path, std::ios::binary);
+	file.read(header, sizeof(header));
+
+	return ZSTD_getFrameContentSize(header, file.gcount());
+}
+
+bool LogArchive::compress(const std::string& path, CompressStats& stats) const
+{
+	auto wall_start = std::chrono::steady_clock::now();
+	double cpu_start = thread_cpu_seconds();
+
+	std::ifstream input(path, std::ios::binary);
+
+	if (!input) {
+		LOG("Could not open " << path);
+		return false;
+	}
+
+	std::error_code ec;
+	uint64_t raw_bytes = fs::file_size(path, ec);
+
+	// Written under a temporary name so an interrupted run never leaves a truncated archive
+	std::string output_path = compressed_path(path);
+	std::string temp_path = output_path + ".tmp";
+	std::ofstream output(temp_path, std::ios::binary | std::ios::trunc);
+
+	if (ec || !output) {
+		LOG("Could not create " << temp_path);
+		return false;
+	}
+
+	std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+	ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_compressionLevel, _settings.compression_level);
+	ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_checksumFlag, 1);
+	// Records the raw size in the frame header, uploads need it before decompressing
+	ZSTD_CCtx_setPledgedSrcSize(cctx.get(), raw_bytes);
+
+	std::vector<char> in_buffer(ZSTD_CStreamInSize());
+	std::vector<char> out_buffer(ZSTD_CStreamOutSize());
+	uint64_t compressed_bytes = 0;
+	bool success = true;
+	bool finished = false;
+
+	while (success && !finished) {
+		input.read(in_buffer.data(), in_buffer.size());
+		size_t read = input.gcount();
+
+		if (input.bad()) {
+			LOG("Error reading " << path);
+			success = false;
+			break;
+		}
+
+		bool last_chunk = input.eof();
+		ZSTD_EndDirective mode = last_chunk ? ZSTD_e_end : ZSTD_e_continue;
+		ZSTD_inBuffer in = {in_buffer.data(), read, 0};
+
+		// Keep going until the input is consumed, or the frame is complete for the last chunk
+		do {
+			ZSTD_outBuffer out = {out_buffer.data(), out_buffer.size(), 0};
+			size_t remaining = ZSTD_compressStream2(cctx.get(), &out, &in, mode);
+
+			if (ZSTD_isError(remaining)) {
+				LOG("Error compressing " << path << ": " << ZSTD_getErrorName(remaining));
+				success = false;
+				break;
+			}
+
+			output.write(out_buffer.data(), out.pos);
+			compressed_bytes += out.pos;
+			finished = last_chunk && remaining == 0;
+
+		} while (last_chunk ? !finished : in.pos < in.size);
+	}
+
+	output.close();
+
+	if (success && !output) {
+		LOG("Error writing " << temp_path);
+		success = false;
+	}
+
+	if (success) {
+		fs::rename(temp_path, output_path, ec);
+		success = !ec;
+	}
+
+	if (!success) {
+		fs::remove(temp_path, ec);
+		return false;
+	}
+
+	stats.raw_bytes = raw_bytes;
+	stats.compressed_bytes = compressed_bytes;
+	stats.cpu_seconds = thread_cpu_seconds() - cpu_start;
+	stats.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+	return true;
+}
+
+LogArchive::Reader::Reader() = default;
+
+LogArchive::Reader::~Reader()
+{
+	if (_dctx) {
+		ZSTD_freeDCtx(_dctx);
+	}
+}
+
+bool LogArchive::Reader::open(const std::string& path, bool decompress)
+{
+	_file.open(path, std::ios::binary);
+
+	if (!_file) {
+		return false;
+	}
+
+	_position = 0;
+
+	if (!decompress || !is_compressed(path)) {
+		std::error_code ec;
+		_size = fs::file_size(path, ec);
+		return !ec;
+	}
+
+	// An empty log is a valid frame with a content size of 0
+	unsigned long long size = frame_content_size(path);
+
+	if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR) {
+		LOG("Compressed log has no content size: " << path);
+		return false;
+	}
+
+	_size = size;
+	_dctx = ZSTD_createDCtx();
+	_input.resize(ZSTD_DStreamInSize());
+	_input_pos = 0;
+	_input_size = 0;
+	_frame_done = false;
+
+	return _dctx != nullptr;
+}
+
+size_t LogArchive::Reader::read(char* buffer, size_t length)
+{
+	if (!_dctx) {
+		_file.read(buffer, length);
+		_position += _file.gcount();
+		return _file.gcount();
+	}
+
+	ZSTD_outBuffer out = {buffer, length, 0};
+
+	// Once all of the content is out the epilogue is still decompressed, that is where the checksum
+	// is verified. The last bytes are only returned if it matches.
+	while (!_frame_done && (out.pos < out.size || _position + out.pos >= _size)) {
+		if (_input_pos == _input_size) {
+			_file.read(_input.data(), _input.size());
+			_input_size = _file.gcount();
+			_input_pos = 0;
+
+			if (_input_size == 0) {
+				LOG("Compressed log ended early at " << _position + out.pos << " of " << _size << " bytes");
+				return 0;
+			}
+		}
+
+		ZSTD_inBuffer in = {_input.data(), _input_size, _input_pos};
+		size_t result = ZSTD_decompressStream(_dctx, &out, &in);
+		_input_pos = in.pos;
+
+		if (ZSTD_isError(result)) {
+			LOG("Error decompressing log: " << ZSTD_getErrorName(result));
+			return 0;
+		}
+
+		_frame_done = result == 0;
+	}
+
+	_position += out.pos;
+
+	return out.pos;
+}
+
+static double thread_cpu_seconds()
+{
+	timespec ts {};
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct ZSTD_DCtx_s;
+
+// Compresses downloaded logs with zstd to save space on the companion and bandwidth on the way
+// out. A compressed log is stored as <log>.ulg.zst, the raw size is kept in the zstd frame header.
+class LogArchive
+{
+public:
+	struct Settings {
+		bool enabled {};
+		int compression_level {3};
+	};
+
+	struct CompressStats {
+		uint64_t raw_bytes;
+		uint64_t compressed_bytes;
+		double cpu_seconds;   // CPU time spent by the compressing thread
+		double wall_seconds;
+	};
+
+	// Sequential reader that yields the raw log, or the stored bytes as they are
+	class Reader
+	{
+	public:
+		Reader();
+		~Reader();
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+
+		// When decompress is false a compressed log is passed through unchanged
+		bool open(const std::string& path, bool decompress = true);
+
+		uint64_t size() const { return _size; }     // Number of bytes read() will produce
+		uint64_t position() const { return _position; }
+
+		// Returns the number of bytes read, 0 at the end of the log or on error
+		size_t read(char* buffer, size_t length);
+
+	private:
+		std::ifstream _file;
+		struct ZSTD_DCtx_s* _dctx = nullptr;
+		std::vector<char> _input;
+		size_t _input_pos = 0;
+		size_t _input_size = 0;
+		uint64_t _size = 0;
+		uint64_t _position = 0;
+		bool _frame_done = false; // The epilogue was decompressed and the checksum matched
+	};
+
+	LogArchive(const Settings& settings);
+
+	bool enabled() const { return _settings.enabled; }
+
+	// Writes <path>.zst next to the raw log, the caller removes the raw log once it is recorded
+	bool compress(const std::string& path, CompressStats& stats) const;
+
+	static bool is_compressed(const std::string& path);
+	static std::string compressed_path(const std::string& path) { return path + ".zst"; }
+	static std::string raw_path(const std::string& path);
+
+	// Size of the log once decompressed, 0 if it can not be determined
+	static uint64_t raw_size(const std::string& path);
+
+private:
+	Settings _settings;
+};
@@ -0,0 +1,601 @@
+#include "LogDownloader.hpp"
+#include "Log.hpp"
+#include "Metrics.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Payload bytes carried by a single LOG_DATA message
+static constexpr uint32_t CHUNK_SIZE = MAVLINK_MSG_LOG_DATA_FIELD_DATA_LEN;
+
+static constexpr char JOURNAL_MAGIC[4] = {'L', 'L', 'J', '1'};
+
+static bool read_journal(const std::string& path, uint32_t size_bytes, std::vector<uint8_t>& bitmap);
+static uint32_t count_chunks(const std::vector<uint8_t>& bitmap, uint32_t num_chunks);
+
+LogDownloader::LogDownloader(std::shared_ptr<mavsdk::MavlinkPassthrough> passthrough, const LogDownloader::Settings& settings)
+	: _passthrough(passthrough)
+	, _settings(settings)
+	, _pacer(settings.pacing)
+{}
+
+void LogDownloader::cancel()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_cancelled = true;
+	}
+
+	_cv.notify_all();
+}
+
+void LogDownloader::hold(bool held)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_held = held;
+	}
+
+	_cv.notify_all();
+}
+
+uint64_t LogDownloader::bytes_transferred() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return std::min<uint64_t>(uint64_t(_chunks_received - _chunks_resumed) * CHUNK_SIZE, _size_bytes);
+}
+
+uint64_t LogDownloader::remaining_bytes(const mavsdk::LogFiles::Entry& entry, const std::string& path)
+{
+	uint32_t num_chunks = (entry.size_bytes + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	std::vector<uint8_t> bitmap((num_chunks + 7) / 8);
+
+	if (!fs::exists(path) || !read_journal(journal_path(path), entry.size_bytes, bitmap)) {
+		return entry.size_bytes;
+	}
+
+	uint64_t received = uint64_t(count_chunks(bitmap, num_chunks)) * CHUNK_SIZE;
+	return entry.size_bytes - std::min<uint64_t>(received, entry.size_bytes);
+}
+
+LogDownloader::Result LogDownloader::download(const mavsdk::LogFiles::Entry& entry, const std::string& path,
+		const ProgressCallback& progress_callback)
+{
+	return transfer(entry, path, 0, UINT32_MAX, progress_callback);
+}
+
+LogDownloader::Result LogDownloader::download_range(const mavsdk::LogFiles::Entry& entry, const std::string& path,
+		uint32_t offset, uint32_t bytes)
+{
+	return transfer(entry, path, offset, bytes, nullptr);
+}
+
+LogDownloader::Result LogDownloader::transfer(const mavsdk::LogFiles::Entry& entry, const std::string& path, uint32_t offset,
+		uint32_t max_bytes, const ProgressCallback& progress_callback)
+{
+	_cancelled = false;
+
+	if (!open_file(entry, path)) {
+		return Result::FileError;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		// Starts on a whole byte of the bitmap, so complete bytes can be skipped from there
+		_first_chunk = std::min(offset / CHUNK_SIZE / 8 * 8, _num_chunks);
+		_target_chunks = std::min<uint64_t>(_num_chunks, (uint64_t(offset) + max_bytes + CHUNK_SIZE - 1) / CHUNK_SIZE);
+		_windows.clear();
+		_last_arrival = {};
+		_pacer.start(DownloadPacer::Clock::now());
+	}
+
+	auto handle = _passthrough->subscribe_message(MAVLINK_MSG_ID_LOG_DATA, [this](const mavlink_message_t& message) {
+		handle_log_data(message);
+	});
+
+	Result result = Result::Success;
+	auto last_progress = DownloadPacer::Clock::now();
+	auto last_journal_save = last_progress;
+	uint32_t chunks_seen = 0;
+
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	while (true) {
+		auto now = DownloadPacer::Clock::now();
+		retire_windows(now);
+
+		if (_cancelled || _held) {
+			result = Result::Cancelled;
+			break;
+		}
+
+		if (_write_error) {
+			result = Result::FileError;
+			break;
+		}
+
+		// Everything up to the target is there
+		if (target_received()) {
+			break;
+		}
+
+		if (_chunks_received != chunks_seen) {
+			chunks_seen = _chunks_received;
+			last_progress = now;
+
+			float progress = float(_chunks_received) / _num_chunks;
+			lock.unlock();
+
+			if (progress_callback) {
+				progress_callback(progress);
+			}
+
+			if (now - last_journal_save > _settings.journal_interval) {
+				save_journal();
+				last_journal_save = DownloadPacer::Clock::now();
+			}
+
+			lock.lock();
+			continue;
+
+		} else if (now - last_progress > _settings.data_timeout * _settings.max_retries) {
+			LOG("Download stalled at " << _chunks_received << "/" << _num_chunks << " chunks");
+			result = Result::Timeout;
+			break;
+		}
+
+		// The next range is requested while the vehicle is still streaming the current one
+		auto request_at = _pacer.next_request();
+
+		if (!_windows.empty()) {
+			const Window& streaming = _windows.back();
+			request_at = std::max(request_at, streaming.first_arrival == DownloadPacer::Clock::time_point {}
+					      ? DownloadPacer::Clock::time_point::max()
+					      : _pacer.pipelined_request(streaming.first_arrival, streaming.range.num_chunks * CHUNK_SIZE));
+		}
+
+		if (_windows.size() < 2 && now >= request_at) {
+			Range range = next_missing_range();
+
+			if (range.num_chunks > 0) {
+				_windows.push_back({range, now, {}, {}, 0, false});
+				_pacer.request_sent(now, range.num_chunks * CHUNK_SIZE);
+
+				lock.unlock();
+				request_range(range);
+				lock.lock();
+				continue;
+			}
+		}
+
+		// Wait for data, the next request or the oldest range to time out
+		auto wake_at = now + _settings.data_timeout;
+
+		if (_windows.size() < 2) {
+			wake_at = std::min(wake_at, request_at);
+		}
+
+		if (!_windows.empty()) {
+			auto timeout = std::min<DownloadPacer::Clock::duration>(_pacer.timeout(), _settings.data_timeout);
+			wake_at = std::min(wake_at, std::max(_windows.front().sent, _last_arrival) + timeout);
+		}
+
+		uint32_t arrivals = _arrivals;
+
+		_cv.wait_until(lock, wake_at, [this, arrivals] {
+			return _cancelled || _held || _write_error || _arrivals != arrivals;
+		});
+	}
+
+	_windows.clear();
+	lock.unlock();
+
+	_passthrough->unsubscribe_message(MAVLINK_MSG_ID_LOG_DATA, handle);
+	request_end();
+
+	if (result == Result::Success && (_first_chunk > 0 || _target_chunks < _num_chunks)) {
+		// Only part of the log was asked for, download() resumes from the journal
+		save_journal();
+
+	} else if (result == Result::Success) {
+		if (progress_callback) {
+			progress_callback(1.f);
+		}
+
+		// Log is complete, the journal is no longer needed
+		fsync(_fd);
+		fs::remove(journal_path(_path));
+
+	} else {
+		// Keep what we have so the next attempt resumes from here
+		save_journal();
+	}
+
+	close_file();
+
+	double rtt_ms = std::chrono::duration_cast<std::chrono::microseconds>(_pacer.smoothed_rtt()).count() / 1e3;
+
+	LOG_DEBUG("Link " << std::fixed << std::setprecision(1) << _pacer.bandwidth() / 1e3 << " kB/s, paced at "
+		  << _pacer.pacing_rate() / 1e3 << " kB/s, rtt " << rtt_ms << " ms, window "
+		  << _pacer.window_bytes() << " bytes, loss " << _pacer.loss() * 100 << "%");
+
+	return result;
+}
+
+void LogDownloader::retire_windows(DownloadPacer::Clock::time_point now)
+{
+	auto timeout = std::min<DownloadPacer::Clock::duration>(_pacer.timeout(), _settings.data_timeout);
+
+	while (!_windows.empty()) {
+		// Nothing arrived for a timeout, the request or the end of the range was lost
+		bool timed_out = now - std::max(_windows.front().sent, _last_arrival) >= timeout;
+
+		if (!_windows.front().finished && !timed_out) {
+			break;
+		}
+
+		Window window = _windows.front();
+		_windows.pop_front();
+
+		uint32_t last_chunk = window.range.first_chunk + window.range.num_chunks - 1;
+		uint32_t tail_missing = 0;
+
+		while (tail_missing < window.range.num_chunks && !chunk_received(last_chunk - tail_missing)) {
+			tail_missing++;
+		}
+
+		DownloadPacer::Sample sample = {
+			.requested_bytes = window.range.num_chunks * CHUNK_SIZE,
+			.received_bytes = window.chunks_received * CHUNK_SIZE,
+			.interval_bytes = (std::max<uint32_t>(window.chunks_received, 1) - 1) * CHUNK_SIZE,
+			.sent = window.sent,
+			.first_arrival = window.first_arrival,
+			.last_arrival = window.last_arrival,
+			// The vehicle left for the next range before the end of this one
+			.truncated = window.finished && window.chunks_received > 0 && tail_missing > 1,
+		};
+
+		_pacer.range_finished(now, sample);
+
+		// Anything lost in this range is filled in by a later request
+		if (window.chunks_received < window.range.num_chunks) {
+			LOG_DEBUG("Range " << window.range.first_chunk << "-" << last_chunk << " lost "
+				  << window.range.num_chunks - window.chunks_received << " chunks" << (timed_out ? ", timed out" : ""));
+		}
+	}
+}
+
+bool LogDownloader::open_file(const mavsdk::LogFiles::Entry& entry, const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_path = path;
+	_log_id = entry.id;
+	_size_bytes = entry.size_bytes;
+	_num_chunks = (entry.size_bytes + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	_chunks_received = 0;
+	_bitmap.assign((_num_chunks + 7) / 8, 0);
+	_write_error = false;
+
+	bool resume = fs::exists(path) && fs::exists(journal_path(path)) && load_journal();
+	_chunks_resumed = _chunks_received;
+
+	if (!resume) {
+		// Without a journal we can not know which parts of an existing file are valid
+		if (fs::exists(path)) {
+			LOG("Found existing file without journal, starting over: " << path);
+		}
+
+		std::error_code ec;
+		fs::remove(journal_path(path), ec);
+	}
+
+	_fd = ::open(path.c_str(), O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+
+	if (_fd < 0) {
+		LOG("Could not open " << path << ": " << strerror(errno));
+		return false;
+	}
+
+	if (ftruncate(_fd, _size_bytes) != 0) {
+		LOG("Could not resize " << path << ": " << strerror(errno));
+		close_file();
+		return false;
+	}
+
+	if (resume) {
+		LOG("Resuming download at " << _chunks_received * 100 / std::max<uint32_t>(_num_chunks, 1) << "%: " << path);
+	}
+
+	return true;
+}
+
+void LogDownloader::close_file()
+{
+	if (_fd >= 0) {
+		::close(_fd);
+		_fd = -1;
+	}
+}
+
+bool LogDownloader::load_journal()
+{
+	std::vector<uint8_t> bitmap(_bitmap.size());
+
+	if (!read_journal(journal_path(_path), _size_bytes, bitmap)) {
+		return false;
+	}
+
+	_bitmap = std::move(bitmap);
+	_chunks_received = count_chunks(_bitmap, _num_chunks);
+
+	return true;
+}
+
+bool LogDownloader::save_journal()
+{
+	std::vector<uint8_t> bitmap;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		bitmap = _bitmap;
+	}
+
+	// Data must be on disk before the journal claims to have it
+	if (_fd < 0 || fdatasync(_fd) != 0) {
+		return false;
+	}
+
+	// Write to a temporary file and rename so a crash never leaves a torn journal
+	std::string journal = journal_path(_path);
+	std::string temp = journal + ".tmp";
+
+	{
+		std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+		file.write(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+		file.write(reinterpret_cast<const char*>(&_size_bytes), sizeof(_size_bytes));
+		file.write(reinterpret_cast<const char*>(&CHUNK_SIZE), sizeof(CHUNK_SIZE));
+		file.write(reinterpret_cast<const char*>(bitmap.data()), bitmap.size());
+
+		if (!file) {
+			LOG("Failed to write journal " << temp);
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	fs::rename(temp, journal, ec);
+
+	return !ec;
+}
+
+void LogDownloader::handle_log_data(const mavlink_message_t& message)
+{
+	if (message.sysid != _passthrough->get_target_sysid()) {
+		return;
+	}
+
+	mavlink_log_data_t log_data;
+	mavlink_msg_log_data_decode(&message, &log_data);
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		// Requests always start on a chunk boundary, anything else is not ours
+		if (_fd < 0 || log_data.id != _log_id || log_data.count == 0 || log_data.ofs % CHUNK_SIZE != 0) {
+			return;
+		}
+
+		uint32_t chunk = log_data.ofs / CHUNK_SIZE;
+
+		if (chunk >= _num_chunks) {
+			return;
+		}
+
+		bool new_chunk = !chunk_received(chunk);
+
+		if (new_chunk) {
+			uint32_t length = std::min<uint32_t>(log_data.count, _size_bytes - log_data.ofs);
+
+			if (pwrite(_fd, log_data.data, length, log_data.ofs) != ssize_t(length)) {
+				LOG("Error writing " << _path << ": " << strerror(errno));
+				_write_error = true;
+				new_chunk = false;
+
+			} else {
+				_bitmap[chunk / 8] |= 1 << (chunk % 8);
+				_chunks_received++;
+				Metrics::instance().downloaded_bytes.increment(length);
+			}
+
+		} else {
+			Metrics::instance().resent_bytes.increment(log_data.count);
+		}
+
+		auto now = DownloadPacer::Clock::now();
+		_last_arrival = now;
+		_arrivals++;
+
+		for (size_t i = 0; i < _windows.size(); i++) {
+			Window& window = _windows[i];
+
+			if (chunk < window.range.first_chunk || chunk >= window.range.first_chunk + window.range.num_chunks) {
+				continue;
+			}
+
+			if (window.first_arrival == DownloadPacer::Clock::time_point {}) {
+				window.first_arrival = now;
+			}
+
+			window.last_arrival = now;
+			window.chunks_received++;
+			window.finished |= chunk == window.range.first_chunk + window.range.num_chunks - 1;
+
+			// The vehicle streams one range at a time, older ones will get nothing more
+			for (size_t older = 0; older < i; older++) {
+				_windows[older].finished = true;
+			}
+
+			break;
+		}
+	}
+
+	_cv.notify_all();
+}
+
+bool LogDownloader::target_received() const
+{
+	uint32_t chunk = _first_chunk;
+
+	// Skip whole bytes of the bitmap that are complete
+	while (chunk + 8 <= _target_chunks && _bitmap[chunk / 8] == 0xFF) {
+		chunk += 8;
+	}
+
+	while (chunk < _target_chunks && chunk_received(chunk)) {
+		chunk++;
+	}
+
+	return chunk >= _target_chunks;
+}
+
+LogDownloader::Range LogDownloader::next_missing_range() const
+{
+	Range range {0, 0};
+	uint32_t max_chunks = std::max<uint32_t>(_pacer.window_bytes() / CHUNK_SIZE, 1);
+
+	uint32_t chunk = _first_chunk;
+
+	// Skip whole bytes of the bitmap that are complete
+	while (chunk < _num_chunks && _bitmap[chunk / 8] == 0xFF) {
+		chunk += 8;
+	}
+
+	// Ranges that were requested already are not asked for again until they are finished
+	while (chunk < _target_chunks) {
+		if (const Window* window = in_flight(chunk)) {
+			chunk = window->range.first_chunk + window->range.num_chunks;
+
+		} else if (chunk_received(chunk)) {
+			chunk++;
+
+		} else {
+			break;
+		}
+	}
+
+	range.first_chunk = std::min(chunk, _target_chunks);
+
+	while (chunk < _target_chunks && !chunk_received(chunk) && !in_flight(chunk) && range.num_chunks < max_chunks) {
+		chunk++;
+		range.num_chunks++;
+	}
+
+	// Holes left by lost chunks are closer together than a round trip of data on a lossy link,
+	// sending a few chunks again costs less than a request per hole
+	uint32_t max_gap = _pacer.bdp_bytes() / CHUNK_SIZE;
+
+	while (range.num_chunks > 0 && range.num_chunks < max_chunks) {
+		uint32_t gap = 0;
+
+		while (chunk + gap < _target_chunks && chunk_received(chunk + gap) && !in_flight(chunk + gap) && gap <= max_gap) {
+			gap++;
+		}
+
+		uint32_t next = chunk + gap;
+
+		if (gap == 0 || gap > max_gap || next >= _target_chunks || in_flight(next) || range.num_chunks + gap >= max_chunks) {
+			break;
+		}
+
+		chunk = next;
+		range.num_chunks += gap;
+
+		while (chunk < _target_chunks && !chunk_received(chunk) && !in_flight(chunk) && range.num_chunks < max_chunks) {
+			chunk++;
+			range.num_chunks++;
+		}
+	}
+
+	return range;
+}
+
+const LogDownloader::Window* LogDownloader::in_flight(uint32_t chunk) const
+{
+	for (const auto& window : _windows) {
+		if (chunk >= window.range.first_chunk && chunk < window.range.first_chunk + window.range.num_chunks) {
+			return &window;
+		}
+	}
+
+	return nullptr;
+}
+
+bool LogDownloader::chunk_received(uint32_t chunk) const
+{
+	return _bitmap[chunk / 8] & (1 << (chunk % 8));
+}
+
+void LogDownloader::request_range(const Range& range)
+{
+	uint32_t offset = range.first_chunk * CHUNK_SIZE;
+	uint32_t count = range.num_chunks * CHUNK_SIZE;
+
+	LOG_DEBUG("Requesting log " << _log_id << " bytes " << offset << "-" << offset + count);
+
+	_passthrough->queue_message([this, offset, count](mavsdk::MavlinkAddress address, uint8_t channel) {
+		mavlink_message_t message;
+		mavlink_msg_log_request_data_pack_chan(address.system_id, address.component_id, channel, &message,
+						       _passthrough->get_target_sysid(), _passthrough->get_target_compid(),
+						       _log_id, offset, count);
+		return message;
+	});
+}
+
+void LogDownloader::request_end()
+{
+	_passthrough->queue_message([this](mavsdk::MavlinkAddress address, uint8_t channel) {
+		mavlink_message_t message;
+		mavlink_msg_log_request_end_pack_chan(address.system_id, address.component_id, channel, &message,
+						      _passthrough->get_target_sysid(), _passthrough->get_target_compid());
+		return message;
+	});
+}
+
+static bool read_journal(const std::string& path, uint32_t size_bytes, std::vector<uint8_t>& bitmap)
+{
+	std::ifstream file(path, std::ios::binary);
+
+	char magic[4] {};
+	uint32_t journal_size_bytes = 0;
+	uint32_t chunk_size = 0;
+
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char*>(&journal_size_bytes), sizeof(journal_size_bytes));
+	file.read(reinterpret_cast<char*>(&chunk_size), sizeof(chunk_size));
+
+	if (!file || std::memcmp(magic, JOURNAL_MAGIC, sizeof(magic)) != 0 || journal_size_bytes != size_bytes || chunk_size != CHUNK_SIZE) {
+		return false;
+	}
+
+	file.read(reinterpret_cast<char*>(bitmap.data()), bitmap.size());
+
+	return bool(file);
+}
+
+static uint32_t count_chunks(const std::vector<uint8_t>& bitmap, uint32_t num_chunks)
+{
+	uint32_t count = 0;
+
+	for (uint32_t chunk = 0; chunk < num_chunks; chunk++) {
+		count += (bitmap[chunk / 8] >> (chunk % 8)) & 1;
+	}
+
+	return count;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <mavsdk/mavsdk.h>
+#include <mavsdk/plugins/log_files/log_files.h>
+#include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "DownloadPacer.hpp"
+
+// Downloads a log with LOG_REQUEST_DATA / LOG_DATA over MAVLink passthrough. Received chunks are
+// written in place and tracked in a bitmap that is persisted next to the log as <log>.journal,
+// so an interrupted download resumes where it stopped and only the missing ranges are requested.
+// The size of the ranges and the time between requests are chosen by a DownloadPacer, which is
+// kept from one download to the next since they share the link.
+class LogDownloader
+{
+public:
+	struct Settings {
+		DownloadPacer::Settings pacing;
+		std::chrono::milliseconds data_timeout {1000}; // Upper bound of the timeout for re-requesting missing data
+		uint32_t max_retries {10};                    // Give up after this many data_timeout without progress
+		std::chrono::seconds journal_interval {2};    // How often the journal is written to disk
+	};
+
+	enum class Result {
+		Success,
+		Timeout,
+		Cancelled,
+		FileError
+	};
+
+	// Called on the downloading thread with the fraction of the log received so far
+	using ProgressCallback = std::function<void(float progress)>;
+
+	LogDownloader(std::shared_ptr<mavsdk::MavlinkPassthrough> passthrough, const Settings& settings);
+
+	Result download(const mavsdk::LogFiles::Entry& entry, const std::string& path, const ProgressCallback& progress_callback);
+
+	// Only fetches the given bytes of the log, the journal is kept so download() resumes around them
+	Result download_range(const mavsdk::LogFiles::Entry& entry, const std::string& path, uint32_t offset, uint32_t bytes);
+	void cancel();
+
+	// While held the transfer in progress stops as if cancelled and new ones return Cancelled right
+	// away, unlike cancel() this is not lost if it happens before a transfer starts
+	void hold(bool held);
+
+	// Bytes received by the last download(), without what was resumed from the journal
+	uint64_t bytes_transferred() const;
+
+	// Link estimates, only read while no transfer is running
+	const DownloadPacer& pacer() const { return _pacer; }
+
+	static std::string journal_path(const std::string& path) { return path + ".journal"; }
+
+	// Bytes still missing from a partial download, the whole size when there is no usable journal
+	static uint64_t remaining_bytes(const mavsdk::LogFiles::Entry& entry, const std::string& path);
+
+private:
+	struct Range {
+		uint32_t first_chunk;
+		uint32_t num_chunks;
+	};
+
+	// A requested range the vehicle may still be streaming
+	struct Window {
+		Range range;
+		DownloadPacer::Clock::time_point sent;
+		DownloadPacer::Clock::time_point first_arrival;
+		DownloadPacer::Clock::time_point last_arrival;
+		uint32_t chunks_received; // Chunks of the range that arrived, new or not
+		bool finished;            // The last chunk arrived, or a chunk of a later range
+	};
+
+	Result transfer(const mavsdk::LogFiles::Entry& entry, const std::string& path, uint32_t offset, uint32_t max_bytes,
+			const ProgressCallback& progress_callback);
+	bool open_file(const mavsdk::LogFiles::Entry& entry, const std::string& path);
+	void close_file();
+	bool load_journal();
+	bool save_journal();
+
+	void handle_log_data(const mavlink_message_t& message);
+	void retire_windows(DownloadPacer::Clock::time_point now); // Caller must hold _mutex
+	bool target_received() const;                              // Caller must hold _mutex
+	Range next_missing_range() const;                          // Caller must hold _mutex
+	const Window* in_flight(uint32_t chunk) const;             // Caller must hold _mutex
+	bool chunk_received(uint32_t chunk) const;                 // Caller must hold _mutex
+	void request_range(const Range& range);
+	void request_end();
+
+	std::shared_ptr<mavsdk::MavlinkPassthrough> _passthrough;
+	Settings _settings;
+
+	// State of the download in progress
+	mutable std::mutex _mutex;
+	std::condition_variable _cv;
+	int _fd = -1;
+	std::string _path;
+	uint16_t _log_id = 0;
+	uint32_t _size_bytes = 0;
+	uint32_t _num_chunks = 0;
+	uint32_t _first_chunk = 0;   // First chunk this transfer is after
+	uint32_t _target_chunks = 0; // End of the chunks this transfer is after
+	uint32_t _chunks_received = 0;
+	uint32_t _chunks_resumed = 0;
+	std::vector<uint8_t> _bitmap;
+	std::deque<Window> _windows; // Oldest first, at most the one streaming and the next one
+	DownloadPacer::Clock::time_point _last_arrival {};
+	uint32_t _arrivals = 0;      // LOG_DATA messages of this log, wakes the transfer loop
+	bool _write_error = false;
+
+	DownloadPacer _pacer;
+
+	std::atomic<bool> _cancelled = false;
+	std::atomic<bool> _held = false;
+};
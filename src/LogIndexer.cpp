@@ -0,0 +1,518 @@
+#include "LogIndexer.hpp"
+#include "Log.hpp"
+#include "LogArchive.hpp"
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <map>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Logs without metadata taken from the database at a time, so new downloads are not held up
+static constexpr uint32_t INDEX_BATCH = 64;
+
+// https://docs.px4.io/main/en/dev_log/ulog_file_format.html
+static constexpr uint8_t ULOG_MAGIC[] = {'U', 'L', 'o', 'g', 0x01, 0x12, 0x35};
+static constexpr size_t ULOG_HEADER_SIZE = 16;
+static constexpr size_t MESSAGE_HEADER_SIZE = 3; // uint16_t msg_size, uint8_t msg_type
+static constexpr std::string_view TIMESTAMP_FIELD = "uint64_t timestamp;";
+
+// Archived logs are decompressed into a buffer of this size, it holds the largest ULog message
+static constexpr size_t READ_BUFFER_SIZE = 256 * 1024;
+
+// ULog is little endian like every companion computer we run on
+template<typename T>
+static T read_value(const uint8_t* data)
+{
+	T value;
+	std::memcpy(&value, data, sizeof(T));
+	return value;
+}
+
+LogIndexer::LogIndexer(std::shared_ptr<Database> database)
+	: _database(std::move(database))
+{}
+
+LogIndexer::~LogIndexer()
+{
+	stop();
+}
+
+void LogIndexer::start()
+{
+	if (_thread.joinable()) {
+		return;
+	}
+
+	_should_exit = false;
+	_thread = std::thread(&LogIndexer::run, this);
+}
+
+void LogIndexer::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_should_exit = true;
+	}
+
+	_cv.notify_all();
+
+	if (_thread.joinable()) {
+		_thread.join();
+	}
+
+	// Whatever was still queued is found in the database next time
+	std::lock_guard<std::mutex> lock(_mutex);
+	_queue.clear();
+	_check_database = true;
+}
+
+void LogIndexer::enqueue(const std::string& uuid)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_queue.push_back(uuid);
+	}
+
+	_cv.notify_one();
+}
+
+void LogIndexer::run()
+{
+	while (true) {
+		std::string uuid;
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cv.wait(lock, [this] { return _should_exit || _check_database || !_queue.empty(); });
+
+			if (_should_exit) {
+				break;
+			}
+
+			if (!_queue.empty()) {
+				uuid = std::move(_queue.front());
+				_queue.pop_front();
+
+			} else {
+				_check_database = false;
+			}
+		}
+
+		if (!uuid.empty()) {
+			index(uuid);
+			continue;
+		}
+
+		auto pending = _database->get_logs_to_index(INDEX_BATCH);
+
+		if (!pending.empty()) {
+			LOG_DEBUG("Indexing " << pending.size() << " logs without metadata");
+		}
+
+		for (const auto& pending_uuid : pending) {
+			if (_should_exit) {
+				break;
+			}
+
+			index(pending_uuid);
+		}
+
+		if (pending.size() == INDEX_BATCH) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_check_database = true;
+		}
+	}
+
+	LOG_DEBUG("Log indexer exiting");
+}
+
+void LogIndexer::index(const std::string& uuid)
+{
+	std::string path = _database->filepath_from_uuid(uuid);
+
+	if (!path.empty()) {
+		index_log(*_database, uuid, path);
+	}
+}
+
+void LogIndexer::index_log(Database& database, const std::string& uuid, const std::string& log_path)
+{
+	std::string path = log_path;
+	auto start = std::chrono::steady_clock::now();
+
+	Database::LogMetadata metadata;
+	Stats stats = {};
+	bool valid = index_file(path, metadata, &stats);
+
+	// The raw log may have been archived after its path was looked up
+	if (!valid && !fs::exists(path)) {
+		std::string archived_path = database.filepath_from_uuid(uuid);
+
+		if (archived_path != path) {
+			path = archived_path;
+			valid = index_file(path, metadata, &stats);
+		}
+	}
+
+	if (!valid) {
+		// Not retried, the log is still uploaded as is
+		LOG("Could not index " << path);
+		database.set_index_failed(uuid);
+		Metrics::instance().index_failures.increment();
+		return;
+	}
+
+	if (!database.set_log_metadata(uuid, metadata)) {
+		return;
+	}
+
+	Metrics::instance().indexed_logs.increment();
+
+	std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+	LOG_DEBUG("Indexed " << fs::path(path).filename().string() << ": "
+		  << std::fixed << std::setprecision(1) << metadata.duration_s << " s flight, "
+		  << (metadata.firmware_version.empty() ? "unknown firmware" : metadata.firmware_version) << ", "
+		  << stats.messages << " messages in " << std::setprecision(3) << duration.count() << " s");
+}
+
+// Collects the metadata of a ULog one message at a time. Names are copied out of the messages, so
+// the buffer they were read from can be reused for the next ones.
+class UlogParser
+{
+public:
+	void message(uint8_t msg_type, const uint8_t* payload, uint16_t msg_size);
+	void finish(Database::LogMetadata& metadata);
+
+	uint64_t messages() const { return _messages; }
+
+private:
+	void observe(uint64_t timestamp)
+	{
+		if (timestamp != 0) {
+			_first_timestamp = std::min(_first_timestamp, timestamp);
+			_last_timestamp = std::max(_last_timestamp, timestamp);
+		}
+	}
+
+	Database::LogMetadata _metadata;
+
+	// Whether the format of each message name starts with the timestamp, from the definitions
+	std::map<std::string, bool, std::less<>> _timestamp_first;
+	// The same by msg_id of the subscriptions, data messages only carry the ID
+	std::vector<uint8_t> _timestamped;
+	// Sorted and made unique at the end
+	std::vector<std::string> _topics;
+
+	std::string _ver_sw;
+	uint32_t _ver_sw_release = 0;
+	uint64_t _first_timestamp = UINT64_MAX;
+	uint64_t _last_timestamp = 0;
+	uint64_t _messages = 0;
+};
+
+void UlogParser::message(uint8_t msg_type, const uint8_t* payload, uint16_t msg_size)
+{
+	const char* text = reinterpret_cast<const char*>(payload);
+
+	_messages++;
+
+	switch (msg_type) {
+	case 'D': // uint16_t msg_id, then the fields of the format
+		if (msg_size >= 2 + sizeof(uint64_t)) {
+			uint16_t msg_id = read_value<uint16_t>(payload);
+
+			if (msg_id < _timestamped.size() && _timestamped[msg_id]) {
+				observe(read_value<uint64_t>(payload + 2));
+			}
+		}
+
+		break;
+
+	case 'L': // uint8_t log_level, uint64_t timestamp, char message[]
+		if (msg_size >= 1 + sizeof(uint64_t)) {
+			observe(read_value<uint64_t>(payload + 1));
+		}
+
+		break;
+
+	case 'C': // uint8_t log_level, uint16_t tag, uint64_t timestamp, char message[]
+		if (msg_size >= 3 + sizeof(uint64_t)) {
+			observe(read_value<uint64_t>(payload + 3));
+		}
+
+		break;
+
+	case 'A': { // uint8_t multi_id, uint16_t msg_id, char message_name[]
+		if (msg_size <= 3) {
+			break;
+		}
+
+		uint16_t msg_id = read_value<uint16_t>(payload + 1);
+		std::string_view name(text + 3, msg_size - 3);
+		_topics.emplace_back(name);
+
+		if (msg_id >= _timestamped.size()) {
+			_timestamped.resize(msg_id + 1);
+		}
+
+		auto format = _timestamp_first.find(name);
+		_timestamped[msg_id] = format != _timestamp_first.end() && format->second;
+		break;
+	}
+
+	case 'F': { // char format[], "<name>:<type> <field>;..."
+		std::string_view format(text, msg_size);
+		size_t colon = format.find(':');
+
+		if (colon != std::string_view::npos) {
+			_timestamp_first[std::string(format.substr(0, colon))] = format.substr(colon + 1).starts_with(TIMESTAMP_FIELD);
+		}
+
+		break;
+	}
+
+	case 'I': { // uint8_t key_len, char key[key_len] as "<type> <name>", value
+		if (msg_size < 1 || payload[0] > msg_size - 1) {
+			break;
+		}
+
+		std::string_view key(text + 1, payload[0]);
+		std::string_view value(text + 1 + payload[0], msg_size - 1 - payload[0]);
+		size_t space = key.find(' ');
+
+		if (space == std::string_view::npos) {
+			break;
+		}
+
+		std::string_view type = key.substr(0, space);
+		std::string_view name = key.substr(space + 1);
+
+		if (name == "ver_sw_release" && type == "uint32_t" && value.size() >= sizeof(uint32_t)) {
+			_ver_sw_release = read_value<uint32_t>(payload + 1 + payload[0]);
+			break;
+		}
+
+		if (!type.starts_with("char[")) {
+			break;
+		}
+
+		// Strings may be padded with zeros
+		value = value.substr(0, value.find('\0'));
+
+		if (name == "ver_sw") {
+			_ver_sw = value;
+
+		} else if (name == "ver_hw") {
+			_metadata.hardware = value;
+
+		} else if (name == "sys_uuid") {
+			_metadata.vehicle_uuid = value;
+		}
+
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+void UlogParser::finish(Database::LogMetadata& metadata)
+{
+	if (_last_timestamp > _first_timestamp) {
+		_metadata.duration_s = (_last_timestamp - _first_timestamp) / 1e6;
+	}
+
+	_metadata.firmware_version = _ver_sw_release ? LogIndexer::release_version(_ver_sw_release) : _ver_sw;
+
+	// Multi instance topics are subscribed once per instance
+	std::sort(_topics.begin(), _topics.end());
+	_topics.erase(std::unique(_topics.begin(), _topics.end()), _topics.end());
+
+	for (const auto& topic : _topics) {
+		if (!_metadata.topics.empty()) {
+			_metadata.topics += ',';
+		}
+
+		_metadata.topics += topic;
+	}
+
+	metadata = std::move(_metadata);
+}
+
+// Parses an archived log as it is decompressed. Only the message being parsed and what was read
+// after it are held in memory, never the whole log.
+static bool parse_archive(LogArchive::Reader& reader, Database::LogMetadata& metadata, LogIndexer::Stats* stats)
+{
+	std::vector<uint8_t> buffer(READ_BUFFER_SIZE);
+	size_t begin = 0;
+	size_t end = 0;
+
+	// Makes sure the next length bytes are in the buffer, the largest message always fits
+	auto fill = [&](size_t length) {
+		if (end - begin >= length) {
+			return true;
+		}
+
+		std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+		end -= begin;
+		begin = 0;
+
+		while (end < length) {
+			size_t read = reader.read(reinterpret_cast<char*>(buffer.data()) + end, buffer.size() - end);
+
+			if (read == 0) {
+				return false;
+			}
+
+			end += read;
+		}
+
+		return true;
+	};
+
+	if (!fill(ULOG_HEADER_SIZE) || std::memcmp(buffer.data(), ULOG_MAGIC, sizeof(ULOG_MAGIC)) != 0) {
+		return false;
+	}
+
+	begin = ULOG_HEADER_SIZE;
+
+	UlogParser parser;
+
+	while (fill(MESSAGE_HEADER_SIZE)) {
+		uint16_t msg_size = read_value<uint16_t>(buffer.data() + begin);
+
+		// A log cut short by a power loss ends in a partial message
+		if (!fill(MESSAGE_HEADER_SIZE + msg_size)) {
+			break;
+		}
+
+		parser.message(buffer[begin + 2], buffer.data() + begin + MESSAGE_HEADER_SIZE, msg_size);
+		begin += MESSAGE_HEADER_SIZE + msg_size;
+	}
+
+	parser.finish(metadata);
+
+	if (stats) {
+		stats->bytes = reader.position();
+		stats->messages = parser.messages();
+	}
+
+	return true;
+}
+
+bool LogIndexer::index_file(const std::string& path, Database::LogMetadata& metadata, Stats* stats)
+{
+	if (LogArchive::is_compressed(path)) {
+		LogArchive::Reader reader;
+
+		if (!reader.open(path)) {
+			return false;
+		}
+
+		return parse_archive(reader, metadata, stats);
+	}
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st {};
+
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	size_t size = st.st_size;
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	// The mapping keeps the file around even if it is deleted while parsing
+	::close(fd);
+
+	if (mapping == MAP_FAILED) {
+		return false;
+	}
+
+	// The log is read front to back exactly once
+	madvise(mapping, size, MADV_SEQUENTIAL);
+
+	bool valid = parse(static_cast<const uint8_t*>(mapping), size, metadata, stats);
+
+	munmap(mapping, size);
+
+	return valid;
+}
+
+bool LogIndexer::parse(const uint8_t* data, size_t size, Database::LogMetadata& metadata, Stats* stats)
+{
+	if (size < ULOG_HEADER_SIZE || std::memcmp(data, ULOG_MAGIC, sizeof(ULOG_MAGIC)) != 0) {
+		return false;
+	}
+
+	UlogParser parser;
+	size_t offset = ULOG_HEADER_SIZE;
+
+	while (offset + MESSAGE_HEADER_SIZE <= size) {
+		uint16_t msg_size = read_value<uint16_t>(data + offset);
+		uint8_t msg_type = data[offset + 2];
+		const uint8_t* payload = data + offset + MESSAGE_HEADER_SIZE;
+
+		offset += MESSAGE_HEADER_SIZE + msg_size;
+
+		// A log cut short by a power loss ends in a partial message
+		if (offset > size) {
+			break;
+		}
+
+		parser.message(msg_type, payload, msg_size);
+	}
+
+	parser.finish(metadata);
+
+	if (stats) {
+		stats->bytes = size;
+		stats->messages = parser.messages();
+	}
+
+	return true;
+}
+
+std::string LogIndexer::release_version(uint32_t ver_sw_release)
+{
+	// 0xAABBCCTT for vAA.BB.CC, TT is 255 for releases, 192 rc, 128 beta, 64 alpha and 0 dev
+	uint8_t type = ver_sw_release & 0xFF;
+
+	std::string version = "v" + std::to_string((ver_sw_release >> 24) & 0xFF)
+			      + "." + std::to_string((ver_sw_release >> 16) & 0xFF)
+			      + "." + std::to_string((ver_sw_release >> 8) & 0xFF);
+
+	if (type == 255) {
+		return version;
+
+	} else if (type >= 192) {
+		return version + "-rc";
+
+	} else if (type >= 128) {
+		return version + "-beta";
+
+	} else if (type >= 64) {
+		return version + "-alpha";
+	}
+
+	return version + "-dev";
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Database.hpp"
+
+// Fills the flight catalog with the metadata of downloaded logs. A raw .ulg is mapped into memory
+// and parsed in place: the header, the format definitions and the info messages are read, the
+// data section is only walked message header to message header to collect the logged topics and
+// the last timestamp. Archived logs are parsed as they are decompressed, a buffer at a time.
+// Logs are indexed on a worker thread so downloads never wait for it, logs without metadata are
+// picked up on start. Logs that are archived right after downloading are indexed by the vehicle
+// before they are compressed.
+class LogIndexer
+{
+public:
+	struct Stats {
+		uint64_t bytes;    // Size of the log that was parsed
+		uint64_t messages; // ULog messages visited
+	};
+
+	LogIndexer(std::shared_ptr<Database> database);
+	~LogIndexer();
+
+	void start();
+	void stop();
+
+	// Index a log that has just been downloaded
+	void enqueue(const std::string& uuid);
+
+	// Indexes a log on the calling thread and stores its metadata, or marks it as failed
+	static void index_log(Database& database, const std::string& uuid, const std::string& path);
+
+	// Parses a ULog held in memory, false if it is not one
+	static bool parse(const uint8_t* data, size_t size, Database::LogMetadata& metadata, Stats* stats = nullptr);
+
+	// Maps a raw log, or decompresses an archived one, and parses it
+	static bool index_file(const std::string& path, Database::LogMetadata& metadata, Stats* stats = nullptr);
+
+	// ver_sw_release as v<major>.<minor>.<patch>, with the type suffix for pre-releases
+	static std::string release_version(uint32_t ver_sw_release);
+
+private:
+	void run();
+	void index(const std::string& uuid);
+
+	std::shared_ptr<Database> _database;
+
+	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	std::deque<std::string> _queue;
+	bool _check_database = true; // Logs downloaded before the indexer existed, or while it was stopped
+	std::atomic<bool> _should_exit = false;
+};
@@ -0,0 +1,207 @@
+#include "LogList.hpp"
+#include "Log.hpp"
+#include "Database.hpp"
+
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+LogList::LogList(std::shared_ptr<mavsdk::LogFiles> log_files, std::shared_ptr<mavsdk::MavlinkPassthrough> passthrough,
+		 const LogList::Settings& settings)
+	: _log_files(log_files)
+	, _passthrough(passthrough)
+	, _settings(settings)
+{}
+
+std::string LogList::format_date(uint32_t time_utc)
+{
+	// Same format MAVSDK uses for LogFiles::Entry::date, the UUIDs depend on it
+	std::time_t time = time_utc;
+	std::tm tm {};
+	gmtime_r(&time, &tm);
+
+	std::ostringstream ss;
+	ss << std::put_time(&tm, "%Y-%m-%dT%H:%M:%SZ");
+	return ss.str();
+}
+
+LogList::Result LogList::refresh()
+{
+	if (!_valid) {
+		return full_refresh();
+	}
+
+	switch (incremental_refresh()) {
+	case IncrementalResult::Unchanged:
+		return Result::Unchanged;
+
+	case IncrementalResult::Updated:
+		return Result::Updated;
+
+	case IncrementalResult::Mismatch:
+		LOG_DEBUG("Log list changed on the vehicle, requesting full list");
+		return full_refresh();
+	}
+
+	return Result::Failed;
+}
+
+LogList::Result LogList::full_refresh()
+{
+	auto [result, entries] = _log_files->get_entries();
+
+	if (result != mavsdk::LogFiles::Result::Success) {
+		_valid = false;
+		return Result::Failed;
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.id < b.id; });
+
+	_entries = std::move(entries);
+	_index.clear();
+	index_entries(0);
+
+	_num_logs = _entries.size();
+	_last_log_num = _entries.empty() ? 0 : _entries.back().id;
+
+	// With nothing to compare against the next refresh has to list everything again anyway
+	_valid = !_entries.empty();
+
+	return Result::Updated;
+}
+
+LogList::IncrementalResult LogList::incremental_refresh()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_received.clear();
+	}
+
+	auto handle = _passthrough->subscribe_message(MAVLINK_MSG_ID_LOG_ENTRY, [this](const mavlink_message_t& message) {
+		handle_log_entry(message);
+	});
+
+	// The last known entry comes back along with anything newer, it tells us whether the list still lines up
+	uint16_t start = _last_log_num;
+
+	_passthrough->queue_message([this, start](mavsdk::MavlinkAddress address, uint8_t channel) {
+		mavlink_message_t message;
+		mavlink_msg_log_request_list_pack_chan(address.system_id, address.component_id, channel, &message,
+						       _passthrough->get_target_sysid(), _passthrough->get_target_compid(),
+						       start, 0xFFFF);
+		return message;
+	});
+
+	std::map<uint16_t, mavlink_log_entry_t> received;
+
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		// Wait until the vehicle has sent up to its last log, or goes quiet
+		while (true) {
+			size_t received_before = _received.size();
+
+			bool complete = _cv.wait_for(lock, _settings.entry_timeout, [this, start] {
+				if (_received.empty()) {
+					return false;
+				}
+
+				uint16_t last_log_num = _received.begin()->second.last_log_num;
+				return last_log_num >= start && _received.size() == size_t(last_log_num - start + 1);
+			});
+
+			if (complete || _received.size() == received_before) {
+				break;
+			}
+		}
+
+		received = std::move(_received);
+	}
+
+	_passthrough->unsubscribe_message(MAVLINK_MSG_ID_LOG_ENTRY, handle);
+
+	if (received.empty()) {
+		LOG_DEBUG("No log entries received");
+		return IncrementalResult::Mismatch;
+	}
+
+	uint16_t num_logs = received.begin()->second.num_logs;
+	uint16_t last_log_num = received.begin()->second.last_log_num;
+
+	// Fewer logs, or IDs that moved, mean logs were deleted on the vehicle
+	if (num_logs < _num_logs || last_log_num < _last_log_num
+	    || num_logs - _num_logs != last_log_num - _last_log_num
+	    || received.size() != size_t(last_log_num - start + 1)) {
+		return IncrementalResult::Mismatch;
+	}
+
+	auto last_known = received.find(start);
+
+	if (last_known == received.end()
+	    || format_date(last_known->second.time_utc) != _entries.back().date
+	    || last_known->second.size != _entries.back().size_bytes) {
+		return IncrementalResult::Mismatch;
+	}
+
+	if (last_log_num == _last_log_num) {
+		return IncrementalResult::Unchanged;
+	}
+
+	size_t first_new = _entries.size();
+
+	for (auto it = std::next(last_known); it != received.end(); ++it) {
+		mavsdk::LogFiles::Entry entry;
+		entry.id = it->first;
+		entry.date = format_date(it->second.time_utc);
+		entry.size_bytes = it->second.size;
+		_entries.push_back(entry);
+	}
+
+	index_entries(first_new);
+
+	LOG_DEBUG("Received " << last_log_num - _last_log_num << " new log entries");
+
+	_num_logs = num_logs;
+	_last_log_num = last_log_num;
+
+	return IncrementalResult::Updated;
+}
+
+const mavsdk::LogFiles::Entry* LogList::find(const std::string& uuid) const
+{
+	uint64_t hash = 0;
+
+	if (!Database::uuid_from_string(uuid, hash)) {
+		return nullptr;
+	}
+
+	auto it = _index.find(hash);
+	return it != _index.end() ? &_entries[it->second] : nullptr;
+}
+
+void LogList::index_entries(size_t first)
+{
+	_index.reserve(_entries.size());
+
+	for (size_t i = first; i < _entries.size(); i++) {
+		_index[Database::uuid_hash(_entries[i], _settings.vehicle_id)] = i;
+	}
+}
+
+void LogList::handle_log_entry(const mavlink_message_t& message)
+{
+	if (message.sysid != _passthrough->get_target_sysid()) {
+		return;
+	}
+
+	mavlink_log_entry_t log_entry;
+	mavlink_msg_log_entry_decode(&message, &log_entry);
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_received[log_entry.id] = log_entry;
+	}
+
+	_cv.notify_all();
+}
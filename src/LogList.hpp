@@ -0,0 +1,75 @@
+#pragma once
+
+#include <mavsdk/mavsdk.h>
+#include <mavsdk/plugins/log_files/log_files.h>
+#include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Cached copy of the vehicle's log list. Enumerating every log over MAVLink takes tens of seconds
+// with 1000+ logs on the SD card, so after the first full listing only the entries from the last
+// known ID onwards are requested. Any sign that older logs changed falls back to a full listing.
+class LogList
+{
+public:
+	struct Settings {
+		std::chrono::milliseconds entry_timeout {1000}; // Give up on an incremental request after this long without LOG_ENTRY
+		uint8_t vehicle_id {1};                         // System the database UUIDs are generated for
+	};
+
+	enum class Result {
+		Unchanged,
+		Updated,
+		Failed
+	};
+
+	LogList(std::shared_ptr<mavsdk::LogFiles> log_files, std::shared_ptr<mavsdk::MavlinkPassthrough> passthrough,
+		const Settings& settings);
+
+	Result refresh();
+
+	// Forces a full listing on the next refresh
+	void invalidate() { _valid = false; }
+
+	// Sorted by log ID
+	const std::vector<mavsdk::LogFiles::Entry>& entries() const { return _entries; }
+
+	// Entry with the given database UUID, nullptr if the vehicle does not have it
+	const mavsdk::LogFiles::Entry* find(const std::string& uuid) const;
+
+	static std::string format_date(uint32_t time_utc);
+
+private:
+	enum class IncrementalResult {
+		Unchanged,
+		Updated,
+		Mismatch  // The vehicle's list no longer matches the cache
+	};
+
+	Result full_refresh();
+	IncrementalResult incremental_refresh();
+	void handle_log_entry(const mavlink_message_t& message);
+	void index_entries(size_t first);
+
+	std::shared_ptr<mavsdk::LogFiles> _log_files;
+	std::shared_ptr<mavsdk::MavlinkPassthrough> _passthrough;
+	Settings _settings;
+
+	// Cached list and the counters the vehicle reported with it
+	std::vector<mavsdk::LogFiles::Entry> _entries;
+	std::unordered_map<uint64_t, size_t> _index; // UUID hash to position in _entries
+	uint16_t _num_logs = 0;
+	uint16_t _last_log_num = 0;
+	bool _valid = false;
+
+	// LOG_ENTRY messages received for the request in progress
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	std::map<uint16_t, mavlink_log_entry_t> _received;
+};
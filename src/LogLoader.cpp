@@ -1,8 +1,8 @@
 #include "LogLoader.hpp"
 #include "Log.hpp"
+#include <algorithm>
 #include <iostream>
 #include <filesystem>
-#include <future>
 #include <regex>
 #include <fstream>
 
@@ -19,34 +19,96 @@ LogLoader::LogLoader(const LogLoader::Settings& settings)
 
 	_logs_directory = _settings.application_directory + "logs/";
 
+	// Setup the state database shared by all backends
+	Database::Settings database_settings = {
+		.db_path = _settings.application_directory + "logloader.db",
+		.logs_directory = _logs_directory,
+	};
+
+	_database = std::make_shared<Database>(database_settings);
+
+	LogArchive::Settings archive_settings = {
+		.enabled = settings.compress_logs,
+		.compression_level = settings.compression_level,
+	};
+
+	_log_archive = std::make_shared<LogArchive>(archive_settings);
+
+	_log_indexer = std::make_unique<LogIndexer>(_database);
+
 	// Setup local server interface
 	ServerInterface::Settings local_server_settings = {
+		.name = "local",
 		.server_url = settings.local_server,
 		.user_email = "",
-		.logs_directory = _logs_directory,
-		.db_path = _settings.application_directory + "local_server.db",
 		.upload_enabled = true, // Always upload to local server
 		.public_logs = true, // Public required true for searching using Web UI
+		.max_concurrent_uploads = settings.max_concurrent_uploads,
+		.accepts_compressed = false,
 	};
 
 	// Setup remote server interface
 	ServerInterface::Settings remote_server_settings = {
+		.name = "remote",
 		.server_url = settings.remote_server,
 		.user_email = settings.email,
-		.logs_directory = _logs_directory,
-		.db_path = _settings.application_directory + "remote_server.db",
 		.upload_enabled = settings.upload_enabled,
 		.public_logs = settings.public_logs,
+		.max_concurrent_uploads = settings.max_concurrent_uploads,
+		.accepts_compressed = false,
 	};
 
-	_local_server = std::make_shared<ServerInterface>(local_server_settings);
-	_remote_server = std::make_shared<ServerInterface>(remote_server_settings);
+	add_backend(local_server_settings);
+	add_backend(remote_server_settings);
+
+	for (const auto& backend : _settings.backends) {
+		add_backend(backend);
+	}
+
+	RetentionManager::Settings retention_settings = _settings.retention;
+	retention_settings.logs_directory = _logs_directory;
 
-	std::cout << std::fixed << std::setprecision(8);
+	_retention = std::make_unique<RetentionManager>(_database, retention_settings);
+
+	// Older versions kept one database per server
+	_database->import_legacy_database(_settings.application_directory + "local_server.db", "local");
+	_database->import_legacy_database(_settings.application_directory + "remote_server.db", "remote");
+
+	if (_settings.metrics_port) {
+		MetricsServer::Settings metrics_settings = {
+			.host = "127.0.0.1",
+			.port = _settings.metrics_port,
+		};
+
+		_metrics_server = std::make_unique<MetricsServer>(metrics_settings);
+		_metrics_server->start();
+	}
 
 	fs::create_directories(_logs_directory);
 }
 
+void LogLoader::add_backend(ServerInterface::Settings settings)
+{
+	if (settings.name.empty() || settings.server_url.empty()) {
+		LOG("Skipping backend without name or url: " << settings.name << " " << settings.server_url);
+		return;
+	}
+
+	for (const auto& server : _servers) {
+		if (server->name() == settings.name) {
+			LOG("Skipping duplicate backend: " << settings.name);
+			return;
+		}
+	}
+
+	settings.retry = _settings.upload_retry;
+	settings.circuit_breaker = _settings.circuit_breaker;
+	settings.health_check_interval = _settings.health_check_interval;
+	settings.health_retry_interval = _settings.health_retry_interval;
+
+	_servers.push_back(std::make_shared<ServerInterface>(settings, _database));
+}
+
 void LogLoader::stop()
 {
 	{
@@ -68,6 +130,7 @@ bool LogLoader::wait_for_mavsdk_connection(double timeout_ms)
 		return false;
 	}
 
+	// Further autopilots are picked up by run() as they appear
 	auto system = _mavsdk->first_autopilot(timeout_ms);
 
 	if (!system) {
@@ -77,279 +140,177 @@ bool LogLoader::wait_for_mavsdk_connection(double timeout_ms)
 
 	LOG("Connected.");
 
-	// MAVSDK plugins
-	_log_files = std::make_shared<mavsdk::LogFiles>(system.value());
-	_telemetry = std::make_shared<mavsdk::Telemetry>(system.value());
-
 	return true;
 }
 
 void LogLoader::run()
 {
-	auto upload_thread = std::thread(&LogLoader::upload_logs_thread, this);
+	start_upload_workers();
+	_log_indexer->start();
 
 	while (!_should_exit) {
-		// Check if vehicle is armed or if the logger is running
-		// TODO: use SYS_STATUS flags to check logger status -- needs MAVSDK impl
-		// bool logger_running = _telemetry->sys_status_sensors().enabled & MAV_SYS_STATUS_LOGGING;
-		bool logger_running = false;
-		bool vehicle_armed = _telemetry->armed();
-
-		if (logger_running || vehicle_armed) {
-			_loop_disabled = true;
-			_remote_server->stop();
-			_local_server->stop();
-			std::this_thread::sleep_for(std::chrono::seconds(1));
-			continue;
-
-		} else if (_loop_disabled) {
-			_loop_disabled = false;
-			_remote_server->start();
-			_local_server->start();
-			// Stall for a few seconds to allow logger to finish writing
-			std::this_thread::sleep_for(std::chrono::seconds(3));
-		}
-
-		// TODO:
-		// - request log entries at boot after connecting only
-		// - during runtime gate the log entry request on logger on/off events
-		if (!request_log_entries()) {
-			LOG_DEBUG("Failed to get logs");
-			std::this_thread::sleep_for(std::chrono::seconds(5));
-			continue;
-		}
-
-		uint32_t total_to_download = _local_server->num_logs_to_download();
-		uint32_t num_remaining = total_to_download;
-
-		while (!_should_exit && num_remaining) {
-			// Download logs until we should exit or there are none left to download
-			LOG("Downloading log " << total_to_download - num_remaining + 1 << "/" << total_to_download);
-			download_next_log();
-			num_remaining = _local_server->num_logs_to_download();
-		}
-
-		// Periodically request log list
-		if (!_should_exit) {
-			std::unique_lock<std::mutex> lock(_exit_cv_mutex);
-			_exit_cv.wait_for(lock, std::chrono::seconds(30), [this] { return _should_exit.load(); });
-		}
-	}
-
-	LOG_DEBUG("Waiting for upload thread");
-	upload_thread.join();
-}
-
-bool LogLoader::request_log_entries()
-{
-	LOG_DEBUG("Requesting log entries...");
-
-	// Debug profiling code. We need to check how this performs with 100+ logs
-	auto request_start = std::chrono::high_resolution_clock::now();
-	auto entries_result = _log_files->get_entries();
-
-	//  Store log entries
-	_log_entries = entries_result.second;
-
-	auto request_end = std::chrono::high_resolution_clock::now();
-
-	std::chrono::duration<double> request_duration = request_end - request_start;
-	LOG_DEBUG("Received " << _log_entries.size() << "log entries in " << request_duration.count() << " seconds");
-
-	if (entries_result.first != mavsdk::LogFiles::Result::Success) {
-		LOG("Error getting log entries");
-		return false;
+		add_new_vehicles();
+		update_upload_state();
+		update_queue_metrics();
+		update_retention();
+
+		// Woken when a vehicle arms or disarms, uploads are paused or resumed without waiting for the poll
+		std::unique_lock<std::mutex> lock(_exit_cv_mutex);
+		_exit_cv.wait_for(lock, std::chrono::seconds(1), [this] { return _should_exit || _vehicle_state_changed; });
+		_vehicle_state_changed = false;
 	}
 
-	// Time the database addition
-	auto db_start = std::chrono::high_resolution_clock::now();
+	// Downloads in progress are cancelled and resume from their journal on the next start
+	LOG_DEBUG("Stopping vehicles");
 
-	for (const auto& entry : _log_entries) {
-		_local_server->add_log_entry(entry);
-		_remote_server->add_log_entry(entry);
+	for (auto& vehicle : _vehicles) {
+		vehicle->stop();
 	}
 
-	auto db_end = std::chrono::high_resolution_clock::now();
-	std::chrono::duration<double> db_duration = db_end - db_start;
+	_vehicles.clear();
 
-	LOG_DEBUG("Added log entries to databases in " << db_duration.count() << " seconds");
-	LOG_DEBUG("Total processing time: " << (request_duration + db_duration).count() << " seconds");
+	LOG_DEBUG("Waiting for upload workers");
+	stop_upload_workers();
 
-	return true;
+	_log_indexer->stop();
 }
 
-void LogLoader::download_next_log()
+void LogLoader::add_new_vehicles()
 {
-	// Get one undownloaded log, use the local server for query
-	ServerInterface::DatabaseEntry db_entry = _local_server->get_next_log_to_download();
-
-	if (db_entry.uuid.empty()) {
-		return;
-	}
+	for (auto& system : _mavsdk->systems()) {
+		if (!system->has_autopilot()) {
+			continue;
+		}
 
-	// Find the corresponding log entry in the list from the vehicle
-	for (const auto& entry : _log_entries) {
-		// Match by UUID (which is based on date and size)
-		std::string uuid = ServerInterface::generate_uuid(entry);
+		uint8_t id = system->get_system_id();
 
-		if (uuid == db_entry.uuid) {
-			if (download_log(entry)) {
-				// Update downloaded status in both databases
-				_local_server->update_download_status(uuid, true);
-				_remote_server->update_download_status(uuid, true);
-			}
+		bool known = std::any_of(_vehicles.begin(), _vehicles.end(), [id](const auto& vehicle) {
+			return vehicle->id() == id;
+		});
 
-			return;
+		if (known) {
+			continue;
 		}
-	}
 
-	// Couldn't find matching entry in _log_entries
-	// This could happen if the log is no longer available on the vehicle
-	// Mark it as processed to avoid trying again in both databases
-	_local_server->update_download_status(db_entry.uuid, true);
-	_remote_server->update_download_status(db_entry.uuid, true);
+		auto vehicle = std::make_unique<Vehicle>(system, _database, _log_archive, _settings.download_scheduler, _settings.log_downloader,
+		[this](const Database::LogEntry & entry) {
+			handoff_to_upload_workers(entry);
 
-	return;
-}
+			// The vehicle indexes the logs it archives before they are compressed
+			if (!_log_archive->enabled()) {
+				_log_indexer->enqueue(entry.uuid);
+			}
 
-bool LogLoader::download_log(const mavsdk::LogFiles::Entry& entry)
-{
-	auto prom = std::promise<mavsdk::LogFiles::Result> {};
-	auto future_result = prom.get_future();
-	auto download_path = _local_server->filepath_from_entry(entry);
+			_retention->run();
+		},
+		[this]() {
+			{
+				std::lock_guard<std::mutex> lock(_exit_cv_mutex);
+				_vehicle_state_changed = true;
+			}
 
-	// Check and delete file if it already exists. This can occur due to partial download.
-	if (fs::exists(download_path)) {
-		LOG("Found existing file, removing: " << download_path);
+			_exit_cv.notify_all();
+		});
 
-		try {
-			fs::remove(download_path);
+		LOG("Found vehicle " << vehicle->name() << ", logs are stored in " << _database->vehicle_directory(id));
 
-		} catch (const fs::filesystem_error& e) {
-			LOG("Error removing existing file: " << e.what());
-			return false;
-		}
+		vehicle->start();
+		_vehicles.push_back(std::move(vehicle));
+		Metrics::instance().vehicles.set(_vehicles.size());
 	}
+}
 
-	LOG("Downloading " << download_path);
-
-	auto time_start = std::chrono::steady_clock::now();
+void LogLoader::update_upload_state()
+{
+	// Uploads share the network with the vehicles, they are held while any of them is armed
+	bool any_armed = std::any_of(_vehicles.begin(), _vehicles.end(), [](const auto& vehicle) {
+		return vehicle->armed();
+	});
 
-	_log_files->download_log_file_async(
-		entry,
-		download_path,
-	[&prom, &entry, &time_start, this](mavsdk::LogFiles::Result result, mavsdk::LogFiles::ProgressData progress) {
+	if (any_armed && !_uploads_paused) {
+		// Uploads in flight are aborted at their next chunk and stay due
+		_uploads_paused = true;
 
-		if (_download_cancelled) return;
+		for (auto& server : _servers) {
+			server->stop();
+		}
 
-		auto now = std::chrono::steady_clock::now();
+	} else if (!any_armed && _uploads_paused) {
+		_uploads_paused = false;
 
-		if (_should_exit) {
-			_download_cancelled = true;
-			prom.set_value(mavsdk::LogFiles::Result::Timeout);
-			std::cout << std::endl << "Download cancelled.. exiting" << std::endl;
-			return;
+		for (auto& server : _servers) {
+			server->start();
 		}
 
-#ifdef DEBUG_BUILD
-		// Calculate data rate in Kbps
-		double rate_kbps = ((progress.progress * entry.size_bytes * 8.0)) / std::chrono::duration_cast<std::chrono::milliseconds>(now -
-				   time_start).count(); // Convert bytes to bits and then to Kbps
-
-		LOG_DEBUG("Downloading: "
-			  << std::setw(24) << std::left << entry.date
-			  << std::setw(8) << std::fixed << std::setprecision(2) << entry.size_bytes / 1e6 << "MB"
-			  << std::setw(6) << std::right << int(progress.progress * 100.0f) << "%"
-			  << std::setw(12) << std::fixed << std::setprecision(2) << rate_kbps << " Kbps"
-			  << std::flush);
-#else
-		(void)progress;
-#endif
-
-		if (result != mavsdk::LogFiles::Result::Next) {
-			double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(now - time_start).count() / 1000.;
-			LOG("Finished in " << std::setprecision(2) << seconds << " seconds");
-			prom.set_value(result);
+		// Pick up the held logs now rather than at the next poll
+		for (auto& workers : _upload_workers) {
+			workers->notify();
 		}
-	});
+	}
+}
 
-	auto result = future_result.get();
+void LogLoader::update_queue_metrics()
+{
+	Metrics::instance().pending_downloads.set(_database->num_logs_to_download());
 
-	std::cout << std::endl;
+	// Refreshes the pending uploads gauge of each backend
+	for (auto& server : _servers) {
+		server->num_logs_to_upload();
+	}
+}
 
-	bool success = result == mavsdk::LogFiles::Result::Success;
+void LogLoader::update_retention()
+{
+	// Runs after every download as well, this catches logs that became evictable by uploading
+	// and the disk filling up for other reasons
+	auto now = std::chrono::steady_clock::now();
 
-	if (!success) {
-		LOG("Download failed");
+	if (now - _retention_time < std::chrono::minutes(1)) {
+		return;
 	}
 
-	return success;
+	_retention_time = now;
+	_retention->run();
 }
 
-void LogLoader::upload_logs_thread()
+void LogLoader::start_upload_workers()
 {
-	while (!_should_exit) {
-		if (_loop_disabled) {
-			std::this_thread::sleep_for(std::chrono::seconds(1));
+	for (auto& server : _servers) {
+		if (!server->upload_enabled()) {
 			continue;
 		}
 
-		// Query the number of pending log uploads for both servers
-		uint32_t num_logs_local = _local_server->num_logs_to_upload();
-		uint32_t num_logs_remote = _remote_server->num_logs_to_upload();
+		UploadWorkerPool::Settings worker_settings = {
+			.max_concurrent_uploads = server->max_concurrent_uploads(),
+			.queue_depth = server->max_concurrent_uploads() * 2,
+		};
 
-		// Process uploads for local server
-		if (!_should_exit && !_settings.local_server.empty() && num_logs_local) {
-			LOG_DEBUG("Uploading " << num_logs_local << " logs to LOCAL server");
-			upload_pending_logs(_local_server);
-		}
-
-		// Process uploads for remote server
-		if (!_should_exit && !_settings.remote_server.empty() && _settings.upload_enabled && num_logs_remote) {
-			LOG_DEBUG("Uploading " << num_logs_remote << " logs to REMOTE server");
-			upload_pending_logs(_remote_server);
-		}
+		LOG_DEBUG("Starting " << worker_settings.max_concurrent_uploads << " upload workers for " << server->name());
 
-		if (!_should_exit) {
-			std::unique_lock<std::mutex> lock(_exit_cv_mutex);
-			_exit_cv.wait_for(lock, std::chrono::seconds(10), [this] { return _should_exit.load(); });
-		}
+		auto workers = std::make_unique<UploadWorkerPool>(server, _database, worker_settings);
+		workers->start();
+		_upload_workers.push_back(std::move(workers));
 	}
-
-	LOG_DEBUG("upload_logs_thread exiting");
 }
 
-void LogLoader::upload_pending_logs(std::shared_ptr<ServerInterface> server)
+void LogLoader::handoff_to_upload_workers(const Database::LogEntry& entry)
 {
-	// Upload all pending logs for this server
-	while (!_should_exit && server->num_logs_to_upload()) {
-
-		// Get one log at a time to upload
-		ServerInterface::DatabaseEntry log_entry = server->get_next_log_to_upload();
-
-		if (log_entry.uuid.empty()) {
-			LOG("Log with empty uuid!");
-			return;
-		}
-
-		std::string filepath = server->filepath_from_uuid(log_entry.uuid);
-
-		if (filepath.empty()) {
-			LOG("Could not determine file path for UUID: " << log_entry.uuid);
-			return;
-		}
-
-		ServerInterface::UploadResult result = server->upload_log(filepath);
-
-		if (result.success) {
-			LOG("Log upload SUCCESS: " << result.message);
+	// The database row is only needed again if the process restarts before the upload
+	for (auto& workers : _upload_workers) {
+		workers->enqueue(entry);
+	}
+}
 
-		} else if (result.status_code == 400) {
-			LOG("Log upload failed (" << result.status_code << "): " << result.message);
+void LogLoader::stop_upload_workers()
+{
+	// Abort uploads in progress
+	for (auto& server : _servers) {
+		server->stop();
+	}
 
-		} else {
-			LOG("Log upload TEMPORARILY FAILED (" << result.status_code << "): "
-			    << result.message << " - Will retry later");
-		}
+	for (auto& workers : _upload_workers) {
+		workers->stop();
 	}
+
+	_upload_workers.clear();
 }
@@ -6,7 +6,14 @@
 #include <mavsdk/log_callback.h>
 #include <condition_variable>
 
+#include "Database.hpp"
+#include "LogArchive.hpp"
+#include "LogIndexer.hpp"
 #include "ServerInterface.hpp"
+#include "MetricsServer.hpp"
+#include "RetentionManager.hpp"
+#include "UploadWorkerPool.hpp"
+#include "Vehicle.hpp"
 
 class LogLoader
 {
@@ -19,6 +26,18 @@ public:
 		std::string application_directory;
 		bool upload_enabled;
 		bool public_logs;
+		uint32_t max_concurrent_uploads;
+		bool compress_logs;
+		int compression_level;
+		uint16_t metrics_port;     // Serve Prometheus metrics on 127.0.0.1, 0 to disable
+		DownloadScheduler::Settings download_scheduler;
+		LogDownloader::Settings log_downloader;
+		Backoff::Settings upload_retry;            // Applied to every backend
+		CircuitBreaker::Settings circuit_breaker;  // Applied to every backend
+		std::chrono::seconds health_check_interval;
+		std::chrono::seconds health_retry_interval;
+		RetentionManager::Settings retention;      // The logs directory is filled in by LogLoader
+		std::vector<ServerInterface::Settings> backends; // Additional backends besides local and remote
 	};
 
 	LogLoader(const Settings& settings);
@@ -28,32 +47,55 @@ public:
 	bool wait_for_mavsdk_connection(double timeout_ms);
 
 private:
-	// Download
-	bool request_log_entries();
-	void download_next_log();
-	bool download_log(const mavsdk::LogFiles::Entry& entry);
+	// Vehicles
+	void add_new_vehicles();
+	void update_upload_state();
+	void update_queue_metrics();
+	void update_retention();
+
+	// Backends
+	void add_backend(ServerInterface::Settings settings);
 
 	// Upload
-	void upload_logs_thread();
-	void upload_pending_logs(std::shared_ptr<ServerInterface> server);
+	void start_upload_workers();
+	void stop_upload_workers();
+	void handoff_to_upload_workers(const Database::LogEntry& entry);
 
 	Settings _settings;
 	std::string _logs_directory;
 
-	// Server objects (each with its own database)
-	std::shared_ptr<ServerInterface> _local_server;
-	std::shared_ptr<ServerInterface> _remote_server;
+	// State database shared by all backends
+	std::shared_ptr<Database> _database;
+
+	// Compresses logs after download when enabled, shared by all vehicles
+	std::shared_ptr<LogArchive> _log_archive;
+
+	// Reads the metadata of downloaded logs into the flight catalog
+	std::unique_ptr<LogIndexer> _log_indexer;
+
+	// One server object per upload backend
+	std::vector<std::shared_ptr<ServerInterface>> _servers;
+
+	// Independent upload workers for each enabled backend
+	std::vector<std::unique_ptr<UploadWorkerPool>> _upload_workers;
+
+	// Deletes old logs when the disk or quota fills up
+	std::unique_ptr<RetentionManager> _retention;
+	std::chrono::steady_clock::time_point _retention_time {};
+
+	// Optional Prometheus endpoint
+	std::unique_ptr<MetricsServer> _metrics_server;
 
 	std::shared_ptr<mavsdk::Mavsdk> _mavsdk;
-	std::shared_ptr<mavsdk::Telemetry> _telemetry;
-	std::shared_ptr<mavsdk::LogFiles> _log_files;
-	std::vector<mavsdk::LogFiles::Entry> _log_entries;
+
+	// One download worker per autopilot found on the connection, only touched by run()
+	std::vector<std::unique_ptr<Vehicle>> _vehicles;
 
 	std::atomic<bool> _should_exit = false;
-	std::atomic<bool> _download_cancelled = false;
 
 	std::condition_variable _exit_cv;
 	std::mutex _exit_cv_mutex;
+	bool _vehicle_state_changed = false; // Set by the vehicles' state callbacks, guarded by _exit_cv_mutex
 
-	bool _loop_disabled = false;
+	bool _uploads_paused = false;
 };
@@ -0,0 +1,245 @@
+#include "Metrics.hpp"
+
+#include <cstdio>
+
+// Bucket bounds in seconds
+static constexpr std::initializer_list<double> TRANSFER_BUCKETS = {1, 5, 10, 30, 60, 120, 300, 600, 1800, 3600};
+static constexpr std::initializer_list<double> LIST_BUCKETS = {0.1, 0.5, 1, 2, 5, 10, 30, 60, 120};
+static constexpr std::initializer_list<double> PREEMPTION_BUCKETS = {0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1};
+static constexpr std::initializer_list<double> QUERY_BUCKETS = {0.00001, 0.00005, 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1};
+
+static std::string format_number(double value);
+static std::string escape_label(const std::string& value);
+static void render_header(std::string& out, const char* name, const char* type, const char* help);
+static void render_sample(std::string& out, const std::string& name, const std::string& labels, const std::string& value);
+
+Metrics::Histogram::Histogram(std::initializer_list<double> bounds)
+	: _bounds(bounds)
+	, _buckets(std::make_unique<std::atomic<uint64_t>[]>(bounds.size() + 1))
+{}
+
+void Metrics::Histogram::observe(double value)
+{
+	size_t bucket = 0;
+
+	while (bucket < _bounds.size() && value > _bounds[bucket]) {
+		bucket++;
+	}
+
+	_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	_count.fetch_add(1, std::memory_order_relaxed);
+	_sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+void Metrics::Histogram::render(std::string& out, const std::string& name, const std::string& labels) const
+{
+	std::string prefix = labels.empty() ? "" : labels + ",";
+	uint64_t cumulative = 0;
+
+	for (size_t i = 0; i <= _bounds.size(); i++) {
+		cumulative += _buckets[i].load(std::memory_order_relaxed);
+		std::string le = i < _bounds.size() ? format_number(_bounds[i]) : "+Inf";
+		render_sample(out, name + "_bucket", prefix + "le=\"" + le + "\"", std::to_string(cumulative));
+	}
+
+	render_sample(out, name + "_sum", labels, format_number(_sum.load(std::memory_order_relaxed)));
+	render_sample(out, name + "_count", labels, std::to_string(_count.load(std::memory_order_relaxed)));
+}
+
+Metrics::Backend::Backend()
+	: upload_seconds(TRANSFER_BUCKETS)
+{}
+
+Metrics::Counter& Metrics::Backend::upload_failure(int status_code)
+{
+	return upload_failures[status_code > 0 && size_t(status_code) < upload_failures.size() ? status_code : 0];
+}
+
+Metrics::Metrics()
+	: download_seconds(TRANSFER_BUCKETS)
+	, log_list_seconds(LIST_BUCKETS)
+	, preemption_seconds(PREEMPTION_BUCKETS)
+	, sqlite_query_seconds(QUERY_BUCKETS)
+{}
+
+Metrics& Metrics::instance()
+{
+	static Metrics metrics;
+	return metrics;
+}
+
+Metrics::Backend& Metrics::backend(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(_backends_mutex);
+
+	for (auto& backend : _backends) {
+		if (backend.name == name) {
+			return backend;
+		}
+	}
+
+	Backend& backend = _backends.emplace_back();
+	backend.name = name;
+	return backend;
+}
+
+std::string Metrics::render() const
+{
+	std::string out;
+	out.reserve(16 * 1024);
+
+	render_header(out, "logloader_vehicles", "gauge", "Autopilots found on the MAVLink connection");
+	render_sample(out, "logloader_vehicles", "", std::to_string(vehicles.value()));
+
+	render_header(out, "logloader_downloaded_bytes_total", "counter", "Log bytes received from the vehicles");
+	render_sample(out, "logloader_downloaded_bytes_total", "", std::to_string(downloaded_bytes.value()));
+
+	render_header(out, "logloader_downloads_total", "counter", "Logs downloaded completely");
+	render_sample(out, "logloader_downloads_total", "", std::to_string(downloads.value()));
+
+	render_header(out, "logloader_download_resent_bytes_total", "counter", "LOG_DATA bytes received again for chunks already downloaded");
+	render_sample(out, "logloader_download_resent_bytes_total", "", std::to_string(resent_bytes.value()));
+
+	render_header(out, "logloader_download_failures_total", "counter", "Downloads that timed out or could not be written");
+	render_sample(out, "logloader_download_failures_total", "", std::to_string(download_failures.value()));
+
+	render_header(out, "logloader_download_duration_seconds", "histogram", "Time to download one log");
+	download_seconds.render(out, "logloader_download_duration_seconds", "");
+
+	render_header(out, "logloader_log_list_duration_seconds", "histogram", "Time to refresh the log list from the vehicle");
+	log_list_seconds.render(out, "logloader_log_list_duration_seconds", "");
+
+	render_header(out, "logloader_download_preemption_seconds", "histogram", "Time from the vehicle arming to the download in progress stopping");
+	preemption_seconds.render(out, "logloader_download_preemption_seconds", "");
+
+	render_header(out, "logloader_pending_downloads", "gauge", "Logs waiting to be downloaded");
+	render_sample(out, "logloader_pending_downloads", "", std::to_string(pending_downloads.value()));
+
+	render_header(out, "logloader_sqlite_query_duration_seconds", "histogram", "Latency of the prepared database queries");
+	sqlite_query_seconds.render(out, "logloader_sqlite_query_duration_seconds", "");
+
+	render_header(out, "logloader_stored_bytes", "gauge", "Bytes of logs kept in the logs directory");
+	render_sample(out, "logloader_stored_bytes", "", std::to_string(stored_bytes.value()));
+
+	render_header(out, "logloader_evicted_logs_total", "counter", "Logs deleted by the retention manager");
+	render_sample(out, "logloader_evicted_logs_total", "", std::to_string(evicted_logs.value()));
+
+	render_header(out, "logloader_evicted_bytes_total", "counter", "Bytes freed by the retention manager");
+	render_sample(out, "logloader_evicted_bytes_total", "", std::to_string(evicted_bytes.value()));
+
+	render_header(out, "logloader_indexed_logs_total", "counter", "Logs added to the flight catalog");
+	render_sample(out, "logloader_indexed_logs_total", "", std::to_string(indexed_logs.value()));
+
+	render_header(out, "logloader_index_failures_total", "counter", "Logs that could not be parsed as ULog");
+	render_sample(out, "logloader_index_failures_total", "", std::to_string(index_failures.value()));
+
+	render_header(out, "logloader_duplicate_logs_total", "counter", "Downloaded logs whose content was already stored or uploaded");
+	render_sample(out, "logloader_duplicate_logs_total", "", std::to_string(duplicate_logs.value()));
+
+	render_header(out, "logloader_duplicate_bytes_skipped_total", "counter", "Log bytes not downloaded because the log was a duplicate");
+	render_sample(out, "logloader_duplicate_bytes_skipped_total", "", std::to_string(duplicate_bytes_skipped.value()));
+
+	render_header(out, "logloader_duplicate_uploads_skipped_total", "counter", "Uploads skipped because the backend has the same content");
+	render_sample(out, "logloader_duplicate_uploads_skipped_total", "", std::to_string(duplicate_uploads_skipped.value()));
+
+	std::lock_guard<std::mutex> lock(_backends_mutex);
+
+	auto render_backends = [&](const char* name, const char* type, const char* help, auto&& value) {
+		render_header(out, name, type, help);
+
+		for (const auto& backend : _backends) {
+			render_sample(out, name, "backend=\"" + escape_label(backend.name) + "\"", std::to_string(value(backend)));
+		}
+	};
+
+	render_backends("logloader_uploaded_bytes_total", "counter", "Log bytes sent to the backend",
+			[](const Backend& backend) { return backend.uploaded_bytes.value(); });
+	render_backends("logloader_uploads_total", "counter", "Logs uploaded successfully",
+			[](const Backend& backend) { return backend.uploads.value(); });
+	render_backends("logloader_pending_uploads", "gauge", "Logs waiting to be uploaded",
+			[](const Backend& backend) { return backend.pending_uploads.value(); });
+	render_backends("logloader_queued_uploads", "gauge", "Logs handed to the upload workers",
+			[](const Backend& backend) { return backend.queued_uploads.value(); });
+	render_backends("logloader_backend_up", "gauge", "1 if the last health check of the backend succeeded",
+			[](const Backend& backend) { return backend.up.value(); });
+	render_backends("logloader_backend_rtt_milliseconds", "gauge", "Round trip time of the last successful health check",
+			[](const Backend& backend) { return backend.rtt_ms.value(); });
+	render_backends("logloader_circuit_open", "gauge", "1 while uploads are held back because the backend is down",
+			[](const Backend& backend) { return backend.circuit_open.value(); });
+	render_backends("logloader_connections_opened_total", "counter", "Requests that required a new TCP/TLS handshake",
+			[](const Backend& backend) { return backend.connections_opened.value(); });
+	render_backends("logloader_connections_reused_total", "counter", "Requests served on an already open connection",
+			[](const Backend& backend) { return backend.connections_reused.value(); });
+
+	render_header(out, "logloader_upload_failures_total", "counter", "Failed uploads by HTTP status code, 0 without response");
+
+	for (const auto& backend : _backends) {
+		for (size_t code = 0; code < backend.upload_failures.size(); code++) {
+			uint64_t value = backend.upload_failures[code].value();
+
+			if (value > 0) {
+				render_sample(out, "logloader_upload_failures_total",
+					      "backend=\"" + escape_label(backend.name) + "\",code=\"" + std::to_string(code) + "\"", std::to_string(value));
+			}
+		}
+	}
+
+	render_header(out, "logloader_upload_duration_seconds", "histogram", "Time to upload one log");
+
+	for (const auto& backend : _backends) {
+		backend.upload_seconds.render(out, "logloader_upload_duration_seconds", "backend=\"" + escape_label(backend.name) + "\"");
+	}
+
+	return out;
+}
+
+static std::string format_number(double value)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%.9g", value);
+	return buffer;
+}
+
+static std::string escape_label(const std::string& value)
+{
+	std::string escaped;
+
+	for (char c : value) {
+		if (c == '\\' || c == '"') {
+			escaped += '\\';
+			escaped += c;
+
+		} else if (c == '\n') {
+			escaped += "\\n";
+
+		} else {
+			escaped += c;
+		}
+	}
+
+	return escaped;
+}
+
+static void render_header(std::string& out, const char* name, const char* type, const char* help)
+{
+	out += "# HELP ";
+	out += name;
+	out += " ";
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += " ";
+	out += type;
+	out += "\n";
+}
+
+static void render_sample(std::string& out, const std::string& name, const std::string& labels, const std::string& value)
+{
+	out += name;
+
+	if (!labels.empty()) {
+		out += "{" + labels + "}";
+	}
+
+	out += " " + value + "\n";
+}
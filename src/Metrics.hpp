@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Process wide counters, gauges and histograms, rendered in the Prometheus text format by
+// MetricsServer. Updating a metric is a single relaxed atomic operation so they stay enabled in
+// the download, upload and database hot paths. Only registering a new backend takes a lock.
+class Metrics
+{
+public:
+	class Counter
+	{
+	public:
+		void increment(uint64_t value = 1) { _value.fetch_add(value, std::memory_order_relaxed); }
+		uint64_t value() const { return _value.load(std::memory_order_relaxed); }
+
+	private:
+		std::atomic<uint64_t> _value {};
+	};
+
+	class Gauge
+	{
+	public:
+		void set(int64_t value) { _value.store(value, std::memory_order_relaxed); }
+		int64_t value() const { return _value.load(std::memory_order_relaxed); }
+
+	private:
+		std::atomic<int64_t> _value {};
+	};
+
+	class Histogram
+	{
+	public:
+		// Upper bounds of the buckets in ascending order, the +Inf bucket is implicit
+		Histogram(std::initializer_list<double> bounds);
+
+		void observe(double value);
+		void render(std::string& out, const std::string& name, const std::string& labels) const;
+
+	private:
+		std::vector<double> _bounds;
+		std::unique_ptr<std::atomic<uint64_t>[]> _buckets; // Not cumulative, summed up when rendering
+		std::atomic<uint64_t> _count {};
+		std::atomic<double> _sum {};
+	};
+
+	// Metrics of one upload backend
+	struct Backend {
+		std::string name;
+		Counter uploaded_bytes;
+		Counter uploads;                 // Successful uploads
+		Histogram upload_seconds;
+		Gauge pending_uploads;           // Logs waiting in the database
+		Gauge queued_uploads;            // Logs handed to the upload workers
+		Counter connections_opened;      // New TCP/TLS handshakes
+		Counter connections_reused;
+		Gauge circuit_open;              // Uploads are held back because the backend is down
+		Gauge up;                        // Last health check succeeded
+		Gauge rtt_ms;                    // Round trip of the last successful health check
+		std::array<Counter, 600> upload_failures; // By HTTP status code, 0 when there was no response
+
+		Backend();
+		Counter& upload_failure(int status_code);
+	};
+
+	static Metrics& instance();
+
+	// Registered on first use, the reference stays valid for the lifetime of the process
+	Backend& backend(const std::string& name);
+
+	std::string render() const;
+
+	// Vehicles, summed over all of them
+	Gauge vehicles;                      // Autopilots found on the MAVLink connection
+	Counter downloaded_bytes;
+	Counter resent_bytes;                // LOG_DATA of chunks that were already received
+	Counter downloads;                   // Logs downloaded completely
+	Counter download_failures;           // Downloads that timed out or failed, excluding cancellations
+	Histogram download_seconds;
+	Histogram log_list_seconds;
+	Histogram preemption_seconds;        // Time from arming to the download in progress stopping
+	Gauge pending_downloads;
+
+	// Database
+	Histogram sqlite_query_seconds;
+
+	// Retention
+	Gauge stored_bytes;                  // Logs kept in the logs directory
+	Counter evicted_logs;
+	Counter evicted_bytes;
+
+	// Flight catalog
+	Counter indexed_logs;                // Logs whose ULog metadata was stored
+	Counter index_failures;              // Logs that could not be read or are not ULog files
+
+	// Deduplication
+	Counter duplicate_logs;              // Logs whose content was already stored or uploaded
+	Counter duplicate_bytes_skipped;     // Bytes not downloaded because both ends matched a stored log
+	Counter duplicate_uploads_skipped;   // Uploads skipped because the backend has the same content
+
+private:
+	Metrics();
+
+	mutable std::mutex _backends_mutex;
+	std::deque<Backend> _backends; // Deque so references survive new registrations
+};
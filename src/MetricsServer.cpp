@@ -0,0 +1,49 @@
+#include "MetricsServer.hpp"
+#include "Metrics.hpp"
+#include "Log.hpp"
+
+#define CPPHTTPLIB_OPENSSL_SUPPORT
+#include <httplib.h>
+
+MetricsServer::MetricsServer(const MetricsServer::Settings& settings)
+	: _settings(settings)
+{}
+
+MetricsServer::~MetricsServer()
+{
+	stop();
+}
+
+bool MetricsServer::start()
+{
+	_server = std::make_unique<httplib::Server>();
+
+	_server->Get("/metrics", [](const httplib::Request&, httplib::Response& res) {
+		res.set_content(Metrics::instance().render(), "text/plain; version=0.0.4");
+	});
+
+	if (!_server->bind_to_port(_settings.host, _settings.port)) {
+		LOG("Could not serve metrics on " << _settings.host << ":" << _settings.port);
+		_server.reset();
+		return false;
+	}
+
+	_thread = std::thread([this] { _server->listen_after_bind(); });
+
+	LOG("Serving metrics at http://" << _settings.host << ":" << _settings.port << "/metrics");
+
+	return true;
+}
+
+void MetricsServer::stop()
+{
+	if (_server) {
+		_server->stop();
+	}
+
+	if (_thread.joinable()) {
+		_thread.join();
+	}
+
+	_server.reset();
+}
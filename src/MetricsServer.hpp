@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace httplib
+{
+class Server;
+}
+
+// Serves Metrics::render() at http://<host>:<port>/metrics for Prometheus to scrape
+class MetricsServer
+{
+public:
+	struct Settings {
+		std::string host {"127.0.0.1"};
+		uint16_t port {9464};
+	};
+
+	MetricsServer(const Settings& settings);
+	~MetricsServer();
+
+	bool start();
+	void stop();
+
+private:
+	Settings _settings;
+	std::unique_ptr<httplib::Server> _server;
+	std::thread _thread;
+};
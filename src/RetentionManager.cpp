@@ -0,0 +1,150 @@
+#include "RetentionManager.hpp"
+#include "Log.hpp"
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <iomanip>
+
+namespace fs = std::filesystem;
+
+// Logs fetched from the database per query while evicting
+static constexpr uint32_t EVICTION_BATCH = 32;
+
+RetentionManager::RetentionManager(std::shared_ptr<Database> database, const RetentionManager::Settings& settings)
+	: _database(std::move(database))
+	, _settings(settings)
+{
+	_settings.high_watermark = std::clamp(_settings.high_watermark, 0.0, 1.0);
+	_settings.low_watermark = std::clamp(_settings.low_watermark, 0.0, _settings.high_watermark);
+}
+
+uint64_t RetentionManager::run()
+{
+	std::unique_lock<std::mutex> lock(_mutex, std::try_to_lock);
+
+	if (!lock.owns_lock()) {
+		return 0;
+	}
+
+	uint64_t needed = bytes_to_free();
+
+	if (needed == 0) {
+		return 0;
+	}
+
+	uint64_t freed = evict(true, needed);
+
+	if (freed < needed && _settings.policy == Policy::Force) {
+		freed += evict(false, needed - freed);
+	}
+
+	if (freed < needed) {
+		LOG_WARNING("Logs directory above the retention watermark, " << std::fixed << std::setprecision(2)
+			    << (needed - freed) / 1e6 << " MB more could not be freed without deleting logs that are not uploaded yet");
+	}
+
+	Metrics::instance().stored_bytes.set(_database->stored_bytes());
+
+	return freed;
+}
+
+uint64_t RetentionManager::bytes_to_free()
+{
+	uint64_t stored = _database->stored_bytes();
+	Metrics::instance().stored_bytes.set(stored);
+
+	uint64_t needed = 0;
+
+	if (_settings.quota_bytes && stored > _settings.high_watermark * _settings.quota_bytes) {
+		needed = stored - uint64_t(_settings.low_watermark * _settings.quota_bytes);
+	}
+
+	// Everything else on the file system counts as well, only logs can be freed
+	std::error_code ec;
+	fs::space_info space = fs::space(_settings.logs_directory, ec);
+
+	if (!ec && space.capacity > 0) {
+		uint64_t used = space.capacity - space.available;
+
+		if (used > _settings.high_watermark * space.capacity) {
+			needed = std::max(needed, used - uint64_t(_settings.low_watermark * space.capacity));
+		}
+	}
+
+	return needed;
+}
+
+uint64_t RetentionManager::evict(bool uploaded_only, uint64_t bytes)
+{
+	uint64_t freed = 0;
+	uint32_t evicted = 0;
+
+	while (freed < bytes) {
+		auto entries = _database->get_logs_to_evict(uploaded_only, EVICTION_BATCH);
+
+		if (entries.empty()) {
+			break;
+		}
+
+		for (const auto& entry : entries) {
+			std::string path = _database->filepath_from_uuid(entry.uuid);
+			std::error_code ec;
+
+			// Already gone counts as evicted, anything else is retried on the next run
+			if (!path.empty() && !fs::remove(path, ec) && ec) {
+				LOG_ERROR("Could not delete " << path << ": " << ec.message());
+				return freed;
+			}
+
+			if (!_database->set_evicted(entry.uuid)) {
+				return freed;
+			}
+
+			uint64_t size = entry.compressed_size ? entry.compressed_size : entry.size_bytes;
+			freed += size;
+			evicted++;
+
+			Metrics::instance().evicted_logs.increment();
+			Metrics::instance().evicted_bytes.increment(size);
+
+			LOG_DEBUG("Evicted " << fs::path(path).filename().string() << (uploaded_only ? "" : " before it was uploaded"));
+
+			if (freed >= bytes) {
+				break;
+			}
+		}
+	}
+
+	if (evicted) {
+		LOG("Deleted " << evicted << (uploaded_only ? " uploaded" : " not uploaded") << " logs to free "
+		    << std::fixed << std::setprecision(2) << freed / 1e6 << " MB");
+	}
+
+	return freed;
+}
+
+bool RetentionManager::parse_policy(const std::string& name, Policy& policy)
+{
+	for (Policy candidate : {Policy::Uploaded, Policy::Force}) {
+		if (name == policy_name(candidate)) {
+			policy = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const char* RetentionManager::policy_name(Policy policy)
+{
+	switch (policy) {
+	case Policy::Uploaded:
+		return "uploaded";
+
+	case Policy::Force:
+		return "force";
+	}
+
+	return "uploaded";
+}
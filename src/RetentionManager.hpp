@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "Database.hpp"
+
+// Keeps the logs directory from filling the disk. Once the stored logs exceed the high watermark
+// of the quota, or the file system holding them is fuller than the high watermark, the oldest logs
+// are deleted until usage is back under the low watermark. Sizes come from the database so the
+// directory is never scanned, the file system usage is a single statvfs.
+class RetentionManager
+{
+public:
+	enum class Policy {
+		Uploaded, // Only logs that every enabled backend has, un-uploaded logs are never deleted
+		Force     // Logs that were not uploaded yet as well, once no uploaded ones are left
+	};
+
+	struct Settings {
+		std::string logs_directory;
+		uint64_t quota_bytes {};      // Bytes of stored logs, 0 to only watch the file system
+		double high_watermark {0.9};  // Fraction of the quota or file system at which eviction starts
+		double low_watermark {0.8};   // Fraction eviction goes down to
+		Policy policy {Policy::Uploaded};
+	};
+
+	RetentionManager(std::shared_ptr<Database> database, const Settings& settings);
+
+	// Evicts logs if usage is above the high watermark, returns the number of bytes freed. Cheap
+	// when there is nothing to do, a call while another one is running returns right away.
+	uint64_t run();
+
+	static bool parse_policy(const std::string& name, Policy& policy);
+	static const char* policy_name(Policy policy);
+
+private:
+	uint64_t bytes_to_free();
+	uint64_t evict(bool uploaded_only, uint64_t bytes);
+
+	std::shared_ptr<Database> _database;
+	Settings _settings;
+	std::mutex _mutex;
+};
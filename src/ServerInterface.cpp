@@ -1,34 +1,52 @@
 #include "ServerInterface.hpp"
 #include "Log.hpp"
+#include "LogArchive.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <charconv>
 #include <iostream>
 #include <filesystem>
-#include <fstream>
-#include <chrono>
-#include <ctime>
-#include <iomanip>
-#include <sstream>
-#include <functional>
+#include <random>
 #define CPPHTTPLIB_OPENSSL_SUPPORT
 #include <httplib.h>
 
 namespace fs = std::filesystem;
 
-ServerInterface::ServerInterface(const ServerInterface::Settings& settings)
+// Size of the file chunks read from disk and handed to httplib while uploading
+static constexpr size_t UPLOAD_CHUNK_SIZE = 64 * 1024;
+
+static std::string generate_multipart_boundary();
+
+ServerInterface::ServerInterface(const ServerInterface::Settings& settings, std::shared_ptr<Database> database)
 	: _settings(settings)
+	, _database(database)
+	, _metrics(Metrics::instance().backend(settings.name))
+	, _retry_backoff(settings.retry)
+	, _circuit_breaker(settings.circuit_breaker)
 {
 	// Sanitize the URL to strip off the prefix
 	sanitize_url_and_determine_protocol();
 
-	// Initialize the database
-	if (!init_database()) {
-		std::cerr << "Failed to initialize database for server: " << _settings.server_url << std::endl;
-	}
-}
+	// Keep-alive connections shared by the health checks and the uploads
+	ConnectionPool::Settings pool_settings = {
+		.host = _settings.server_url,
+		.name = _settings.name,
+		.https = _protocol == Protocol::Https,
+		.max_idle = std::max<size_t>(_settings.max_concurrent_uploads, 2),
+	};
 
-ServerInterface::~ServerInterface()
-{
-	close_database();
+	_connection_pool = std::make_unique<ConnectionPool>(pool_settings);
+
+	HealthMonitor::Settings health_settings = {
+		.name = _settings.name,
+		.interval = _settings.health_check_interval,
+		.retry_interval = _settings.health_retry_interval,
+	};
+
+	_health_monitor = std::make_unique<HealthMonitor>(*_connection_pool, health_settings);
+
+	_database->register_backend(_settings.name, _settings.upload_enabled);
 }
 
 void ServerInterface::sanitize_url_and_determine_protocol()
@@ -69,189 +87,58 @@ void ServerInterface::stop()
 	_should_exit = true;
 }
 
-std::string ServerInterface::generate_uuid(const mavsdk::LogFiles::Entry& entry)
-{
-	// Create a unique identifier based on date and size
-	std::stringstream ss;
-	ss << entry.date << "_" << entry.size_bytes;
-
-	// Use a simple hash for the UUID
-	std::hash<std::string> hasher;
-	size_t hash = hasher(ss.str());
-
-	ss.str("");
-	ss << std::hex << std::setw(16) << std::setfill('0') << hash;
-	return ss.str();
-}
-
-bool ServerInterface::add_log_entry(const mavsdk::LogFiles::Entry& entry)
-{
-	std::string uuid = generate_uuid(entry);
-
-	// Check if the log already exists
-	sqlite3_stmt* stmt;
-	std::string check_query = "SELECT COUNT(*) FROM logs WHERE uuid = ?";
-
-	if (sqlite3_prepare_v2(_db, check_query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		std::cerr << "SQL error preparing add_log_entry check: " << sqlite3_errmsg(_db) << std::endl;
-		return false;
-	}
-
-	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
-
-	bool exists = false;
-
-	if (sqlite3_step(stmt) == SQLITE_ROW) {
-		exists = sqlite3_column_int(stmt, 0) > 0;
-	}
-
-	sqlite3_finalize(stmt);
-
-	if (exists) {
-		return true; // Already exists, no need to add
-	}
-
-	// Insert the log
-	std::string insert_query =
-		"INSERT INTO logs (uuid, id, date, size_bytes, downloaded, uploaded) "
-		"VALUES (?, ?, ?, ?, 0, 0)";
-
-	if (sqlite3_prepare_v2(_db, insert_query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		std::cerr << "SQL error preparing add_log_entry insert: " << sqlite3_errmsg(_db) << std::endl;
-		return false;
-	}
-
-	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
-	sqlite3_bind_int(stmt, 2, entry.id);
-	sqlite3_bind_text(stmt, 3, entry.date.c_str(), -1, SQLITE_STATIC);
-	sqlite3_bind_int(stmt, 4, entry.size_bytes);
-
-	bool success = sqlite3_step(stmt) == SQLITE_DONE;
-	sqlite3_finalize(stmt);
-
-	return success;
-}
-
-bool ServerInterface::update_download_status(const std::string& uuid, bool downloaded)
-{
-	std::string query = "UPDATE logs SET downloaded = ? WHERE uuid = ?";
-	sqlite3_stmt* stmt;
-
-	if (sqlite3_prepare_v2(_db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		std::cerr << "SQL error preparing update_download_status: " << sqlite3_errmsg(_db) << std::endl;
-		return false;
-	}
-
-	sqlite3_bind_int(stmt, 1, downloaded ? 1 : 0);
-	sqlite3_bind_text(stmt, 2, uuid.c_str(), -1, SQLITE_STATIC);
-
-	bool success = sqlite3_step(stmt) == SQLITE_DONE;
-	sqlite3_finalize(stmt);
-
-	return success;
-}
-
 uint32_t ServerInterface::num_logs_to_upload()
 {
 	if (!_settings.upload_enabled || _should_exit) {
 		return false;
 	}
 
-	sqlite3_stmt* stmt;
-	std::string query =
-		"SELECT COUNT(*) FROM logs "
-		"WHERE downloaded = 1 AND uploaded = 0 "
-		"AND uuid NOT IN (SELECT uuid FROM blacklist)";
-
-	if (sqlite3_prepare_v2(_db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		std::cerr << "SQL error preparing has_logs_to_upload: " << sqlite3_errmsg(_db) << std::endl;
-		return false;
-	}
-
-	uint32_t log_count = 0;
-
-	if (sqlite3_step(stmt) == SQLITE_ROW) {
-		log_count = sqlite3_column_int(stmt, 0);
-	}
-
-	sqlite3_finalize(stmt);
-	return log_count;
+	uint32_t num_logs = _database->num_logs_to_upload(_settings.name);
+	_metrics.pending_uploads.set(num_logs);
+	return num_logs;
 }
 
-ServerInterface::DatabaseEntry ServerInterface::get_next_log_to_upload()
+Database::LogEntry ServerInterface::get_next_log_to_upload()
 {
-	DatabaseEntry empty_entry;
-	empty_entry.uuid = ""; // Empty UUID indicates not found
-
 	if (!_settings.upload_enabled || _should_exit) {
+		Database::LogEntry empty_entry;
+		empty_entry.uuid = ""; // Empty UUID indicates not found
 		return empty_entry;
 	}
 
-	sqlite3_stmt* stmt;
-	std::string query =
-		"SELECT uuid, id, date, size_bytes, downloaded, uploaded FROM logs "
-		"WHERE downloaded = 1 AND uploaded = 0 "
-		"AND uuid NOT IN (SELECT uuid FROM blacklist) "
-		"ORDER BY date DESC, size_bytes DESC LIMIT 1";
-
-	if (sqlite3_prepare_v2(_db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		std::cerr << "SQL error preparing get_next_log_to_upload: " << sqlite3_errmsg(_db) << std::endl;
-		return empty_entry;
-	}
-
-	DatabaseEntry entry = empty_entry;
+	return _database->get_next_log_to_upload(_settings.name);
+}
 
-	if (sqlite3_step(stmt) == SQLITE_ROW) {
-		entry = row_to_db_entry(stmt);
+std::vector<Database::LogEntry> ServerInterface::get_logs_to_upload(uint32_t limit)
+{
+	if (!_settings.upload_enabled || _should_exit) {
+		return {};
 	}
 
-	sqlite3_finalize(stmt);
-	return entry;
+	return _database->get_logs_to_upload(_settings.name, limit);
 }
 
 ServerInterface::UploadResult ServerInterface::upload_log(const std::string& filepath)
 {
 	if (!_settings.upload_enabled || _should_exit) {
-		return {false, 0, "Upload disabled or shutting down"};
+		// Paused while armed or stopping, the log is not at fault and is held back like for a down backend
+		return {false, 0, "Upload disabled, paused or shutting down", true};
 	}
 
 	// Extract UUID from filename
-	std::string filename = fs::path(filepath).filename().string();
+	mavsdk::LogFiles::Entry entry;
 	std::string uuid;
 
-	// Parse the ID and date from filename (assuming format like LOG0001_2023-04-15T12:34:56Z.ulg)
-	size_t underscore_pos = filename.find('_');
-	size_t dot_pos = filename.find_last_of('.');
-
-	if (underscore_pos != std::string::npos && dot_pos != std::string::npos) {
-		std::string id_part = filename.substr(3, underscore_pos - 3); // Skip "LOG" prefix
-		std::string date_part = filename.substr(underscore_pos + 1, dot_pos - underscore_pos - 1);
+	if (parse_log_filename(filepath, entry)) {
+		entry.size_bytes = fs::exists(filepath) ? LogArchive::raw_size(filepath) : 0;
 
-		uint32_t id = std::stoi(id_part);
-		uint32_t size = fs::exists(filepath) ? fs::file_size(filepath) : 0;
-
-		// Create a log entry and generate UUID
-		mavsdk::LogFiles::Entry entry;
-		entry.id = id;
-		entry.date = date_part;
-		entry.size_bytes = size;
-
-		uuid = generate_uuid(entry);
+		uint8_t vehicle_id = Database::vehicle_from_filepath(filepath);
+		uuid = Database::generate_uuid(entry, vehicle_id);
 
 		// Add to database if not already there
-		sqlite3_stmt* stmt;
-		std::string check_query = "SELECT COUNT(*) FROM logs WHERE uuid = ?";
-
-		if (sqlite3_prepare_v2(_db, check_query.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
-			sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
-
-			if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) == 0) {
-				// Log doesn't exist, add it
-				add_log_entry(entry);
-				update_download_status(uuid, true); // Mark as downloaded since we have the file
-			}
-
-			sqlite3_finalize(stmt);
+		if (!_database->log_exists(uuid)) {
+			_database->add_log_entry(entry, vehicle_id);
+			_database->update_download_status(uuid, true); // Mark as downloaded since we have the file
 		}
 	}
 
@@ -264,135 +151,95 @@ ServerInterface::UploadResult ServerInterface::upload_log(const std::string& fil
 		return {false, 400, "Log is blacklisted"};
 	}
 
+	// The same content may have been uploaded under another UUID, e.g. before an SD card swap
+	std::string duplicate_of = _database->uploaded_duplicate(_settings.name, uuid);
+
+	if (!duplicate_of.empty()) {
+		_database->set_upload_state(_settings.name, uuid, Database::UploadState::Uploaded, "Duplicate of " + duplicate_of);
+		Metrics::instance().duplicate_uploads_skipped.increment();
+		return {true, 0, "Duplicate of " + duplicate_of + ", already uploaded"};
+	}
+
+	if (!_circuit_breaker.available()) {
+		return {false, 0, "Circuit open, " + _settings.server_url + " is down", true};
+	}
+
 	// Perform the upload
+	auto start = std::chrono::steady_clock::now();
 	UploadResult result = upload(filepath);
 
-	// Update database with result
 	if (result.success) {
-		std::string query = "UPDATE logs SET uploaded = 1 WHERE uuid = ?";
-		sqlite3_stmt* stmt;
+		std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+		_metrics.uploads.increment();
+		_metrics.upload_seconds.observe(duration.count());
 
-		if (sqlite3_prepare_v2(_db, query.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
-			sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
-			sqlite3_step(stmt);
-			sqlite3_finalize(stmt);
-		}
+	} else {
+		_metrics.upload_failure(result.status_code).increment();
+	}
+
+	// Update database with result
+	if (result.success) {
+		_database->set_upload_state(_settings.name, uuid, Database::UploadState::Uploaded, result.message);
 
 	} else if (result.status_code == 400) {
 		// Permanent failure - add to blacklist
-		add_to_blacklist(uuid, "HTTP 400: Bad Request");
-	}
-
-	return result;
-}
+		_database->set_upload_state(_settings.name, uuid, Database::UploadState::Rejected, "HTTP 400: Bad Request");
 
-bool ServerInterface::is_blacklisted(const std::string& uuid)
-{
-	std::string query = "SELECT COUNT(*) FROM blacklist WHERE uuid = ?";
-	sqlite3_stmt* stmt;
+	} else if (result.backend_down || _should_exit) {
+		// Not the fault of the log, it stays due and is uploaded once the backend is back or uploads resume
 
-	if (sqlite3_prepare_v2(_db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		std::cerr << "SQL error preparing is_blacklisted: " << sqlite3_errmsg(_db) << std::endl;
-		return false;
+	} else {
+		retry_later(uuid, result.message);
 	}
 
-	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
-
-	bool blacklisted = false;
-
-	if (sqlite3_step(stmt) == SQLITE_ROW) {
-		blacklisted = sqlite3_column_int(stmt, 0) > 0;
-	}
+	_metrics.pending_uploads.set(_database->num_logs_to_upload(_settings.name));
 
-	sqlite3_finalize(stmt);
-	return blacklisted;
+	return result;
 }
 
-uint32_t ServerInterface::num_logs_to_download()
+void ServerInterface::retry_later(const std::string& uuid, const std::string& message)
 {
-	sqlite3_stmt* stmt;
-	std::string query =
-		"SELECT COUNT(*) FROM logs "
-		"WHERE downloaded = 0";
-
-	if (sqlite3_prepare_v2(_db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		std::cerr << "SQL error preparing num_logs_to_download: " << sqlite3_errmsg(_db) << std::endl;
-		return 0;
-	}
+	_database->set_upload_state(_settings.name, uuid, Database::UploadState::Pending, message);
 
-	uint32_t log_count = 0;
+	uint32_t attempts = _database->upload_attempts(_settings.name, uuid);
+	auto delay = _retry_backoff.delay(attempts);
 
-	if (sqlite3_step(stmt) == SQLITE_ROW) {
-		log_count = sqlite3_column_int(stmt, 0);
-	}
+	_database->set_upload_retry(_settings.name, uuid, std::chrono::system_clock::now() + delay);
 
-	sqlite3_finalize(stmt);
-	return log_count;
+	LOG_DEBUG(_settings.name << ": retrying " << uuid << " in " << std::chrono::duration_cast<std::chrono::seconds>(delay).count()
+		  << " seconds after " << attempts << " attempts");
 }
 
-ServerInterface::DatabaseEntry ServerInterface::get_next_log_to_download()
+bool ServerInterface::parse_log_filename(const std::string& filepath, mavsdk::LogFiles::Entry& entry)
 {
-	DatabaseEntry empty_entry;
-	empty_entry.uuid = ""; // Empty UUID indicates not found
+	// Archived logs carry an extra .zst extension
+	std::string filename = fs::path(LogArchive::raw_path(filepath)).filename().string();
 
-	sqlite3_stmt* stmt;
-	std::string query =
-		"SELECT uuid, id, date, size_bytes, downloaded, uploaded "
-		"FROM logs WHERE downloaded = 0 "
-		"ORDER BY date DESC, size_bytes DESC LIMIT 1";
+	// Parse the ID and date from filename (assuming format like LOG0001_2023-04-15T12:34:56Z.ulg)
+	size_t underscore_pos = filename.find('_');
+	size_t dot_pos = filename.find_last_of('.');
 
-	if (sqlite3_prepare_v2(_db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		std::cerr << "SQL error preparing get_next_log_to_download: " << sqlite3_errmsg(_db) << std::endl;
-		return empty_entry;
+	if (filename.compare(0, 3, "LOG") != 0 || underscore_pos == std::string::npos || dot_pos == std::string::npos
+	    || dot_pos < underscore_pos) {
+		return false;
 	}
 
-	DatabaseEntry entry = empty_entry;
+	uint32_t id = 0;
+	auto [ptr, ec] = std::from_chars(filename.data() + 3, filename.data() + underscore_pos, id); // Skip "LOG" prefix
 
-	if (sqlite3_step(stmt) == SQLITE_ROW) {
-		entry = row_to_db_entry(stmt);
+	if (ec != std::errc() || ptr != filename.data() + underscore_pos) {
+		return false;
 	}
 
-	sqlite3_finalize(stmt);
-	return entry;
-}
+	entry.id = id;
+	entry.date = filename.substr(underscore_pos + 1, dot_pos - underscore_pos - 1);
 
-std::string ServerInterface::filepath_from_entry(const mavsdk::LogFiles::Entry& entry) const
-{
-	std::ostringstream ss;
-	ss << _settings.logs_directory << "LOG" << std::setfill('0') << std::setw(4) << entry.id << "_" << entry.date << ".ulg";
-	return ss.str();
+	return true;
 }
 
-std::string ServerInterface::filepath_from_uuid(const std::string& uuid) const
+bool ServerInterface::is_blacklisted(const std::string& uuid)
 {
-	// Look up the log entry by UUID
-	sqlite3_stmt* stmt;
-	std::string query =
-		"SELECT id, date FROM logs WHERE uuid = ?";
-
-	if (sqlite3_prepare_v2(_db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		std::cerr << "SQL error preparing filepath_from_uuid: " << sqlite3_errmsg(_db) << std::endl;
-		return "";
-	}
-
-	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
-
-	std::string filepath;
-
-	if (sqlite3_step(stmt) == SQLITE_ROW) {
-		int id = sqlite3_column_int(stmt, 0);
-		const unsigned char* date_text = sqlite3_column_text(stmt, 1);
-
-		if (date_text != nullptr) {
-			std::string date = reinterpret_cast<const char*>(date_text);
-			std::ostringstream ss;
-			ss << _settings.logs_directory << "LOG" << std::setfill('0') << std::setw(4) << id << "_" << date << ".ulg";
-			filepath = ss.str();
-		}
-	}
-
-	sqlite3_finalize(stmt);
-	return filepath;
+	return _database->is_blacklisted(_settings.name, uuid);
 }
 
 ServerInterface::UploadResult ServerInterface::upload(const std::string& filepath)
@@ -412,189 +259,164 @@ ServerInterface::UploadResult ServerInterface::upload(const std::string& filepat
 		return {false, 0, "Skipping zero-size log file: " + filepath};
 	}
 
-	if (!server_reachable()) {
-		return {false, 0, "Server unreachable: " + _settings.server_url};
+	// Reachability comes from the health monitor, uploads wait for it to see the backend again
+	if (!_health_monitor->up()) {
+		return {false, 0, "Server unreachable: " + _settings.server_url, true};
 	}
 
-	std::ifstream file(filepath, std::ios::binary);
+	// Only a single upload goes out while the circuit is half open
+	if (!_circuit_breaker.allow()) {
+		return {false, 0, "Circuit open, " + _settings.server_url + " is down", true};
+	}
+
+	// Archived logs are sent as they are to backends that accept them, otherwise decompressed while uploading
+	bool send_compressed = _settings.accepts_compressed && LogArchive::is_compressed(filepath);
+	LogArchive::Reader file;
 
-	if (!file) {
+	if (!file.open(filepath, !send_compressed)) {
+		_circuit_breaker.release();
 		return {false, 0, "Could not open file: " + filepath};
 	}
 
+	std::string upload_filename = send_compressed ? filepath : LogArchive::raw_path(filepath);
+
 	// Build multi-part form data
-	httplib::MultipartFormDataItems items = {
-		{"type", _settings.public_logs ? "flightreport" : "personal", "", ""}, // NOTE: backend logic is funky
-		{"description", "Uploaded by logloader", "", ""},
-		{"feedback", "", "", ""},
-		{"email", _settings.user_email, "", ""},
-		{"source", "auto", "", ""},
-		{"videoUrl", "", "", ""},
-		{"rating", "", "", ""},
-		{"windSpeed", "", "", ""},
-		{"public", _settings.public_logs ? "true" : "false", "", ""},
+	std::vector<std::pair<std::string, std::string>> fields = {
+		{"type", _settings.public_logs ? "flightreport" : "personal"}, // NOTE: backend logic is funky
+		{"description", "Uploaded by logloader"},
+		{"feedback", ""},
+		{"email", _settings.user_email},
+		{"source", "auto"},
+		{"videoUrl", ""},
+		{"rating", ""},
+		{"windSpeed", ""},
+		{"public", _settings.public_logs ? "true" : "false"},
 	};
 
-	std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-	items.push_back({"filearg", content, filepath, "application/octet-stream"});
+	// Only the form fields and part headers are held in memory, the log itself is streamed from disk
+	// in fixed size chunks so memory usage does not depend on the size of the log.
+	std::string boundary = generate_multipart_boundary();
+	std::string preamble;
 
-	LOG("Uploading " << fs::path(filepath).filename().string() << " to " << _settings.server_url);
+	for (const auto& [name, value] : fields) {
+		preamble += "--" + boundary + "\r\n";
+		preamble += "Content-Disposition: form-data; name=\"" + name + "\"\r\n\r\n";
+		preamble += value + "\r\n";
+	}
 
-	// Post multi-part form
-	httplib::Result res;
+	preamble += "--" + boundary + "\r\n";
+	preamble += "Content-Disposition: form-data; name=\"filearg\"; filename=\"" + upload_filename + "\"\r\n";
+	preamble += std::string("Content-Type: ") + (send_compressed ? "application/zstd" : "application/octet-stream") + "\r\n\r\n";
 
-	if (_protocol == Protocol::Https) {
-		httplib::SSLClient cli(_settings.server_url);
-		res = cli.Post("/upload", items);
+	std::string epilogue = "\r\n--" + boundary + "--\r\n";
 
-	} else {
-		httplib::Client cli(_settings.server_url);
-		res = cli.Post("/upload", items);
-	}
+	uint64_t file_size = file.size();
+	size_t content_length = preamble.size() + file_size + epilogue.size();
+	std::vector<char> buffer(UPLOAD_CHUNK_SIZE);
+	bool read_error = false;
 
-	if (res && res->status == 302) {
-		return {true, 302, "Success: " + _settings.server_url + res->get_header_value("Location")};
+	auto content_provider = [&](size_t offset, size_t length, httplib::DataSink& sink) {
+		// Abort the transfer when uploads are stopped
+		if (_should_exit) {
+			return false;
+		}
 
-	} else if (res && res->status == 400) {
-		return {false, 400, "Bad Request - Will not retry"};
+		if (offset < preamble.size()) {
+			sink.write(preamble.data() + offset, std::min(length, preamble.size() - offset));
+			return true;
+		}
 
-	} else {
-		return {false, res ? res->status : 0, "Will retry later"};
-	}
-}
+		uint64_t file_offset = offset - preamble.size();
 
-bool ServerInterface::server_reachable()
-{
-	httplib::Result res;
+		if (file_offset < file_size) {
+			size_t chunk_size = std::min<uint64_t>({length, UPLOAD_CHUNK_SIZE, file_size - file_offset});
 
-	if (_protocol == Protocol::Https) {
-		httplib::SSLClient cli(_settings.server_url);
-		res = cli.Get("/");
+			// Compressed logs can only be read front to back, httplib asks for the data in order
+			if (file_offset != file.position() || file.read(buffer.data(), chunk_size) != chunk_size) {
+				LOG("Error reading " << filepath << " at offset " << file_offset);
+				read_error = true;
+				return false;
+			}
 
-	} else {
-		httplib::Client cli(_settings.server_url);
-		res = cli.Get("/");
-	}
+			sink.write(buffer.data(), chunk_size);
+			_metrics.uploaded_bytes.increment(chunk_size);
+			return true;
+		}
 
-	bool success = res && res->status == 200;
+		size_t epilogue_offset = file_offset - file_size;
+		sink.write(epilogue.data() + epilogue_offset, std::min(length, epilogue.size() - epilogue_offset));
+		return true;
+	};
 
-	if (!success) {
-		LOG("Connection to " << _settings.server_url << " failed: " << (res ? std::to_string(res->status) : "No response"));
-	}
+	std::string content_type = "multipart/form-data; boundary=" + boundary;
 
-	return success;
-}
+	LOG("Uploading " << fs::path(upload_filename).filename().string() << " to " << _settings.server_url);
 
-bool ServerInterface::init_database()
-{
-	int rc = sqlite3_open(_settings.db_path.c_str(), &_db);
+	// Post multi-part form
+	auto connection = _connection_pool->acquire();
+	httplib::Result res = connection->Post("/upload", {}, content_length, content_provider, content_type);
 
-	if (rc != SQLITE_OK) {
-		std::cerr << "Cannot open database: " << sqlite3_errmsg(_db) << std::endl;
-		sqlite3_close(_db);
-		_db = nullptr;
-		return false;
+	// Aborted on our side, says nothing about the backend
+	if (!res && (_should_exit || read_error)) {
+		_circuit_breaker.release();
+		return {false, 0, read_error ? "Could not read file: " + filepath : "Upload stopped"};
 	}
 
-	// Create logs table
-	const char* create_logs_table =
-		"CREATE TABLE IF NOT EXISTS logs ("
-		"  uuid TEXT PRIMARY KEY,"  // UUID of the log
-		"  id INTEGER,"             // Original log ID
-		"  date TEXT,"              // ISO8601 date from log
-		"  size_bytes INTEGER,"     // Size in bytes
-		"  downloaded INTEGER DEFAULT 0," // Has it been downloaded
-		"  uploaded INTEGER DEFAULT 0"   // Has it been uploaded
-		");";
-
-	// Create blacklist table
-	const char* create_blacklist_table =
-		"CREATE TABLE IF NOT EXISTS blacklist ("
-		"  uuid TEXT PRIMARY KEY,"  // UUID of the log
-		"  reason TEXT,"            // Reason for blacklisting
-		"  timestamp TEXT"          // When the log was blacklisted
-		");";
-
-	bool success = execute_query(create_logs_table) && execute_query(create_blacklist_table);
-	return success;
-}
-
-void ServerInterface::close_database()
-{
-	if (_db) {
-		sqlite3_close(_db);
-		_db = nullptr;
+	if (!res || res->status == 502 || res->status == 503 || res->status == 504) {
+		// Lost the connection or the server behind a proxy is gone
+		_circuit_breaker.record_failure();
+		_health_monitor->report_failure();
+		update_circuit_metrics();
+		return {false, res ? res->status : 0, "Backend unavailable - Will retry later", true};
 	}
-}
 
-bool ServerInterface::add_to_blacklist(const std::string& uuid, const std::string& reason)
-{
-	// Get current timestamp
-	auto now = std::chrono::system_clock::now();
-	auto now_c = std::chrono::system_clock::to_time_t(now);
-	std::stringstream ss;
-	ss << std::put_time(std::localtime(&now_c), "%Y-%m-%d %H:%M:%S");
-	std::string timestamp = ss.str();
-
-	// Add to blacklist
-	std::string query = "INSERT OR REPLACE INTO blacklist (uuid, reason, timestamp) VALUES (?, ?, ?)";
-	sqlite3_stmt* stmt;
-
-	if (sqlite3_prepare_v2(_db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-		std::cerr << "SQL error preparing add_to_blacklist: " << sqlite3_errmsg(_db) << std::endl;
-		return false;
-	}
+	_circuit_breaker.record_success();
+	update_circuit_metrics();
 
-	sqlite3_bind_text(stmt, 1, uuid.c_str(), -1, SQLITE_STATIC);
-	sqlite3_bind_text(stmt, 2, reason.c_str(), -1, SQLITE_STATIC);
-	sqlite3_bind_text(stmt, 3, timestamp.c_str(), -1, SQLITE_STATIC);
+	if (res->status == 302) {
+		return {true, 302, "Success: " + _settings.server_url + res->get_header_value("Location")};
 
-	bool success = sqlite3_step(stmt) == SQLITE_DONE;
-	sqlite3_finalize(stmt);
+	} else if (res->status == 400) {
+		return {false, 400, "Bad Request - Will not retry"};
 
-	return success;
+	} else {
+		return {false, res->status, "Will retry later"};
+	}
 }
 
-bool ServerInterface::execute_query(const std::string& query)
+ConnectionPool::Stats ServerInterface::connection_stats() const
 {
-	char* error_msg = nullptr;
-	int rc = sqlite3_exec(_db, query.c_str(), nullptr, nullptr, &error_msg);
-
-	if (rc != SQLITE_OK) {
-		std::cerr << "SQL error: " << error_msg << std::endl;
-		sqlite3_free(error_msg);
-		return false;
-	}
-
-	return true;
+	return _connection_pool->stats();
 }
 
-ServerInterface::DatabaseEntry ServerInterface::row_to_db_entry(sqlite3_stmt* stmt)
+void ServerInterface::start_health_monitor(HealthMonitor::ChangeCallback on_change)
 {
-	DatabaseEntry entry;
-
-	const unsigned char* uuid_text = sqlite3_column_text(stmt, 0);
+	_health_monitor->start(std::move(on_change));
+}
 
-	if (uuid_text != nullptr) {
-		entry.uuid = reinterpret_cast<const char*>(uuid_text);
+void ServerInterface::stop_health_monitor()
+{
+	_health_monitor->stop();
+}
 
-	} else {
-		entry.uuid = "";
-	}
+void ServerInterface::update_circuit_metrics()
+{
+	_metrics.circuit_open.set(_circuit_breaker.state() != CircuitBreaker::State::Closed);
+}
 
-	entry.id = sqlite3_column_int(stmt, 1);
+static std::string generate_multipart_boundary()
+{
+	static const char charset[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
-	const unsigned char* date_text = sqlite3_column_text(stmt, 2);
+	std::random_device rd;
+	std::mt19937 engine(rd());
+	std::uniform_int_distribution<size_t> dist(0, sizeof(charset) - 2);
 
-	if (date_text != nullptr) {
-		entry.date = reinterpret_cast<const char*>(date_text);
+	std::string boundary = "--logloader-multipart-data-";
 
-	} else {
-		entry.date = "";
+	for (int i = 0; i < 16; i++) {
+		boundary += charset[dist(engine)];
 	}
 
-	entry.size_bytes = sqlite3_column_int(stmt, 3);
-	entry.downloaded = sqlite3_column_int(stmt, 4) != 0;
-
-	return entry;
+	return boundary;
 }
@@ -1,60 +1,73 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
-#include <sqlite3.h>
-#include <mavsdk/plugins/log_files/log_files.h>
+
+#include "Backoff.hpp"
+#include "CircuitBreaker.hpp"
+#include "ConnectionPool.hpp"
+#include "Database.hpp"
+#include "HealthMonitor.hpp"
 
 class ServerInterface
 {
 public:
 	struct Settings {
+		std::string name;            // Backend identifier used for the upload state in the database
 		std::string server_url;
 		std::string user_email;
-		std::string logs_directory;
-		std::string db_path;         // Path to this server's database
 		bool upload_enabled {};
 		bool public_logs {};
+		uint32_t max_concurrent_uploads {1};
+		bool accepts_compressed {};  // Backend takes .ulg.zst uploads, otherwise archived logs are decompressed on the fly
+		Backoff::Settings retry {};  // Delay before a log that failed temporarily is tried again
+		CircuitBreaker::Settings circuit_breaker {};
+		std::chrono::seconds health_check_interval {30}; // While the backend is reachable
+		std::chrono::seconds health_retry_interval {5};  // First recheck once it is down, backs off up to the interval
 	};
 
 	struct UploadResult {
 		bool success;
 		int status_code;    // HTTP status code, or 0 if not applicable
 		std::string message;
+		bool backend_down {}; // Failed because of the backend or a pause rather than the log, no attempt is recorded
 	};
 
-	struct DatabaseEntry {
-		std::string uuid;
-		uint32_t id;
-		std::string date;
-		uint32_t size_bytes;
-		bool downloaded;
-	};
-
-	ServerInterface(const Settings& settings);
-	~ServerInterface();
+	ServerInterface(const Settings& settings, std::shared_ptr<Database> database);
 
-	// Database initialization
-	bool init_database();
-	void close_database();
-
-	// Log entry management
-	static std::string generate_uuid(const mavsdk::LogFiles::Entry& entry);
-	bool add_log_entry(const mavsdk::LogFiles::Entry& entry);
-	bool update_download_status(const std::string& uuid, bool downloaded);
-	uint32_t num_logs_to_download();
+	const std::string& name() const { return _settings.name; }
+	bool upload_enabled() const { return _settings.upload_enabled; }
+	uint32_t max_concurrent_uploads() const { return _settings.max_concurrent_uploads; }
 
 	// Upload management
 	uint32_t num_logs_to_upload();
-	DatabaseEntry get_next_log_to_upload();
+	Database::LogEntry get_next_log_to_upload();
+	std::vector<Database::LogEntry> get_logs_to_upload(uint32_t limit);
 	UploadResult upload_log(const std::string& filepath);
 
+	// Records a temporary failure of a log and backs it off
+	void retry_later(const std::string& uuid, const std::string& message);
+
+	// Checks reachability in the background, calls back when the backend comes and goes. Without
+	// it the backend is checked on demand before uploading.
+	void start_health_monitor(HealthMonitor::ChangeCallback on_change);
+	void stop_health_monitor();
+	HealthMonitor::Status health() const { return _health_monitor->status(); }
+
+	// False while the backend is unreachable or the circuit breaker keeps uploads away from it
+	bool available() const { return _health_monitor->state() == HealthMonitor::State::Up && _circuit_breaker.available(); }
+	CircuitBreaker::State circuit_state() const { return _circuit_breaker.state(); }
+	CircuitBreaker::Clock::time_point circuit_retry_at() const { return _circuit_breaker.retry_at(); }
+
+	// Fills in the ID and date from a LOG<id>_<date>.ulg[.zst] path, the size is left untouched
+	static bool parse_log_filename(const std::string& filepath, mavsdk::LogFiles::Entry& entry);
+
 	// Query methods
 	bool is_blacklisted(const std::string& uuid);
-	DatabaseEntry get_next_log_to_download();
 
-	std::string filepath_from_entry(const mavsdk::LogFiles::Entry& entry) const ;
-	std::string filepath_from_uuid(const std::string& uuid) const;
+	ConnectionPool::Stats connection_stats() const;
 
 	void start();
 	void stop();
@@ -67,15 +80,15 @@ private:
 
 	void sanitize_url_and_determine_protocol();
 	UploadResult upload(const std::string& filepath);
-	bool server_reachable();
-
-	// Database operations
-	bool execute_query(const std::string& query);
-	bool add_to_blacklist(const std::string& uuid, const std::string& reason);
-	DatabaseEntry row_to_db_entry(sqlite3_stmt* stmt);
+	void update_circuit_metrics();
 
 	Settings _settings;
 	Protocol _protocol {Protocol::Https};
-	bool _should_exit = false;
-	sqlite3* _db = nullptr;
+	std::shared_ptr<Database> _database;
+	Metrics::Backend& _metrics;
+	std::unique_ptr<ConnectionPool> _connection_pool;
+	std::unique_ptr<HealthMonitor> _health_monitor;
+	Backoff _retry_backoff;
+	CircuitBreaker _circuit_breaker;
+	std::atomic<bool> _should_exit = false; // Uploads run on several worker threads
 };
@@ -0,0 +1,64 @@
+#include "Sha256.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include <openssl/evp.h>
+
+static constexpr size_t READ_BLOCK_SIZE = 1024 * 1024;
+
+std::string sha256_file(const std::string& path, uint64_t max_bytes, uint64_t offset)
+{
+	std::ifstream file(path, std::ios::binary);
+
+	if (!file || !file.seekg(offset)) {
+		return "";
+	}
+
+	std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+
+	if (!ctx || EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) != 1) {
+		return "";
+	}
+
+	std::vector<char> buffer(std::min<uint64_t>(READ_BLOCK_SIZE, max_bytes));
+	uint64_t remaining = max_bytes;
+
+	while (remaining > 0) {
+		file.read(buffer.data(), std::min<uint64_t>(buffer.size(), remaining));
+		size_t read = file.gcount();
+
+		if (read == 0) {
+			break;
+		}
+
+		if (EVP_DigestUpdate(ctx.get(), buffer.data(), read) != 1) {
+			return "";
+		}
+
+		remaining -= read;
+	}
+
+	if (file.bad()) {
+		return "";
+	}
+
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int length = 0;
+
+	if (EVP_DigestFinal_ex(ctx.get(), digest, &length) != 1) {
+		return "";
+	}
+
+	static const char digits[] = "0123456789abcdef";
+
+	std::string hex(length * 2, '0');
+
+	for (unsigned int i = 0; i < length; i++) {
+		hex[2 * i] = digits[digest[i] >> 4];
+		hex[2 * i + 1] = digits[digest[i] & 0xF];
+	}
+
+	return hex;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// SHA-256 of max_bytes of a file from offset, or of all of it, as 64 lowercase hex digits. Empty if
+// the file can not be read. The file is streamed through OpenSSL in fixed-size blocks.
+std::string sha256_file(const std::string& path, uint64_t max_bytes = UINT64_MAX, uint64_t offset = 0);
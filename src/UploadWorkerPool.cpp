@@ -0,0 +1,316 @@
+#include "UploadWorkerPool.hpp"
+#include "Log.hpp"
+
+#include <algorithm>
+
+UploadWorkerPool::UploadWorkerPool(std::shared_ptr<ServerInterface> server, std::shared_ptr<Database> database,
+				   const UploadWorkerPool::Settings& settings)
+	: _server(server)
+	, _database(database)
+	, _settings(settings)
+	, _metrics(Metrics::instance().backend(server->name()))
+{
+	_settings.max_concurrent_uploads = std::max<uint32_t>(_settings.max_concurrent_uploads, 1);
+	_settings.queue_depth = std::max<uint32_t>(_settings.queue_depth, 1);
+}
+
+UploadWorkerPool::~UploadWorkerPool()
+{
+	stop();
+}
+
+void UploadWorkerPool::start()
+{
+	// Logs held back while the backend was unreachable are picked up as soon as it is back
+	_server->start_health_monitor([this](HealthMonitor::State state) {
+		if (state == HealthMonitor::State::Up) {
+			notify();
+		}
+	});
+
+	_should_exit = false;
+	_dispatcher = std::thread(&UploadWorkerPool::dispatch_thread, this);
+
+	for (uint32_t i = 0; i < _settings.max_concurrent_uploads; i++) {
+		_workers.emplace_back(&UploadWorkerPool::worker_thread, this);
+	}
+}
+
+void UploadWorkerPool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_should_exit = true;
+	}
+
+	_dispatch_cv.notify_all();
+	_worker_cv.notify_all();
+
+	if (_dispatcher.joinable()) {
+		_dispatcher.join();
+	}
+
+	for (auto& worker : _workers) {
+		worker.join();
+	}
+
+	_workers.clear();
+	_server->stop_health_monitor();
+	_queue.clear();
+	_claimed.clear();
+	_metrics.queued_uploads.set(0);
+}
+
+void UploadWorkerPool::enqueue(const Database::LogEntry& entry)
+{
+	if (!_server->upload_enabled()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (_claimed.contains(entry.uuid)) {
+			return;
+		}
+
+		// Backpressure: when the queue is full the log stays in the database until there is room
+		if (_queue.size() >= _settings.queue_depth) {
+			_check_database = true;
+			return;
+		}
+
+		_claimed.insert(entry.uuid);
+		_queue.push_back({entry, std::chrono::steady_clock::now()});
+		_metrics.queued_uploads.set(_queue.size());
+	}
+
+	_worker_cv.notify_one();
+}
+
+void UploadWorkerPool::notify()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_check_database = true;
+	}
+
+	_dispatch_cv.notify_one();
+}
+
+UploadWorkerPool::HandoffStats UploadWorkerPool::handoff_stats() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	return {
+		.count = _handoff_count,
+		.mean_ms = _handoff_count ? _handoff_total_ms / _handoff_count : 0.0,
+		.max_ms = _handoff_max_ms,
+	};
+}
+
+void UploadWorkerPool::dispatch_thread()
+{
+	while (!_should_exit) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_reschedule = false;
+		}
+
+		auto timeout = next_wakeup();
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+
+			// Only go to the database once the workers have made room in the queue
+			bool notified = _dispatch_cv.wait_for(lock, timeout, [this] {
+				return _should_exit || _reschedule || (_check_database && _queue.size() < _settings.queue_depth);
+			});
+
+			if (!notified) {
+				// A log is due for its retry, the circuit breaker cooldown expired or it is time to poll
+				_check_database = true;
+			}
+
+			if (!_check_database || _queue.size() >= _settings.queue_depth) {
+				continue;
+			}
+
+			_check_database = false;
+		}
+
+		if (_should_exit) {
+			break;
+		}
+
+		fill_queue();
+	}
+
+	LOG_DEBUG("Upload dispatcher for " << _server->name() << " exiting");
+}
+
+std::chrono::milliseconds UploadWorkerPool::next_wakeup() const
+{
+	using namespace std::chrono;
+
+	milliseconds timeout = duration_cast<milliseconds>(_settings.poll_interval);
+
+	// Once the cooldown has expired the circuit is available and the next fill sends the probe
+	auto circuit_retry_at = _server->circuit_retry_at();
+	auto now = steady_clock::now();
+
+	if (_server->circuit_state() == CircuitBreaker::State::Open && circuit_retry_at > now) {
+		timeout = std::min(timeout, ceil<milliseconds>(circuit_retry_at - now));
+	}
+
+	auto next_retry = _database->next_upload_retry(_server->name());
+
+	if (next_retry != system_clock::time_point {}) {
+		timeout = std::min(timeout, ceil<milliseconds>(next_retry - system_clock::now()));
+	}
+
+	return std::max(timeout, milliseconds(0));
+}
+
+void UploadWorkerPool::fill_queue()
+{
+	// Nothing goes out while the backend is down
+	if (!_server->available()) {
+		return;
+	}
+
+	// A backend coming back from an outage is probed with a single upload first
+	bool probing = _server->circuit_state() != CircuitBreaker::State::Closed;
+	size_t room = 0;
+	size_t limit = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (_queue.size() >= _settings.queue_depth) {
+			return;
+		}
+
+		room = probing ? 1 : _settings.queue_depth - _queue.size();
+
+		// Logs that are already claimed come back from the query as well, skip over them
+		limit = room + _claimed.size();
+	}
+
+	auto entries = _server->get_logs_to_upload(limit);
+
+	if (entries.empty()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		// A full result means there may be more pending logs than what fits in the queue
+		if (entries.size() >= limit) {
+			_check_database = true;
+		}
+
+		size_t added = 0;
+
+		for (const auto& entry : entries) {
+			if (_queue.size() >= _settings.queue_depth || added >= room) {
+				break;
+			}
+
+			if (_claimed.insert(entry.uuid).second) {
+				_queue.push_back({entry, std::nullopt});
+				added++;
+			}
+		}
+
+		_metrics.queued_uploads.set(_queue.size());
+	}
+
+	_worker_cv.notify_all();
+}
+
+void UploadWorkerPool::worker_thread()
+{
+	while (true) {
+		Job job;
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_worker_cv.wait(lock, [this] { return _should_exit || !_queue.empty(); });
+
+			if (_should_exit) {
+				return;
+			}
+
+			job = _queue.front();
+			_queue.pop_front();
+			_metrics.queued_uploads.set(_queue.size());
+		}
+
+		if (job.downloaded_at) {
+			record_handoff(*job.downloaded_at);
+		}
+
+		bool done = upload(job.entry);
+
+		// Logs that failed temporarily are picked up again once their retry is due, the
+		// dispatcher wakes up for the earliest one
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_claimed.erase(job.entry.uuid);
+			_reschedule = _reschedule || !done;
+		}
+
+		_dispatch_cv.notify_one();
+	}
+}
+
+void UploadWorkerPool::record_handoff(std::chrono::steady_clock::time_point downloaded_at)
+{
+	std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - downloaded_at;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_handoff_count++;
+	_handoff_total_ms += latency.count();
+	_handoff_max_ms = std::max(_handoff_max_ms, latency.count());
+
+	LOG_DEBUG(_server->name() << " upload started " << latency.count() << " ms after download ("
+		  << _handoff_count << " logs, mean " << _handoff_total_ms / _handoff_count << " ms, max " << _handoff_max_ms << " ms)");
+}
+
+bool UploadWorkerPool::upload(const Database::LogEntry& entry)
+{
+	std::string filepath = _database->filepath_from_uuid(entry.uuid);
+
+	if (filepath.empty()) {
+		LOG("Could not determine file path for UUID: " << entry.uuid);
+		_server->retry_later(entry.uuid, "Could not determine file path");
+		return false;
+	}
+
+	ServerInterface::UploadResult result = _server->upload_log(filepath);
+
+	if (result.success) {
+		LOG("Log upload SUCCESS: " << result.message);
+
+	} else if (result.status_code == 400) {
+		LOG("Log upload failed (" << result.status_code << "): " << result.message);
+
+	} else if (result.backend_down) {
+		LOG_DEBUG("Log upload held back (" << result.status_code << "): " << result.message);
+
+	} else {
+		LOG("Log upload TEMPORARILY FAILED (" << result.status_code << "): "
+		    << result.message << " - Will retry later");
+	}
+
+	if (Logger::instance().enabled(LogLevel::Debug)) {
+		auto stats = _server->connection_stats();
+		LOG_DEBUG(_server->name() << " connections opened: " << stats.connections_opened
+			  << " handshakes saved: " << stats.handshakes_saved
+			  << " idle reconnects: " << stats.idle_reconnects);
+	}
+
+	return result.success || result.status_code == 400;
+}
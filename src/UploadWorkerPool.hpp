@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "Database.hpp"
+#include "ServerInterface.hpp"
+
+// Uploads the pending logs of a single backend. Freshly downloaded logs are handed over directly
+// through enqueue() and a fixed number of workers drain the bounded queue, so every backend makes
+// progress independently of the others and never has more than max_concurrent_uploads in flight.
+// The dispatcher thread only falls back to the database to recover logs pending from a previous
+// run, logs that did not fit in the queue and logs that failed temporarily. Those are handed out
+// again once their backoff expires. Nothing is handed out while the backend is unreachable or its
+// circuit is open, the dispatcher is woken by the backend's health monitor when it comes back.
+class UploadWorkerPool
+{
+public:
+	struct Settings {
+		uint32_t max_concurrent_uploads {1};
+		uint32_t queue_depth {4};          // Maximum number of logs waiting for a free worker
+		std::chrono::seconds poll_interval {60}; // Longest time between checks of the database
+	};
+
+	// Time from the download finishing to its upload starting, for logs handed over with enqueue()
+	struct HandoffStats {
+		uint64_t count;
+		double mean_ms;
+		double max_ms;
+	};
+
+	UploadWorkerPool(std::shared_ptr<ServerInterface> server, std::shared_ptr<Database> database, const Settings& settings);
+	~UploadWorkerPool();
+
+	void start();
+	void stop();
+
+	// Hand over a log that has just been downloaded
+	void enqueue(const Database::LogEntry& entry);
+
+	// Wake the dispatcher to check the database for pending logs
+	void notify();
+
+	HandoffStats handoff_stats() const;
+
+private:
+	struct Job {
+		Database::LogEntry entry;
+		std::optional<std::chrono::steady_clock::time_point> downloaded_at;
+	};
+
+	void dispatch_thread();
+	void worker_thread();
+	void fill_queue();
+	std::chrono::milliseconds next_wakeup() const;
+	bool upload(const Database::LogEntry& entry); // False when the log is still pending
+	void record_handoff(std::chrono::steady_clock::time_point downloaded_at);
+
+	std::shared_ptr<ServerInterface> _server;
+	std::shared_ptr<Database> _database;
+	Settings _settings;
+	Metrics::Backend& _metrics;
+
+	std::thread _dispatcher;
+	std::vector<std::thread> _workers;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _dispatch_cv;
+	std::condition_variable _worker_cv;
+	std::deque<Job> _queue;
+	std::unordered_set<std::string> _claimed; // UUIDs queued or being uploaded
+	bool _check_database = true; // The database may hold pending logs that are not queued
+	bool _reschedule = false;    // A log failed, the dispatcher recomputes when to wake up
+	std::atomic<bool> _should_exit = false;
+
+	uint64_t _handoff_count = 0;
+	double _handoff_total_ms = 0;
+	double _handoff_max_ms = 0;
+};
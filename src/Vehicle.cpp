@@ -0,0 +1,568 @@
+#include "Vehicle.hpp"
+#include "Log.hpp"
+#include "LogIndexer.hpp"
+#include "Metrics.hpp"
+#include "Sha256.hpp"
+
+#include <filesystem>
+#include <iomanip>
+
+namespace fs = std::filesystem;
+
+// Pending logs the scheduler chooses from, newest first
+static constexpr uint32_t MAX_SCHEDULER_CANDIDATES = 512;
+
+// Bytes at each end of a log that identify it. The start holds the ULog header, definitions and
+// parameters, which are the same for every flight of an airframe on one firmware, the end holds
+// the last data of the flight. A log of the same size as one we have is only downloaded completely
+// if either end differs.
+static constexpr uint32_t END_BYTES = 64 * 1024;
+
+// After a disarm the logger closes the log of the flight. Autopilots that report their logger in
+// SYS_STATUS are waited for until it stops, up to LOGGER_STOP_TIMEOUT for one that logs from boot,
+// the others get a fixed LOGGER_STALL.
+static constexpr std::chrono::seconds LOGGER_STOP_TIMEOUT {10};
+static constexpr std::chrono::seconds LOGGER_STALL {3};
+
+Vehicle::Vehicle(std::shared_ptr<mavsdk::System> system, std::shared_ptr<Database> database,
+		 std::shared_ptr<LogArchive> log_archive, const DownloadScheduler::Settings& scheduler_settings,
+		 const LogDownloader::Settings& downloader_settings, HandoffCallback handoff, StateCallback state_changed)
+	: _id(system->get_system_id())
+	, _name("sys" + std::to_string(_id))
+	, _database(std::move(database))
+	, _log_archive(std::move(log_archive))
+	, _handoff(std::move(handoff))
+	, _state_changed(std::move(state_changed))
+	, _system(system)
+	, _scheduler(scheduler_settings, _id)
+{
+	// MAVSDK plugins
+	_log_files = std::make_shared<mavsdk::LogFiles>(system);
+	_telemetry = std::make_shared<mavsdk::Telemetry>(system);
+	_mavlink_passthrough = std::make_shared<mavsdk::MavlinkPassthrough>(system);
+
+	LogList::Settings list_settings = {};
+	list_settings.vehicle_id = _id;
+
+	_log_downloader = std::make_unique<LogDownloader>(_mavlink_passthrough, downloader_settings);
+	_log_list = std::make_unique<LogList>(_log_files, _mavlink_passthrough, list_settings);
+
+	fs::create_directories(_database->vehicle_directory(_id));
+}
+
+Vehicle::~Vehicle()
+{
+	stop();
+}
+
+void Vehicle::start()
+{
+	_armed = _telemetry->armed();
+	_log_downloader->hold(_armed);
+
+	_armed_handle = _telemetry->subscribe_armed([this](bool armed) {
+		set_armed(armed);
+	});
+
+	// A vehicle that rebooted may have logged while it was gone
+	_connected_handle = _system->subscribe_is_connected([this](bool connected) {
+		set_connected(connected);
+	});
+
+	_sys_status_handle = _mavlink_passthrough->subscribe_message(MAVLINK_MSG_ID_SYS_STATUS, [this](const mavlink_message_t& message) {
+		handle_sys_status(message);
+	});
+
+	_thread = std::thread(&Vehicle::run, this);
+}
+
+void Vehicle::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(_exit_cv_mutex);
+		_should_exit = true;
+	}
+	_exit_cv.notify_all();
+
+	_telemetry->unsubscribe_armed(_armed_handle);
+	_system->unsubscribe_is_connected(_connected_handle);
+	_mavlink_passthrough->unsubscribe_message(MAVLINK_MSG_ID_SYS_STATUS, _sys_status_handle);
+
+	_log_downloader->cancel();
+
+	if (_thread.joinable()) {
+		_thread.join();
+	}
+}
+
+void Vehicle::set_armed(bool armed)
+{
+	{
+		std::lock_guard<std::mutex> lock(_exit_cv_mutex);
+
+		// Telemetry reports the state with every heartbeat
+		if (_armed == armed) {
+			return;
+		}
+
+		_armed = armed;
+
+		if (armed) {
+			// Stop the download here rather than when the vehicle's thread gets to it
+			_armed_time = std::chrono::steady_clock::now();
+			_log_downloader->hold(true);
+		}
+	}
+
+	_exit_cv.notify_all();
+
+	LOG_DEBUG(_name << (armed ? ": Armed" : ": Disarmed"));
+
+	if (_state_changed) {
+		_state_changed();
+	}
+}
+
+void Vehicle::set_connected(bool connected)
+{
+	LOG_DEBUG(_name << (connected ? ": Connected" : ": Disconnected"));
+
+	if (!connected) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_exit_cv_mutex);
+		_list_stale = true;
+	}
+
+	_exit_cv.notify_all();
+}
+
+void Vehicle::handle_sys_status(const mavlink_message_t& message)
+{
+	// Other components of the vehicle do not run the logger
+	if (message.sysid != _id || message.compid != _mavlink_passthrough->get_target_compid()) {
+		return;
+	}
+
+	mavlink_sys_status_t sys_status;
+	mavlink_msg_sys_status_decode(&message, &sys_status);
+
+	bool running = sys_status.onboard_control_sensors_enabled & MAV_SYS_STATUS_LOGGING;
+
+	{
+		std::lock_guard<std::mutex> lock(_exit_cv_mutex);
+
+		if (sys_status.onboard_control_sensors_present & MAV_SYS_STATUS_LOGGING) {
+			_logger_reported = true;
+		}
+
+		if (_logger_running == running) {
+			return;
+		}
+
+		_logger_running = running;
+	}
+
+	_exit_cv.notify_all();
+
+	LOG_DEBUG(_name << (running ? ": Logger started" : ": Logger stopped"));
+}
+
+void Vehicle::run()
+{
+	// Already disarmed when we connected, the window counts for scheduling but not for its estimate
+	if (!_armed) {
+		_scheduler.disarmed(DownloadScheduler::Clock::now(), false);
+	}
+
+	while (!_should_exit) {
+		if (_armed) {
+			// Transfers were already stopped by set_armed(), wait for the disarm
+			_loop_disabled = true;
+			_scheduler.armed(DownloadScheduler::Clock::now());
+			wait(std::chrono::seconds(30));
+			continue;
+
+		} else if (_loop_disabled) {
+			_loop_disabled = false;
+			_scheduler.disarmed(DownloadScheduler::Clock::now());
+
+			// The log of the flight is listed once the logger closed it
+			_list_stale = true;
+
+			if (!wait_for_logger()) {
+				continue;
+			}
+		}
+
+		// Cleared first, a reconnect while the list is requested asks for it again
+		if (_list_stale.exchange(false) && !request_log_entries()) {
+			LOG_DEBUG(_name << ": Failed to get logs");
+			_list_stale = true;
+			wait(std::chrono::seconds(5));
+			continue;
+		}
+
+		uint32_t total_to_download = _database->num_logs_to_download(_id);
+		uint32_t num_remaining = total_to_download;
+
+		while (!_should_exit && num_remaining && resume_transfers()) {
+			// Download logs until we should exit, the vehicle arms or there are none left to download
+			LOG(_name << ": Downloading log " << total_to_download - num_remaining + 1 << "/" << total_to_download);
+			download_next_log();
+			num_remaining = _database->num_logs_to_download(_id);
+		}
+
+		// Nothing is polled, new logs only appear after a flight or a reboot
+		wait_for_new_logs();
+	}
+}
+
+void Vehicle::wait(std::chrono::seconds duration)
+{
+	// Against the state run() acted on, an arm or disarm just before the wait is not missed
+	std::unique_lock<std::mutex> lock(_exit_cv_mutex);
+	_exit_cv.wait_for(lock, duration, [this] { return _should_exit || _armed != _loop_disabled; });
+}
+
+void Vehicle::wait_for_new_logs()
+{
+	std::unique_lock<std::mutex> lock(_exit_cv_mutex);
+	_exit_cv.wait(lock, [this] { return _should_exit || _armed != _loop_disabled || _list_stale; });
+}
+
+bool Vehicle::wait_for_logger()
+{
+	std::unique_lock<std::mutex> lock(_exit_cv_mutex);
+
+	if (_logger_reported) {
+		_exit_cv.wait_for(lock, LOGGER_STOP_TIMEOUT, [this] { return _should_exit || _armed || !_logger_running; });
+
+	} else {
+		_exit_cv.wait_for(lock, LOGGER_STALL, [this] { return _should_exit || _armed; });
+	}
+
+	return !_should_exit && !_armed;
+}
+
+bool Vehicle::resume_transfers()
+{
+	// Under the lock so an arm in between cannot be undone
+	std::lock_guard<std::mutex> lock(_exit_cv_mutex);
+
+	if (_armed) {
+		return false;
+	}
+
+	_log_downloader->hold(false);
+	return true;
+}
+
+bool Vehicle::request_log_entries()
+{
+	LOG_DEBUG(_name << ": Requesting log entries...");
+
+	// Only the first request lists every log, later ones ask for entries past the last known ID
+	auto request_start = std::chrono::high_resolution_clock::now();
+	auto result = _log_list->refresh();
+
+	auto request_end = std::chrono::high_resolution_clock::now();
+
+	std::chrono::duration<double> request_duration = request_end - request_start;
+	Metrics::instance().log_list_seconds.observe(request_duration.count());
+
+	if (result == LogList::Result::Failed) {
+		LOG(_name << ": Error getting log entries");
+		return false;
+	}
+
+	if (result == LogList::Result::Unchanged) {
+		LOG_DEBUG(_name << ": Log list unchanged, checked in " << request_duration.count() << " seconds");
+		return true;
+	}
+
+	LOG_DEBUG(_name << ": Received " << _log_list->entries().size() << " log entries in " << request_duration.count() << " seconds");
+
+	// Time the database addition
+	auto db_start = std::chrono::high_resolution_clock::now();
+
+	auto new_logs = _database->add_log_entries(_log_list->entries(), _id);
+
+	auto db_end = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> db_duration = db_end - db_start;
+
+	if (!new_logs.empty()) {
+		LOG(_name << ": Found " << new_logs.size() << " new logs");
+	}
+
+	for (const auto& uuid : new_logs) {
+		if (const auto* entry = _log_list->find(uuid)) {
+			_scheduler.log_found(entry->size_bytes);
+		}
+	}
+
+	LOG_DEBUG(_name << ": Added log entries to database in " << db_duration.count() << " seconds");
+	LOG_DEBUG(_name << ": Total processing time: " << (request_duration + db_duration).count() << " seconds");
+
+	return true;
+}
+
+Database::LogEntry Vehicle::next_log_to_download()
+{
+	if (_scheduler.policy() == DownloadScheduler::Policy::NewestFirst) {
+		return _database->get_next_log_to_download(_id);
+	}
+
+	std::vector<DownloadScheduler::Candidate> candidates;
+
+	for (auto& db_entry : _database->get_logs_to_download(_id, MAX_SCHEDULER_CANDIDATES)) {
+		mavsdk::LogFiles::Entry entry;
+		entry.id = db_entry.id;
+		entry.date = db_entry.date;
+		entry.size_bytes = db_entry.size_bytes;
+
+		// Partial downloads only cost what is left of them
+		uint64_t remaining_bytes = LogDownloader::remaining_bytes(entry, _database->filepath_from_entry(entry, _id));
+		candidates.push_back({std::move(db_entry), remaining_bytes});
+	}
+
+	if (candidates.empty()) {
+		return {};
+	}
+
+	auto now = DownloadScheduler::Clock::now();
+	const auto& chosen = candidates[_scheduler.choose(candidates, now)];
+
+	LOG_DEBUG(_name << ": " << DownloadScheduler::policy_name(_scheduler.policy()) << " policy chose " << chosen.entry.date
+		  << ", " << chosen.remaining_bytes << " bytes left, " << std::fixed << std::setprecision(0)
+		  << _scheduler.seconds_left(now) << " s left in window at " << _scheduler.throughput() / 1e3 << " kB/s");
+
+	return chosen.entry;
+}
+
+void Vehicle::download_next_log()
+{
+	// Get one undownloaded log of this vehicle
+	Database::LogEntry db_entry = next_log_to_download();
+
+	if (db_entry.uuid.empty()) {
+		return;
+	}
+
+	// Find the corresponding log entry in the list from the vehicle
+	const mavsdk::LogFiles::Entry* entry = _log_list->find(db_entry.uuid);
+
+	if (entry) {
+		auto path = _database->filepath_from_entry(*entry, _id);
+		std::string original_uuid;
+
+		// Retried on the next pass
+		if (!probe_duplicate(db_entry, *entry, path, original_uuid)) {
+			return;
+		}
+
+		if (!original_uuid.empty()) {
+			drop_duplicate(db_entry, path, original_uuid);
+			Metrics::instance().duplicate_bytes_skipped.increment(entry->size_bytes - 2 * END_BYTES);
+			return;
+		}
+
+		if (download_log(*entry)) {
+			original_uuid = hash_log(db_entry, path);
+
+			if (!original_uuid.empty()) {
+				drop_duplicate(db_entry, path, original_uuid);
+				return;
+			}
+
+			_database->update_download_status(db_entry.uuid, true);
+
+			db_entry.downloaded = true;
+
+			if (_log_archive->enabled()) {
+				// The raw log is still in the page cache and can be mapped, the archive would have to
+				// be decompressed again to read it
+				LogIndexer::index_log(*_database, db_entry.uuid, path);
+				archive_log(db_entry, path);
+			}
+
+			_handoff(db_entry);
+		}
+
+		return;
+	}
+
+	// Couldn't find matching entry in the log list
+	// This could happen if the log is no longer available on the vehicle
+	// Mark it as processed to avoid trying again, there is no file to upload or keep
+	_database->update_download_status(db_entry.uuid, true);
+	_database->set_evicted(db_entry.uuid);
+}
+
+bool Vehicle::download_log(const mavsdk::LogFiles::Entry& entry)
+{
+	auto download_path = _database->filepath_from_entry(entry, _id);
+
+	// A partial file is resumed from its journal rather than downloaded again
+	LOG("Downloading " << download_path);
+
+	auto time_start = std::chrono::steady_clock::now();
+
+	auto result = _log_downloader->download(entry, download_path, [this, &entry, &time_start](float progress) {
+		if (!Logger::instance().enabled(LogLevel::Info) || !Logger::instance().progress_due(_progress_time)) {
+			return;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		auto elapsed_ms = std::max<int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now - time_start).count(), 1);
+
+		// Calculate data rate in Kbps
+		double rate_kbps = ((progress * entry.size_bytes * 8.0)) / elapsed_ms; // Convert bytes to bits and then to Kbps
+
+		LOG(_name << ": Downloading: "
+		    << std::setw(24) << std::left << entry.date
+		    << std::setw(8) << std::fixed << std::setprecision(2) << entry.size_bytes / 1e6 << "MB"
+		    << std::setw(6) << std::right << int(progress * 100.0f) << "%"
+		    << std::setw(12) << std::fixed << std::setprecision(2) << rate_kbps << " Kbps");
+	});
+
+	switch (result) {
+	case LogDownloader::Result::Success: {
+		auto now = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(now - time_start).count() / 1000.;
+		LOG(_name << ": Finished in " << std::fixed << std::setprecision(2) << seconds << " seconds");
+		_scheduler.download_finished(_log_downloader->bytes_transferred(), seconds);
+		Metrics::instance().downloads.increment();
+		Metrics::instance().download_seconds.observe(seconds);
+		return true;
+	}
+
+	case LogDownloader::Result::Cancelled: {
+		std::unique_lock<std::mutex> lock(_exit_cv_mutex);
+
+		if (!_armed) {
+			LOG(_name << ": Download cancelled, will resume later");
+			return false;
+		}
+
+		std::chrono::duration<double> latency = std::chrono::steady_clock::now() - _armed_time;
+		lock.unlock();
+
+		LOG(_name << ": Download stopped " << std::fixed << std::setprecision(0) << latency.count() * 1e3
+		    << " ms after arming, will resume later");
+		Metrics::instance().preemption_seconds.observe(latency.count());
+		return false;
+	}
+
+	case LogDownloader::Result::Timeout:
+		LOG(_name << ": Download timed out, will resume later");
+		Metrics::instance().download_failures.increment();
+		return false;
+
+	case LogDownloader::Result::FileError:
+		LOG(_name << ": Download failed");
+		Metrics::instance().download_failures.increment();
+		return false;
+	}
+
+	return false;
+}
+
+bool Vehicle::probe_duplicate(const Database::LogEntry& db_entry, const mavsdk::LogFiles::Entry& entry, const std::string& path,
+			      std::string& original_uuid)
+{
+	// Small logs are not worth the extra round trips, and only sizes we already have can match
+	if (entry.size_bytes <= 2 * END_BYTES || !_database->has_end_hashes(entry.size_bytes)) {
+		return true;
+	}
+
+	// Both ends are kept, a log that turns out to be new resumes between them
+	uint32_t tail_offset = entry.size_bytes - END_BYTES;
+	auto result = _log_downloader->download_range(entry, path, 0, END_BYTES);
+
+	if (result == LogDownloader::Result::Success) {
+		result = _log_downloader->download_range(entry, path, tail_offset, END_BYTES);
+	}
+
+	if (result != LogDownloader::Result::Success) {
+		if (result != LogDownloader::Result::Cancelled) {
+			LOG(_name << ": Could not fetch the ends of " << path);
+		}
+
+		return false;
+	}
+
+	std::string head_hash = sha256_file(path, END_BYTES);
+	std::string tail_hash = sha256_file(path, END_BYTES, tail_offset);
+
+	if (!head_hash.empty() && !tail_hash.empty()) {
+		original_uuid = _database->find_duplicate_by_ends(db_entry.uuid, entry.size_bytes, head_hash, tail_hash);
+	}
+
+	return true;
+}
+
+std::string Vehicle::hash_log(const Database::LogEntry& db_entry, const std::string& path)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	// The file was just written and is still in the page cache
+	std::string content_hash = sha256_file(path);
+	std::string head_hash = sha256_file(path, END_BYTES);
+	std::string tail_hash = sha256_file(path, END_BYTES, db_entry.size_bytes - std::min(db_entry.size_bytes, END_BYTES));
+
+	if (content_hash.empty() || head_hash.empty() || tail_hash.empty()) {
+		LOG("Could not hash " << path);
+		return "";
+	}
+
+	std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+	LOG_DEBUG(_name << ": SHA-256 " << content_hash << " in " << std::fixed << std::setprecision(3) << duration.count() << " s");
+
+	_database->set_content_hash(db_entry.uuid, content_hash, head_hash, tail_hash);
+
+	return _database->find_duplicate_by_content(db_entry.uuid, content_hash);
+}
+
+void Vehicle::drop_duplicate(const Database::LogEntry& db_entry, const std::string& path, const std::string& original_uuid)
+{
+	// One file per content, the duplicate is neither kept nor uploaded
+	std::error_code ec;
+	fs::remove(path, ec);
+	fs::remove(LogDownloader::journal_path(path), ec);
+
+	_database->set_duplicate(db_entry.uuid, original_uuid);
+	Metrics::instance().duplicate_logs.increment();
+
+	LOG(_name << ": " << fs::path(path).filename().string() << " is a duplicate of " << original_uuid << ", skipped");
+}
+
+void Vehicle::archive_log(Database::LogEntry& entry, const std::string& path)
+{
+	LogArchive::CompressStats stats = {};
+
+	if (!_log_archive->compress(path, stats)) {
+		// The raw log is still there and is uploaded as is
+		LOG("Failed to compress " << path);
+		return;
+	}
+
+	// Only drop the raw log once the database points at the archive
+	if (!_database->update_compressed_size(entry.uuid, stats.compressed_bytes)) {
+		fs::remove(LogArchive::compressed_path(path));
+		return;
+	}
+
+	entry.compressed_size = stats.compressed_bytes;
+
+	std::error_code ec;
+	fs::remove(path, ec);
+
+	LOG("Compressed " << fs::path(path).filename().string() << " "
+	    << std::fixed << std::setprecision(2) << stats.raw_bytes / 1e6 << "MB -> " << stats.compressed_bytes / 1e6 << "MB"
+	    << " ratio " << double(stats.raw_bytes) / std::max<uint64_t>(stats.compressed_bytes, 1)
+	    << " cpu " << stats.cpu_seconds << "s"
+	    << " wall " << stats.wall_seconds << "s");
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <mavsdk/mavsdk.h>
+#include <mavsdk/plugins/telemetry/telemetry.h>
+#include <mavsdk/plugins/log_files/log_files.h>
+#include <mavsdk/plugins/mavlink_passthrough/mavlink_passthrough.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Database.hpp"
+#include "DownloadScheduler.hpp"
+#include "LogArchive.hpp"
+#include "LogDownloader.hpp"
+#include "LogList.hpp"
+
+// Download worker for one autopilot on the MAVLink connection. Every vehicle lists and downloads
+// its logs on its own thread, so a slow link to one vehicle does not hold up the others. Logs are
+// stored under the vehicle's namespace in the shared database and logs directory, and are handed
+// to the shared upload workers once they are complete. Transfers are driven by the armed state and
+// the logger flag of SYS_STATUS as they arrive, not by polling. The log list is requested after
+// connecting and once the logger closed the log of a flight.
+class Vehicle
+{
+public:
+	// Called on the vehicle's thread for each log that finished downloading
+	using HandoffCallback = std::function<void(const Database::LogEntry& entry)>;
+
+	// Called on a MAVSDK thread when the vehicle arms or disarms
+	using StateCallback = std::function<void()>;
+
+	Vehicle(std::shared_ptr<mavsdk::System> system, std::shared_ptr<Database> database,
+		std::shared_ptr<LogArchive> log_archive, const DownloadScheduler::Settings& scheduler_settings,
+		const LogDownloader::Settings& downloader_settings, HandoffCallback handoff, StateCallback state_changed);
+	~Vehicle();
+
+	uint8_t id() const { return _id; }
+	const std::string& name() const { return _name; }
+	bool armed() const { return _armed; }
+
+	void start();
+	void stop(); // Cancels the download in progress, it resumes from its journal next time
+
+private:
+	void run();
+	bool request_log_entries();
+	Database::LogEntry next_log_to_download();
+	void download_next_log();
+	bool download_log(const mavsdk::LogFiles::Entry& entry);
+	// False if the ends could not be fetched, original_uuid is set when the log is a duplicate
+	bool probe_duplicate(const Database::LogEntry& db_entry, const mavsdk::LogFiles::Entry& entry, const std::string& path,
+			     std::string& original_uuid);
+	std::string hash_log(const Database::LogEntry& db_entry, const std::string& path); // Returns the original of a duplicate
+	void drop_duplicate(const Database::LogEntry& db_entry, const std::string& path, const std::string& original_uuid);
+	void archive_log(Database::LogEntry& entry, const std::string& path);
+	void wait(std::chrono::seconds duration); // Returns early when stopped or the vehicle arms or disarms
+	bool wait_for_logger(); // False if the vehicle armed again before the log of the flight was closed
+	bool resume_transfers(); // False while armed
+	void wait_for_new_logs(); // Returns when stopped, the vehicle arms or the log list is out of date
+
+	// MAVSDK callbacks
+	void set_armed(bool armed);
+	void set_connected(bool connected);
+	void handle_sys_status(const mavlink_message_t& message);
+
+	uint8_t _id;
+	std::string _name;
+
+	std::shared_ptr<Database> _database;
+	std::shared_ptr<LogArchive> _log_archive;
+	HandoffCallback _handoff;
+	StateCallback _state_changed;
+
+	std::shared_ptr<mavsdk::System> _system;
+	std::shared_ptr<mavsdk::Telemetry> _telemetry;
+	std::shared_ptr<mavsdk::LogFiles> _log_files;
+	std::shared_ptr<mavsdk::MavlinkPassthrough> _mavlink_passthrough;
+	std::unique_ptr<LogDownloader> _log_downloader;
+	std::unique_ptr<LogList> _log_list;
+	DownloadScheduler _scheduler; // Only used on the vehicle's thread
+
+	std::thread _thread;
+	std::atomic<bool> _should_exit = false;
+	std::condition_variable _exit_cv;
+	std::mutex _exit_cv_mutex;
+
+	// Vehicle state, written by the MAVSDK callbacks while holding _exit_cv_mutex
+	std::atomic<bool> _armed = false;
+	std::atomic<bool> _logger_running = false;
+	std::atomic<bool> _logger_reported = false; // The autopilot has the logger flag in SYS_STATUS
+	std::atomic<bool> _list_stale = true;       // Connected again or flown since the log list was requested
+	std::chrono::steady_clock::time_point _armed_time {};
+	mavsdk::System::IsConnectedHandle _connected_handle;
+	mavsdk::Telemetry::ArmedHandle _armed_handle;
+	mavsdk::MavlinkPassthrough::MessageHandle _sys_status_handle;
+
+	bool _loop_disabled = false; // run() has seen the vehicle armed, only used on the vehicle's thread
+	std::atomic<int64_t> _progress_time {}; // Rate limits the progress lines of this vehicle
+};
@@ -0,0 +1,104 @@
+#include "XXHash64.hpp"
+
+#include <cstring>
+
+static constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static constexpr uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+// The spec reads input as little endian, which is what all our targets are
+static inline uint64_t read64(const uint8_t* p)
+{
+	uint64_t value;
+	std::memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t read32(const uint8_t* p)
+{
+	uint32_t value;
+	std::memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t round(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME64_2;
+	acc = rotl(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t value)
+{
+	acc ^= round(0, value);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t xxhash64(const void* data, size_t length, uint64_t seed)
+{
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	const uint8_t* end = p + length;
+	uint64_t hash;
+
+	if (length >= 32) {
+		uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+		uint64_t v2 = seed + PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME64_1;
+
+		// Four lanes of 8 bytes per 32 byte stripe
+		do {
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+			p += 32;
+		} while (p + 32 <= end);
+
+		hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		hash = merge_round(hash, v1);
+		hash = merge_round(hash, v2);
+		hash = merge_round(hash, v3);
+		hash = merge_round(hash, v4);
+
+	} else {
+		hash = seed + PRIME64_5;
+	}
+
+	hash += length;
+
+	// Remaining input in 8, 4 and 1 byte steps
+	while (p + 8 <= end) {
+		hash ^= round(0, read64(p));
+		hash = rotl(hash, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+
+	if (p + 4 <= end) {
+		hash ^= uint64_t(read32(p)) * PRIME64_1;
+		hash = rotl(hash, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+
+	while (p < end) {
+		hash ^= (*p) * PRIME64_5;
+		hash = rotl(hash, 11) * PRIME64_1;
+		p++;
+	}
+
+	// Avalanche
+	hash ^= hash >> 33;
+	hash *= PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= PRIME64_3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
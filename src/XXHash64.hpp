@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// XXH64 from the xxHash specification (https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md).
+// Unlike std::hash the result is fixed by the spec, so values stored on disk stay valid across
+// compilers and standard library versions.
+uint64_t xxhash64(const void* data, size_t length, uint64_t seed = 0);
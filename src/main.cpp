@@ -13,7 +13,6 @@ int main()
 {
 	signal(SIGINT, signal_handler);
 	signal(SIGTERM, signal_handler);
-	setbuf(stdout, NULL); // Disable stdout buffering
 
 	toml::table config;
 
@@ -29,6 +28,22 @@ int main()
 		return -1;
 	}
 
+	// Log lines are written by a background thread from here on
+	Logger::Settings log_settings = {
+		.level = Logger::instance().level(),
+		.json = config["log_json"].value_or(false),
+		.progress_interval = std::chrono::milliseconds(config["log_progress_interval_ms"].value_or(1000)),
+	};
+
+	if (auto level = config["log_level"].value<std::string>()) {
+		if (!Logger::parse_level(*level, log_settings.level)) {
+			std::cerr << "Invalid log_level: " << *level << "\n";
+			return -1;
+		}
+	}
+
+	Logger::instance().start(log_settings);
+
 	// Setup the LogLoader
 	LogLoader::Settings settings = {
 		.email = config["email"].value_or(""),
@@ -37,9 +52,78 @@ int main()
 		.mavsdk_connection_url = config["connection_url"].value_or("0.0.0"),
 		.application_directory = std::string(getenv("HOME")) + "/.local/share/logloader/",
 		.upload_enabled = config["upload_enabled"].value_or(false),
-		.public_logs = config["public_logs"].value_or(false)
+		.public_logs = config["public_logs"].value_or(false),
+		.max_concurrent_uploads = config["max_concurrent_uploads"].value_or(2u),
+		.compress_logs = config["compress_logs"].value_or(false),
+		.compression_level = config["compression_level"].value_or(3),
+		.metrics_port = config["metrics_port"].value_or(uint16_t(0)),
+		.download_scheduler = {
+			.initial_window = std::chrono::seconds(config["download_window_s"].value_or(600)),
+			.trace_path = config["download_trace"].value_or(""),
+		},
+		.log_downloader = {
+			.pacing = {
+				.link_reserve = config["download_link_reserve"].value_or(0.2),
+				.max_burst = std::chrono::milliseconds(config["download_max_burst_ms"].value_or(250)),
+			},
+		},
+		.upload_retry = {
+			.initial = std::chrono::seconds(config["upload_retry_s"].value_or(30)),
+			.max = std::chrono::seconds(config["upload_retry_max_s"].value_or(3600)),
+		},
+		.circuit_breaker = {
+			.failure_threshold = config["circuit_breaker_failures"].value_or(3u),
+			.cooldown = {
+				.initial = std::chrono::seconds(config["circuit_breaker_cooldown_s"].value_or(30)),
+				.max = std::chrono::seconds(config["circuit_breaker_cooldown_max_s"].value_or(900)),
+			},
+		},
+		.health_check_interval = std::chrono::seconds(config["health_check_interval_s"].value_or(30)),
+		.health_retry_interval = std::chrono::seconds(config["health_retry_interval_s"].value_or(5)),
+		.retention = {
+			.logs_directory = "",
+			.quota_bytes = config["retention_quota_mb"].value_or(uint64_t(0)) * 1000 * 1000,
+			.high_watermark = config["retention_high_watermark"].value_or(0.9),
+			.low_watermark = config["retention_low_watermark"].value_or(0.8),
+		},
+		.backends = {}
 	};
 
+	if (auto policy = config["download_policy"].value<std::string>()) {
+		if (!DownloadScheduler::parse_policy(*policy, settings.download_scheduler.policy)) {
+			std::cerr << "Invalid download_policy: " << *policy << "\n";
+			return -1;
+		}
+	}
+
+	if (auto policy = config["retention_policy"].value<std::string>()) {
+		if (!RetentionManager::parse_policy(*policy, settings.retention.policy)) {
+			std::cerr << "Invalid retention_policy: " << *policy << "\n";
+			return -1;
+		}
+	}
+
+	// Additional upload backends
+	if (auto backends = config["backends"].as_array()) {
+		for (const auto& node : *backends) {
+			auto backend = node.as_table();
+
+			if (!backend) {
+				continue;
+			}
+
+			settings.backends.push_back({
+				.name = (*backend)["name"].value_or(""),
+				.server_url = (*backend)["url"].value_or(""),
+				.user_email = (*backend)["email"].value_or(""),
+				.upload_enabled = (*backend)["upload_enabled"].value_or(false),
+				.public_logs = (*backend)["public_logs"].value_or(false),
+				.max_concurrent_uploads = (*backend)["max_concurrent_uploads"].value_or(settings.max_concurrent_uploads),
+				.accepts_compressed = (*backend)["accepts_compressed"].value_or(false),
+			});
+		}
+	}
+
 	_log_loader = std::make_shared<LogLoader>(settings);
 
 	bool connected = false;
@@ -54,6 +138,8 @@ int main()
 
 	LOG("Exiting.");
 
+	Logger::instance().stop();
+
 	return 0;
 }
 